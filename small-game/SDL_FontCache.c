@@ -69,11 +69,12 @@ __inline int c99_snprintf(char *outBuf, size_t size, const char *format, ...)
 #endif
 
 
+// Formats into the calling thread's scratch text, see FC_GetScratch()
 #define FC_EXTRACT_VARARGS(buffer, start_args) \
 { \
     va_list lst; \
     va_start(lst, start_args); \
-    vsnprintf(buffer, fc_buffer_size, start_args, lst); \
+    buffer = FC_FormatScratch(start_args, lst); \
     va_end(lst); \
 }
 
@@ -144,21 +145,98 @@ static char* new_concat(const char* a, const char* b)
     return new_string;
 }
 
-static char* replace_concat(char** a, const char* b)
+
+
+// Size of the scratch text each thread unpacks variadic text into
+static unsigned int fc_buffer_size = 1024;
+
+// A line of laid out text, [start, end) of the scratch text
+typedef struct FC_LineSpan
+{
+    const char* start;
+    const char* end;
+} FC_LineSpan;
+
+// Per thread memory for formatting and laying out text, so the FC_Get*() functions can measure and wrap text on
+// several threads at once.  It's kept for the life of the thread and only grows, so drawing text doesn't allocate.
+typedef struct FC_Scratch
 {
-    char* new_string = new_concat(*a, b);
-    free(*a);
-    *a = new_string;
-    return *a;
+    char* text;
+    unsigned int text_size;
+    FC_LineSpan* lines;
+    int line_capacity;
+} FC_Scratch;
+
+static SDL_TLSID fc_scratch_tls = 0;
+static SDL_SpinLock fc_scratch_lock = 0;
+
+static void FC_FreeScratch(void* data)
+{
+    FC_Scratch* scratch = (FC_Scratch*)data;
+    free(scratch->text);
+    free(scratch->lines);
+    free(scratch);
 }
 
+static FC_Scratch* FC_GetScratch(void)
+{
+    FC_Scratch* scratch;
+
+    // FC_Init() creates the slot on the main thread, this only covers text functions used before any font
+    if(fc_scratch_tls == 0)
+    {
+        SDL_AtomicLock(&fc_scratch_lock);
+        if(fc_scratch_tls == 0)
+            fc_scratch_tls = SDL_TLSCreate();
+        SDL_AtomicUnlock(&fc_scratch_lock);
+    }
+
+    scratch = (FC_Scratch*)SDL_TLSGet(fc_scratch_tls);
+    if(scratch == NULL)
+    {
+        scratch = (FC_Scratch*)calloc(1, sizeof(FC_Scratch));
+        if(scratch == NULL)
+            return NULL;
+        if(SDL_TLSSet(fc_scratch_tls, scratch, FC_FreeScratch) < 0)
+        {
+            free(scratch);
+            return NULL;
+        }
+    }
 
+    if(scratch->text_size != fc_buffer_size)
+    {
+        char* new_text = (char*)realloc(scratch->text, fc_buffer_size);
+        if(new_text == NULL)
+            return NULL;
+        scratch->text = new_text;
+        scratch->text_size = fc_buffer_size;
+    }
+    return scratch;
+}
 
+static Uint8 FC_GrowScratchLines(FC_Scratch* scratch)
+{
+    int capacity = (scratch->line_capacity > 0? 2*scratch->line_capacity : 16);
+    FC_LineSpan* new_lines = (FC_LineSpan*)realloc(scratch->lines, capacity * sizeof(FC_LineSpan));
+    if(new_lines == NULL)
+        return 0;
 
+    scratch->lines = new_lines;
+    scratch->line_capacity = capacity;
+    return 1;
+}
 
-// Shared buffer for variadic text
-static char* fc_buffer = NULL;
-static unsigned int fc_buffer_size = 1024;
+// Returns the formatted text in the scratch of this thread, valid until the next call on the thread
+static const char* FC_FormatScratch(const char* format, va_list args)
+{
+    FC_Scratch* scratch = FC_GetScratch();
+    if(scratch == NULL)
+        return "";
+
+    vsnprintf(scratch->text, scratch->text_size, format, args);
+    return scratch->text;
+}
 
 static Uint8 fc_has_render_target_support = 0;
 
@@ -269,151 +347,200 @@ FC_GlyphData FC_MakeGlyphData(int cache_level, Sint16 x, Sint16 y, Uint16 w, Uin
     gd.rect.w = w;
     gd.rect.h = h;
     gd.cache_level = cache_level;
+    gd.offset_y = 0;
 
     return gd;
 }
 
-// Enough to hold all of the ascii characters and some.
-#define FC_DEFAULT_NUM_BUCKETS 300
+// Glyphs by codepoint. Codepoints below FC_MAP_DIRECT_SIZE (all of ASCII) index a plain array, the rest
+// go in an open addressing hash table with linear probing. Both are flat, so a lookup is a single index
+// or a short scan of adjacent entries instead of a walk over separately allocated nodes.
+// Each glyph also keeps the use clock of its last lookup, for evicting the least recently used ones.
+#define FC_MAP_DIRECT_SIZE 256
+#define FC_MAP_INITIAL_CAPACITY 64  // Must be a power of two
+#define FC_MAP_EMPTY_KEY 0xFFFFFFFF  // 0xFF never appears in UTF-8, so no codepoint packs to this
 
-typedef struct FC_MapNode
+typedef struct FC_MapEntry
 {
     Uint32 key;
     FC_GlyphData value;
-    struct FC_MapNode* next;
-
-} FC_MapNode;
+    Uint32 last_use;
+} FC_MapEntry;
 
 typedef struct FC_Map
 {
-    int num_buckets;
-    FC_MapNode** buckets;
+    FC_GlyphData direct[FC_MAP_DIRECT_SIZE];
+    Uint8 direct_used[FC_MAP_DIRECT_SIZE];
+    Uint32 direct_last_use[FC_MAP_DIRECT_SIZE];
+    unsigned int num_direct;
+
+    // Advances on every insert, so lookups between two misses share a stamp and it does not wrap in practice
+    Uint32 use_clock;
+
+    FC_MapEntry* entries;
+    unsigned int capacity;
+    unsigned int count;
 } FC_Map;
 
 
+static_inline Uint32 FC_MapHash(Uint32 codepoint)
+{
+    // Multiplicative hash, folded so the high bits reach the mask too
+    Uint32 h = codepoint * 2654435761u;
+    return h ^ (h >> 16);
+}
 
-static FC_Map* FC_MapCreate(int num_buckets)
+static FC_MapEntry* FC_MapAllocEntries(unsigned int capacity)
 {
-    int i;
-    FC_Map* map = (FC_Map*)malloc(sizeof(FC_Map));
+    unsigned int i;
+    FC_MapEntry* entries = (FC_MapEntry*)malloc(capacity * sizeof(FC_MapEntry));
+    if(entries == NULL)
+        return NULL;
+    for(i = 0; i < capacity; ++i)
+        entries[i].key = FC_MAP_EMPTY_KEY;
+    return entries;
+}
 
-    map->num_buckets = num_buckets;
-    map->buckets = (FC_MapNode**)malloc(num_buckets * sizeof(FC_MapNode*));
+static FC_Map* FC_MapCreate(void)
+{
+    FC_Map* map = (FC_Map*)malloc(sizeof(FC_Map));
+    if(map == NULL)
+        return NULL;
 
-    for(i = 0; i < num_buckets; ++i)
+    memset(map->direct_used, 0, sizeof(map->direct_used));
+    map->num_direct = 0;
+    map->use_clock = 0;
+    map->capacity = FC_MAP_INITIAL_CAPACITY;
+    map->count = 0;
+    map->entries = FC_MapAllocEntries(map->capacity);
+    if(map->entries == NULL)
     {
-        map->buckets[i] = NULL;
+        free(map);
+        return NULL;
     }
 
     return map;
 }
 
-/*static void FC_MapClear(FC_Map* map)
+static void FC_MapFree(FC_Map* map)
 {
-    int i;
     if(map == NULL)
         return;
 
-    // Go through each bucket
-    for(i = 0; i < map->num_buckets; ++i)
-    {
-        // Delete the nodes in order
-        FC_MapNode* node = map->buckets[i];
-        while(node != NULL)
-        {
-            FC_MapNode* last = node;
-            node = node->next;
-            free(last);
-        }
-        // Set the bucket to empty
-        map->buckets[i] = NULL;
-    }
-}*/
+    free(map->entries);
+    free(map);
+}
 
-static void FC_MapFree(FC_Map* map)
+// Returns the slot holding codepoint, or the empty slot where it would go
+static FC_MapEntry* FC_MapProbe(FC_MapEntry* entries, unsigned int capacity, Uint32 codepoint)
 {
-    int i;
-    if(map == NULL)
-        return;
+    Uint32 mask = capacity - 1;
+    Uint32 index = FC_MapHash(codepoint) & mask;
+    while(entries[index].key != codepoint && entries[index].key != FC_MAP_EMPTY_KEY)
+        index = (index + 1) & mask;
+    return &entries[index];
+}
+
+static int FC_MapGrow(FC_Map* map)
+{
+    unsigned int i;
+    unsigned int new_capacity = map->capacity * 2;
+    FC_MapEntry* new_entries = FC_MapAllocEntries(new_capacity);
+    if(new_entries == NULL)
+        return 0;
 
-    // Go through each bucket
-    for(i = 0; i < map->num_buckets; ++i)
+    for(i = 0; i < map->capacity; ++i)
     {
-        // Delete the nodes in order
-        FC_MapNode* node = map->buckets[i];
-        while(node != NULL)
-        {
-            FC_MapNode* last = node;
-            node = node->next;
-            free(last);
-        }
+        if(map->entries[i].key != FC_MAP_EMPTY_KEY)
+            *FC_MapProbe(new_entries, new_capacity, map->entries[i].key) = map->entries[i];
     }
 
-    free(map->buckets);
-    free(map);
+    free(map->entries);
+    map->entries = new_entries;
+    map->capacity = new_capacity;
+    return 1;
 }
 
-// Note: Does not handle duplicates in any special way.
+// Inserting an existing codepoint replaces its glyph.
+// The returned pointer is only valid until the next insert.
 static FC_GlyphData* FC_MapInsert(FC_Map* map, Uint32 codepoint, FC_GlyphData glyph)
 {
-    Uint32 index;
-    FC_MapNode* node;
+    FC_MapEntry* entry;
     if(map == NULL)
         return NULL;
 
-    // Get index for bucket
-    index = codepoint % map->num_buckets;
-
-    // If this bucket is empty, create a node and return its value
-    if(map->buckets[index] == NULL)
+    map->use_clock++;
+    if(codepoint < FC_MAP_DIRECT_SIZE)
     {
-        node = map->buckets[index] = (FC_MapNode*)malloc(sizeof(FC_MapNode));
-        node->key = codepoint;
-        node->value = glyph;
-        node->next = NULL;
-        return &node->value;
+        if(!map->direct_used[codepoint])
+        {
+            map->direct_used[codepoint] = 1;
+            map->num_direct++;
+        }
+        map->direct[codepoint] = glyph;
+        map->direct_last_use[codepoint] = map->use_clock;
+        return &map->direct[codepoint];
     }
 
-    for(node = map->buckets[index]; node != NULL; node = node->next)
-    {
-        // Find empty node and add a new one on.
-        if(node->next == NULL)
-        {
-            node->next = (FC_MapNode*)malloc(sizeof(FC_MapNode));
-            node = node->next;
+    // Keep the load factor at or below one half so probe sequences stay short
+    if((map->count + 1) * 2 > map->capacity && !FC_MapGrow(map))
+        return NULL;
 
-            node->key = codepoint;
-            node->value = glyph;
-            node->next = NULL;
-            return &node->value;
-        }
+    entry = FC_MapProbe(map->entries, map->capacity, codepoint);
+    if(entry->key == FC_MAP_EMPTY_KEY)
+    {
+        entry->key = codepoint;
+        map->count++;
     }
+    entry->value = glyph;
+    entry->last_use = map->use_clock;
+    return &entry->value;
+}
+
+// Same as FC_MapFind() without marking the glyph used, so several threads can look up at once
+static FC_GlyphData* FC_MapPeek(FC_Map* map, Uint32 codepoint)
+{
+    FC_MapEntry* entry;
+    if(map == NULL)
+        return NULL;
+
+    if(codepoint < FC_MAP_DIRECT_SIZE)
+        return (map->direct_used[codepoint]? &map->direct[codepoint] : NULL);
 
-    return NULL;
+    entry = FC_MapProbe(map->entries, map->capacity, codepoint);
+    if(entry->key == FC_MAP_EMPTY_KEY)
+        return NULL;
+    return &entry->value;
 }
 
 static FC_GlyphData* FC_MapFind(FC_Map* map, Uint32 codepoint)
 {
-    Uint32 index;
-    FC_MapNode* node;
+    FC_MapEntry* entry;
     if(map == NULL)
         return NULL;
 
-    // Get index for bucket
-    index = codepoint % map->num_buckets;
-
-    // Go through list until we find a match
-    for(node = map->buckets[index]; node != NULL; node = node->next)
+    if(codepoint < FC_MAP_DIRECT_SIZE)
     {
-        if(node->key == codepoint)
-            return &node->value;
+        if(!map->direct_used[codepoint])
+            return NULL;
+        map->direct_last_use[codepoint] = map->use_clock;
+        return &map->direct[codepoint];
     }
 
-    return NULL;
+    entry = FC_MapProbe(map->entries, map->capacity, codepoint);
+    if(entry->key == FC_MAP_EMPTY_KEY)
+        return NULL;
+    entry->last_use = map->use_clock;
+    return &entry->value;
 }
 
 
 
+typedef struct FC_SkylineNode
+{
+    int x, y, w;
+} FC_SkylineNode;
+
 struct FC_Font
 {
     #ifndef FC_USE_SDL_GPU
@@ -422,6 +549,7 @@ struct FC_Font
 
     TTF_Font* ttf_source;  // TTF_Font source of characters
     Uint8 owns_ttf_source;  // Can we delete the TTF_Font ourselves?
+    void* ttf_data;  // Font file the TTF_Font reads from, when it was loaded into memory
 
     FC_FilterEnum filter;
 
@@ -440,22 +568,104 @@ struct FC_Font
     // Codepoints are little endian (reversed from UTF-8) so that something like 0x00000005 is ASCII 5 and the map can be indexed by ASCII values
     FC_Map* glyphs;
 
-    FC_GlyphData last_glyph;  // Texture packing cursor
+    FC_GlyphData last_glyph;  // Last glyph packed, FC_AddGlyphToCache() draws there
+    // Skyline of the cache level being packed: the top of its used area as runs from left to right
+    FC_SkylineNode* skyline;
+    int skyline_size;
+    int skyline_capacity;
     int glyph_cache_size;
     int glyph_cache_count;
     FC_Image** glyph_cache;
 
     char* loading_string;
+    FC_LoadModeEnum load_mode;
+    char* atlas_cache_dir;  // Where packed atlases are saved and loaded from, NULL to always rasterize
+
+    Uint32 layout_generation;  // Changes whenever laid out glyph positions may be stale, see FC_Text
+
+    Uint8 distance_field;  // The cache levels hold distance fields instead of coverage, see FC_MakeDistanceField()
+
+    Uint32 cache_budget;  // Bytes of cache levels before cold glyphs are evicted, 0 for no limit
+    Uint32 cache_hits;
+    Uint32 cache_misses;
+    Uint32 cache_evictions;
+    Uint32 cache_repacks;
+
+    SDL_threadID owner_thread;  // Loaded the font, the only thread that adds glyphs to the cache levels
+
+    // Lets other threads read the glyph map while the owner thread changes it, see FC_BeginGlyphRead()
+    SDL_mutex* glyphs_mutex;
+    SDL_cond* glyphs_cond;
+    int glyphs_readers;
+    Uint8 glyphs_writing;
 
 };
 
 // Private
-static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, Uint16 width, Uint16 maxWidth, Uint16 maxHeight);
+static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, Uint16 width, Uint16 height, int offset_y, Uint16 maxWidth, Uint16 maxHeight);
+static Uint8 FC_SkylineInsert(FC_Font* font, int width, int height, int maxWidth, int maxHeight, int* result_x, int* result_y);
 
 
 static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text);
 static FC_Rect FC_RenderCenter(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text);
 static FC_Rect FC_RenderRight(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text);
+static FC_Rect FC_RenderAlignedSpan(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, FC_AlignEnum align, const char* text, const char* end);
+static Uint16 FC_GetSpanWidth(FC_Font* font, const char* text, const char* end);
+
+
+// A reader/writer lock over font->glyphs built from a mutex, since SDL has no rwlock.
+// Threads other than the owner read the map between FC_BeginGlyphRead() and FC_EndGlyphRead(), which never nest.
+// The owner thread reads without it, as it is the only writer, and wraps each change in FC_BeginGlyphWrite() and
+// FC_EndGlyphWrite(). A waiting writer holds off new readers, so the owner can't be starved by busy workers.
+static void FC_BeginGlyphRead(FC_Font* font)
+{
+    if(font->glyphs_mutex == NULL)
+        return;
+    SDL_LockMutex(font->glyphs_mutex);
+    while(font->glyphs_writing)
+        SDL_CondWait(font->glyphs_cond, font->glyphs_mutex);
+    font->glyphs_readers++;
+    SDL_UnlockMutex(font->glyphs_mutex);
+}
+
+static void FC_EndGlyphRead(FC_Font* font)
+{
+    if(font->glyphs_mutex == NULL)
+        return;
+    SDL_LockMutex(font->glyphs_mutex);
+    if(--font->glyphs_readers == 0)
+        SDL_CondBroadcast(font->glyphs_cond);
+    SDL_UnlockMutex(font->glyphs_mutex);
+}
+
+static void FC_BeginGlyphWrite(FC_Font* font)
+{
+    if(font->glyphs_mutex == NULL)
+        return;
+    SDL_LockMutex(font->glyphs_mutex);
+    font->glyphs_writing = 1;
+    while(font->glyphs_readers > 0)
+        SDL_CondWait(font->glyphs_cond, font->glyphs_mutex);
+}
+
+static void FC_EndGlyphWrite(FC_Font* font)
+{
+    if(font->glyphs_mutex == NULL)
+        return;
+    font->glyphs_writing = 0;
+    SDL_CondBroadcast(font->glyphs_cond);
+    SDL_UnlockMutex(font->glyphs_mutex);
+}
+
+// FC_MapInsert() into the font's glyphs, safe against other threads measuring
+static FC_GlyphData* FC_InsertGlyph(FC_Font* font, Uint32 codepoint, FC_GlyphData glyph)
+{
+    FC_GlyphData* result;
+    FC_BeginGlyphWrite(font);
+    result = FC_MapInsert(font->glyphs, codepoint, glyph);
+    FC_EndGlyphWrite(font);
+    return result;
+}
 
 
 static_inline SDL_Surface* FC_CreateSurface32(Uint32 width, Uint32 height)
@@ -467,6 +677,16 @@ static_inline SDL_Surface* FC_CreateSurface32(Uint32 width, Uint32 height)
     #endif
 }
 
+// Same format as FC_CreateSurface32(), over existing tightly packed pixels
+static_inline SDL_Surface* FC_CreateSurface32From(void* pixels, Uint32 width, Uint32 height)
+{
+    #if SDL_BYTEORDER == SDL_BIG_ENDIAN
+        return SDL_CreateRGBSurfaceFrom(pixels, width, height, 32, 4*width, 0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
+    #else
+        return SDL_CreateRGBSurfaceFrom(pixels, width, height, 32, 4*width, 0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000);
+    #endif
+}
+
 
 char* U8_alloc(unsigned int size)
 {
@@ -810,6 +1030,39 @@ void FC_SetLoadingString(FC_Font* font, const char* string)
     font->loading_string = U8_strdup(string);
 }
 
+void FC_SetLoadMode(FC_Font* font, FC_LoadModeEnum mode)
+{
+    if(font == NULL)
+        return;
+
+    font->load_mode = mode;
+}
+
+void FC_SetAtlasCacheDir(FC_Font* font, const char* directory)
+{
+    if(font == NULL)
+        return;
+
+    free(font->atlas_cache_dir);
+    font->atlas_cache_dir = (directory == NULL? NULL : U8_strdup(directory));
+}
+
+void FC_SetDistanceField(FC_Font* font, Uint8 enable)
+{
+    if(font == NULL)
+        return;
+
+    font->distance_field = enable;
+}
+
+void FC_SetCacheBudget(FC_Font* font, Uint32 max_bytes)
+{
+    if(font == NULL)
+        return;
+
+    font->cache_budget = max_bytes;
+}
+
 
 unsigned int FC_GetBufferSize(void)
 {
@@ -818,14 +1071,9 @@ unsigned int FC_GetBufferSize(void)
 
 void FC_SetBufferSize(unsigned int size)
 {
-    free(fc_buffer);
+    // Each thread resizes its scratch text the next time it formats
     if(size > 0)
-    {
         fc_buffer_size = size;
-        fc_buffer = (char*)malloc(fc_buffer_size);
-    }
-    else
-        fc_buffer = (char*)malloc(fc_buffer_size);
 }
 
 
@@ -863,17 +1111,28 @@ static void FC_Init(FC_Font* font)
     font->lineSpacing = 0;
     font->letterSpacing = 0;
 
+    font->layout_generation++;
+
+    font->cache_hits = 0;
+    font->cache_misses = 0;
+    font->cache_evictions = 0;
+    font->cache_repacks = 0;
+
+    font->owner_thread = SDL_ThreadID();
+
     // Give a little offset for when filtering/mipmaps are used.  Depending on mipmap level, this will still not be enough.
     font->last_glyph.rect.x = FC_CACHE_PADDING;
     font->last_glyph.rect.y = FC_CACHE_PADDING;
     font->last_glyph.rect.w = 0;
     font->last_glyph.rect.h = 0;
     font->last_glyph.cache_level = 0;
+    font->last_glyph.offset_y = 0;
+    font->skyline_size = 0;
 
     if(font->glyphs != NULL)
         FC_MapFree(font->glyphs);
 
-    font->glyphs = FC_MapCreate(FC_DEFAULT_NUM_BUCKETS);
+    font->glyphs = FC_MapCreate();
 
     font->glyph_cache_size = 3;
     font->glyph_cache_count = 0;
@@ -884,8 +1143,8 @@ static void FC_Init(FC_Font* font)
 	if (font->loading_string == NULL)
 		font->loading_string = FC_GetStringASCII();
 
-    if(fc_buffer == NULL)
-        fc_buffer = (char*)malloc(fc_buffer_size);
+    if(fc_scratch_tls == 0)
+        fc_scratch_tls = SDL_TLSCreate();
 }
 
 static Uint8 FC_GrowGlyphCache(FC_Font* font)
@@ -896,7 +1155,13 @@ static Uint8 FC_GrowGlyphCache(FC_Font* font)
     GPU_Image* new_level = GPU_CreateImage(font->height * 12, font->height * 12, GPU_FORMAT_RGBA);
     GPU_SetAnchor(new_level, 0.5f, 0.5f);  // Just in case the default is different
     #else
-    SDL_Texture* new_level = SDL_CreateTexture(font->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, font->height * 12, font->height * 12);
+    // Same filter mode as FC_UploadGlyphCache() gives the levels made at load
+    char old_filter_mode[16];
+    SDL_Texture* new_level;
+    snprintf(old_filter_mode, 16, "%s", SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY));
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, FC_GetFilterMode(font) == FC_FILTER_LINEAR? "1" : "0");
+    new_level = SDL_CreateTexture(font->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, font->height * 12, font->height * 12);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, old_filter_mode);
     #endif
     if(new_level == NULL || !FC_SetGlyphCacheLevel(font, font->glyph_cache_count, new_level))
     {
@@ -1045,37 +1310,198 @@ Uint8 FC_UploadGlyphCache(FC_Font* font, int cache_level, SDL_Surface* data_surf
     return 1;
 }
 
-static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, Uint16 width, Uint16 maxWidth, Uint16 maxHeight)
+// Returns where a width x height rect starting at skyline node index would rest, or -1 if it goes past the level
+static int FC_SkylineFit(FC_Font* font, int index, int width, int height, int maxWidth, int maxHeight)
 {
-    FC_Map* glyphs = font->glyphs;
-    FC_GlyphData* last_glyph = &font->last_glyph;
-    Uint16 height = font->height + FC_CACHE_PADDING;
+    FC_SkylineNode* nodes = font->skyline;
+    int y = 0;
+    int remaining = width;
+
+    if(nodes[index].x + width > maxWidth)
+        return -1;
+
+    for(; remaining > 0; ++index)
+    {
+        if(index >= font->skyline_size)
+            return -1;
+        y = FC_MAX(y, nodes[index].y);
+        if(y + height > maxHeight)
+            return -1;
+        remaining -= nodes[index].w;
+    }
+
+    return y;
+}
+
+// Bottom-left skyline packing: each rect goes where its bottom is lowest, then on the narrowest run
+static Uint8 FC_SkylineInsert(FC_Font* font, int width, int height, int maxWidth, int maxHeight, int* result_x, int* result_y)
+{
+    FC_SkylineNode* nodes;
+    int best_index = -1;
+    int best_bottom = 0;
+    int best_width = 0;
+    int best_y = 0;
+    int i, y, shrink;
+
+    if(font->skyline_size + 1 > font->skyline_capacity)
+    {
+        int new_capacity = FC_MAX(32, font->skyline_capacity * 2);
+        FC_SkylineNode* new_skyline = (FC_SkylineNode*)realloc(font->skyline, new_capacity * sizeof(FC_SkylineNode));
+        if(new_skyline == NULL)
+            return 0;
+        font->skyline = new_skyline;
+        font->skyline_capacity = new_capacity;
+    }
+    nodes = font->skyline;
+
+    if(font->skyline_size == 0)
+    {
+        nodes[0].x = FC_CACHE_PADDING;
+        nodes[0].y = FC_CACHE_PADDING;
+        nodes[0].w = maxWidth - FC_CACHE_PADDING;
+        font->skyline_size = 1;
+    }
 
-    if(last_glyph->rect.x + last_glyph->rect.w + width >= maxWidth - FC_CACHE_PADDING)
+    for(i = 0; i < font->skyline_size; ++i)
     {
-        if(last_glyph->rect.y + height + height >= maxHeight - FC_CACHE_PADDING)
+        y = FC_SkylineFit(font, i, width, height, maxWidth, maxHeight);
+        if(y < 0)
+            continue;
+        if(best_index < 0 || y + height < best_bottom || (y + height == best_bottom && nodes[i].w < best_width))
         {
-            // Get ready to pack on the next cache level when it is ready
-            last_glyph->cache_level = font->glyph_cache_count;
-            last_glyph->rect.x = FC_CACHE_PADDING;
-            last_glyph->rect.y = FC_CACHE_PADDING;
-            last_glyph->rect.w = 0;
-            return NULL;
+            best_index = i;
+            best_bottom = y + height;
+            best_width = nodes[i].w;
+            best_y = y;
         }
-        else
+    }
+
+    if(best_index < 0)
+        return 0;
+
+    *result_x = nodes[best_index].x;
+    *result_y = best_y;
+
+    // The rect becomes a new run, cutting into the runs it covers
+    memmove(&nodes[best_index + 1], &nodes[best_index], (font->skyline_size - best_index) * sizeof(FC_SkylineNode));
+    nodes[best_index].y = best_y + height;
+    nodes[best_index].w = width;
+    font->skyline_size++;
+
+    for(i = best_index + 1; i < font->skyline_size;)
+    {
+        shrink = nodes[i-1].x + nodes[i-1].w - nodes[i].x;
+        if(shrink <= 0)
+            break;
+        nodes[i].x += shrink;
+        nodes[i].w -= shrink;
+        if(nodes[i].w > 0)
+            break;
+        memmove(&nodes[i], &nodes[i + 1], (font->skyline_size - i - 1) * sizeof(FC_SkylineNode));
+        font->skyline_size--;
+    }
+
+    for(i = 0; i + 1 < font->skyline_size;)
+    {
+        if(nodes[i].y == nodes[i + 1].y)
         {
-            // Go to next row
-            last_glyph->rect.x = FC_CACHE_PADDING;
-            last_glyph->rect.y += height;
-            last_glyph->rect.w = 0;
+            nodes[i].w += nodes[i + 1].w;
+            memmove(&nodes[i + 1], &nodes[i + 2], (font->skyline_size - i - 2) * sizeof(FC_SkylineNode));
+            font->skyline_size--;
         }
+        else
+            ++i;
+    }
+
+    return 1;
+}
+
+// Lowest free row of the level being packed
+static int FC_SkylineTop(FC_Font* font)
+{
+    int i;
+    int top = FC_CACHE_PADDING;
+    for(i = 0; i < font->skyline_size; ++i)
+        top = FC_MAX(top, font->skyline[i].y);
+    return top;
+}
+
+static FC_GlyphData* FC_PackGlyphData(FC_Font* font, Uint32 codepoint, Uint16 width, Uint16 height, int offset_y, Uint16 maxWidth, Uint16 maxHeight)
+{
+    FC_GlyphData* last_glyph = &font->last_glyph;
+    int x, y;
+
+    // Blank glyphs like the space only need their advance, they take no room in the cache
+    if(height == 0)
+        return FC_InsertGlyph(font, codepoint, FC_MakeGlyphData(last_glyph->cache_level, 0, 0, width, 0));
+
+    // Each glyph keeps FC_CACHE_PADDING free pixels to its right and below, and the level edges start padded
+    if(!FC_SkylineInsert(font, width + FC_CACHE_PADDING, height + FC_CACHE_PADDING, maxWidth, maxHeight, &x, &y))
+    {
+        // Get ready to pack on the next cache level when it is ready
+        last_glyph->cache_level = font->glyph_cache_count;
+        last_glyph->rect.x = FC_CACHE_PADDING;
+        last_glyph->rect.y = FC_CACHE_PADDING;
+        last_glyph->rect.w = 0;
+        last_glyph->rect.h = 0;
+        font->skyline_size = 0;
+        return NULL;
     }
 
-    // Move to next space
-    last_glyph->rect.x += last_glyph->rect.w + 1 + FC_CACHE_PADDING;
+    last_glyph->rect.x = x;
+    last_glyph->rect.y = y;
     last_glyph->rect.w = width;
+    last_glyph->rect.h = height;
+    last_glyph->offset_y = offset_y;
+
+    return FC_InsertGlyph(font, codepoint, *last_glyph);
+}
+
+// Finds the rows of a rendered glyph with any coverage.  SDL_ttf renders every glyph at the full line height.
+static void FC_GetGlyphRows(SDL_Surface* surface, int* top, int* height)
+{
+    int x, y;
+    int first = -1;
+    int last = -1;
+    Uint32 amask = surface->format->Amask;
+    const Uint32* row;
+
+    if(surface->format->BytesPerPixel != 4 || amask == 0)
+    {
+        *top = 0;
+        *height = surface->h;
+        return;
+    }
+
+    if(SDL_MUSTLOCK(surface))
+        SDL_LockSurface(surface);
+    for(y = 0; y < surface->h; ++y)
+    {
+        row = (const Uint32*)((const Uint8*)surface->pixels + y * surface->pitch);
+        for(x = 0; x < surface->w; ++x)
+        {
+            if(row[x] & amask)
+            {
+                if(first < 0)
+                    first = y;
+                last = y;
+                break;
+            }
+        }
+    }
+    if(SDL_MUSTLOCK(surface))
+        SDL_UnlockSurface(surface);
+
+    *top = (first < 0? 0 : first);
+    *height = (first < 0? 0 : last - first + 1);
+}
 
-    return FC_MapInsert(glyphs, codepoint, FC_MakeGlyphData(last_glyph->cache_level, last_glyph->rect.x, last_glyph->rect.y, last_glyph->rect.w, last_glyph->rect.h));
+// The given rows of a glyph surface, sharing its pixels
+static SDL_Surface* FC_CropGlyphRows(SDL_Surface* surface, int top, int height)
+{
+    SDL_PixelFormat* format = surface->format;
+    return SDL_CreateRGBSurfaceFrom((Uint8*)surface->pixels + top * surface->pitch, surface->w, height, format->BitsPerPixel, surface->pitch,
+                                    format->Rmask, format->Gmask, format->Bmask, format->Amask);
 }
 
 
@@ -1130,6 +1556,16 @@ FC_Font* FC_CreateFont(void)
     memset(font, 0, sizeof(FC_Font));
 
     FC_Init(font);
+    font->glyphs_mutex = SDL_CreateMutex();
+    font->glyphs_cond = SDL_CreateCond();
+    if(font->glyphs_mutex == NULL || font->glyphs_cond == NULL)
+    {
+        // Still usable on the thread that loads it
+        SDL_DestroyMutex(font->glyphs_mutex);
+        SDL_DestroyCond(font->glyphs_cond);
+        font->glyphs_mutex = NULL;
+        font->glyphs_cond = NULL;
+    }
 
     return font;
 }
@@ -1138,32 +1574,481 @@ FC_Font* FC_CreateFont(void)
 // Assume this many will be enough...
 #define FC_LOAD_MAX_SURFACES 10
 
-#ifdef FC_USE_SDL_GPU
-Uint8 FC_LoadFontFromTTF(FC_Font* font, TTF_Font* ttf, SDL_Color color)
-#else
-Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color)
-#endif
+// Distance field glyphs
+// Width in texels of the baked alpha ramp
+#define FC_SDF_RAMP 1.0f
+
+// Replaces a rendered glyph's coverage with its signed distance to the half covered contour, within the glyph's own box.
+// The distance is baked into an alpha ramp FC_SDF_RAMP texels wide on white, which draws like any other glyph.
+static void FC_MakeDistanceField(SDL_Surface* surface)
 {
-    if(font == NULL || ttf == NULL)
-        return 0;
-    #ifndef FC_USE_SDL_GPU
-    if(renderer == NULL)
-        return 0;
-    #endif
+    int radius = (int)FC_SDF_RAMP + 1;
+    float range = FC_SDF_RAMP;
+    float lengths[((int)FC_SDF_RAMP * 2 + 3) * ((int)FC_SDF_RAMP * 2 + 3)];
+    int side = 2 * radius + 1;
+    Uint32 amask = surface->format->Amask;
+    Uint32 rgbmask = surface->format->Rmask | surface->format->Gmask | surface->format->Bmask;
+    Uint8* coverage;
+    Uint32* row;
+    int x, y, dx, dy, qx, qy;
+    float c, cq, dist, candidate, value;
+    Uint8 inside;
+    Uint32 v;
+
+    if(surface->format->BytesPerPixel != 4 || amask == 0 || surface->w == 0 || surface->h == 0)
+        return;
 
-    FC_ClearFont(font);
+    coverage = (Uint8*)malloc(surface->w * surface->h);
+    if(coverage == NULL)
+        return;
 
+    for(dy = -radius; dy <= radius; ++dy)
+    {
+        for(dx = -radius; dx <= radius; ++dx)
+            lengths[(dy + radius) * side + dx + radius] = (float)SDL_sqrt((double)(dx*dx + dy*dy));
+    }
 
-    // Might as well check render target support here
-    #ifdef FC_USE_SDL_GPU
-    fc_has_render_target_support = GPU_IsFeatureEnabled(GPU_FEATURE_RENDER_TARGETS);
-    #else
-    SDL_RendererInfo info;
-    SDL_GetRendererInfo(renderer, &info);
-    fc_has_render_target_support = (info.flags & SDL_RENDERER_TARGETTEXTURE);
+    if(SDL_MUSTLOCK(surface))
+        SDL_LockSurface(surface);
+    for(y = 0; y < surface->h; ++y)
+    {
+        row = (Uint32*)((Uint8*)surface->pixels + y * surface->pitch);
+        for(x = 0; x < surface->w; ++x)
+            coverage[y * surface->w + x] = (Uint8)((row[x] & amask) / (amask / 0xFF));
+    }
 
-    font->renderer = renderer;
-    #endif
+    for(y = 0; y < surface->h; ++y)
+    {
+        row = (Uint32*)((Uint8*)surface->pixels + y * surface->pitch);
+        for(x = 0; x < surface->w; ++x)
+        {
+            // A texel of coverage c has the edge about c - 0.5 texels from its center, so through any texel q that the
+            // edge may cross, the edge is about |p - q| + (c(q) - 0.5) away from an inside p and |p - q| + (0.5 - c(q)) from an outside one.
+            // Outside the box counts as uncovered.
+            c = coverage[y * surface->w + x] / 255.0f;
+            inside = (c >= 0.5f);
+            dist = (float)radius;
+            for(dy = -radius; dy <= radius; ++dy)
+            {
+                qy = y + dy;
+                for(dx = -radius; dx <= radius; ++dx)
+                {
+                    qx = x + dx;
+                    cq = (qx < 0 || qy < 0 || qx >= surface->w || qy >= surface->h? 0.0f : coverage[qy * surface->w + qx] / 255.0f);
+                    if(inside? cq >= 1.0f : cq <= 0.0f)
+                        continue;
+                    candidate = lengths[(dy + radius) * side + dx + radius] + (inside? cq - 0.5f : 0.5f - cq);
+                    if(candidate < dist)
+                        dist = candidate;
+                }
+            }
+
+            value = 0.5f + (inside? dist : -dist) / range;
+            value = (value < 0.0f? 0.0f : (value > 1.0f? 1.0f : value));
+            v = (Uint32)(value * 255.0f + 0.5f);
+            row[x] = rgbmask | (v * (amask / 0xFF));
+        }
+    }
+    if(SDL_MUSTLOCK(surface))
+        SDL_UnlockSurface(surface);
+
+    free(coverage);
+}
+
+// Threads rasterizing the loading string, each one needs its own TTF_Font since FreeType faces are not thread safe
+#define FC_LOAD_MAX_THREADS 8
+// Fewer glyphs than this per thread are not worth starting one
+#define FC_LOAD_MIN_GLYPHS_PER_THREAD 16
+
+// The font file in memory, so each rasterizing thread can open a face of its own
+typedef struct FC_TTFSource
+{
+    const void* data;
+    int size;
+    Uint32 pointSize;
+} FC_TTFSource;
+
+typedef struct FC_RasterJob
+{
+    TTF_Font* ttf;
+    char (*glyphs)[5];  // UTF-8
+    SDL_Surface** surfaces;
+    int num_glyphs;
+    int first;
+    int stride;
+    Uint8 distance_field;
+} FC_RasterJob;
+
+static int FC_RasterizeGlyphs(void* data)
+{
+    FC_RasterJob* job = (FC_RasterJob*)data;
+    SDL_Color white = {255, 255, 255, 255};
+    int i;
+
+    for(i = job->first; i < job->num_glyphs; i += job->stride)
+    {
+        job->surfaces[i] = TTF_RenderUTF8_Blended(job->ttf, job->glyphs[i], white);
+        if(job->surfaces[i] != NULL && job->distance_field)
+            FC_MakeDistanceField(job->surfaces[i]);
+    }
+    return 0;
+}
+
+// Opens another face with the same settings as ttf.  Opening faces is not thread safe either, so this stays on the loading thread.
+static TTF_Font* FC_OpenRasterTTF(TTF_Font* ttf, const FC_TTFSource* source)
+{
+    TTF_Font* result;
+    SDL_RWops* rwops = SDL_RWFromConstMem(source->data, source->size);
+    if(rwops == NULL)
+        return NULL;
+
+    result = TTF_OpenFontRW(rwops, 1, source->pointSize);
+    if(result == NULL)
+        return NULL;
+
+    TTF_SetFontOutline(result, TTF_GetFontOutline(ttf));
+    TTF_SetFontStyle(result, TTF_GetFontStyle(ttf));
+    TTF_SetFontHinting(result, TTF_GetFontHinting(ttf));
+    TTF_SetFontKerning(result, TTF_GetFontKerning(ttf));
+    return result;
+}
+
+// Rasterizes glyphs[i] into surfaces[i].  With a source the glyphs are spread over threads, which only changes how fast
+// they come out: every glyph is rendered the same way and packing happens afterwards in loading string order.
+static void FC_RasterizeLoadingGlyphs(FC_Font* font, TTF_Font* ttf, const FC_TTFSource* source, char (*glyphs)[5], SDL_Surface** surfaces, int num_glyphs)
+{
+    FC_RasterJob jobs[FC_LOAD_MAX_THREADS];
+    SDL_Thread* threads[FC_LOAD_MAX_THREADS];
+    int num_threads = 1;
+    int i;
+
+    if(source != NULL)
+    {
+        num_threads = FC_MIN(SDL_GetCPUCount(), FC_LOAD_MAX_THREADS);
+        num_threads = FC_MIN(num_threads, num_glyphs / FC_LOAD_MIN_GLYPHS_PER_THREAD);
+        num_threads = FC_MAX(num_threads, 1);
+    }
+
+    jobs[0].ttf = ttf;
+    for(i = 1; i < num_threads; ++i)
+    {
+        jobs[i].ttf = FC_OpenRasterTTF(ttf, source);
+        if(jobs[i].ttf == NULL)
+        {
+            num_threads = i;
+            break;
+        }
+    }
+
+    // Interleaved, so each thread gets a mix of wide and narrow glyphs
+    for(i = 0; i < num_threads; ++i)
+    {
+        jobs[i].glyphs = glyphs;
+        jobs[i].surfaces = surfaces;
+        jobs[i].num_glyphs = num_glyphs;
+        jobs[i].first = i;
+        jobs[i].stride = num_threads;
+        jobs[i].distance_field = font->distance_field;
+    }
+
+    for(i = 1; i < num_threads; ++i)
+        threads[i] = SDL_CreateThread(FC_RasterizeGlyphs, "FC_Rasterize", &jobs[i]);
+
+    FC_RasterizeGlyphs(&jobs[0]);
+
+    for(i = 1; i < num_threads; ++i)
+    {
+        if(threads[i] != NULL)
+            SDL_WaitThread(threads[i], NULL);
+        else
+            FC_RasterizeGlyphs(&jobs[i]);
+        TTF_CloseFont(jobs[i].ttf);
+    }
+}
+
+
+// Atlas cache
+// A loaded font's packed cache levels and glyph table, saved so the next load of the same font file, size, style and
+// loading string skips rasterizing.  The file is in native byte order, it is only meant for the machine that wrote it.
+
+#define FC_ATLAS_MAGIC 0x54414346  // "FCAT"
+#define FC_ATLAS_VERSION 2
+#define FC_ATLAS_MAX_SIZE 16384
+
+typedef struct FC_AtlasHeader
+{
+    Uint32 magic;
+    Uint32 version;
+    Uint64 key;
+    Sint32 num_levels;
+    Sint32 num_glyphs;
+    Sint32 num_skyline_nodes;  // The last level's skyline, after the glyphs
+    FC_GlyphData last_glyph;
+} FC_AtlasHeader;
+
+typedef struct FC_AtlasGlyph
+{
+    Uint32 codepoint;
+    FC_GlyphData data;
+} FC_AtlasGlyph;
+
+// Followed by 4*w*h bytes of tightly packed pixels
+typedef struct FC_AtlasLevel
+{
+    Sint32 w;
+    Sint32 h;
+} FC_AtlasLevel;
+
+// FNV-1a
+static Uint64 FC_HashBytes(Uint64 hash, const void* data, size_t size)
+{
+    const Uint8* bytes = (const Uint8*)data;
+    size_t i;
+    for(i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static Uint64 FC_GetAtlasKey(FC_Font* font, TTF_Font* ttf, const FC_TTFSource* source)
+{
+    Sint32 settings[8];
+    Uint64 key = 0xcbf29ce484222325ULL;
+
+    settings[0] = source->pointSize;
+    settings[1] = TTF_GetFontStyle(ttf);
+    settings[2] = TTF_GetFontOutline(ttf);
+    settings[3] = TTF_GetFontHinting(ttf);
+    settings[4] = TTF_GetFontKerning(ttf);
+    settings[5] = font->load_mode;
+    settings[6] = FC_CACHE_PADDING;
+    settings[7] = font->distance_field;
+
+    key = FC_HashBytes(key, source->data, source->size);
+    key = FC_HashBytes(key, settings, sizeof(settings));
+    if(font->load_mode != FC_LOAD_ON_DEMAND)
+        key = FC_HashBytes(key, font->loading_string, strlen(font->loading_string));
+    return key;
+}
+
+static char* FC_GetAtlasPath(FC_Font* font, Uint64 key)
+{
+    const char* dir = font->atlas_cache_dir;
+    size_t length = strlen(dir);
+    const char* separator = (length > 0 && dir[length-1] != '/' && dir[length-1] != '\\'? "/" : "");
+    char* path = (char*)malloc(length + 32);
+    if(path != NULL)
+        snprintf(path, length + 32, "%s%sfc_%08x%08x.atlas", dir, separator, (unsigned int)(key >> 32), (unsigned int)key);
+    return path;
+}
+
+// Reads the whole file with one read, the cache levels are uploaded straight from that buffer
+static Uint8 FC_LoadAtlasCache(FC_Font* font, const char* path, Uint64 key)
+{
+    SDL_RWops* rwops;
+    Sint64 size;
+    Uint8* data;
+    Uint8* cursor;
+    Uint8* end;
+    FC_AtlasHeader header;
+    FC_AtlasGlyph glyph;
+    FC_AtlasLevel level;
+    FC_SkylineNode* skyline;
+    SDL_Surface* surface;
+    int i;
+
+    rwops = SDL_RWFromFile(path, "rb");
+    if(rwops == NULL)
+        return 0;
+
+    size = SDL_RWsize(rwops);
+    data = (size >= (Sint64)sizeof(FC_AtlasHeader) && size <= 0x7FFFFFFF? (Uint8*)malloc((size_t)size) : NULL);
+    if(data == NULL || SDL_RWread(rwops, data, 1, (size_t)size) != (size_t)size)
+    {
+        free(data);
+        SDL_RWclose(rwops);
+        return 0;
+    }
+    SDL_RWclose(rwops);
+
+    cursor = data;
+    end = data + size;
+    memcpy(&header, cursor, sizeof(header));
+    cursor += sizeof(header);
+    if(header.magic != FC_ATLAS_MAGIC || header.version != FC_ATLAS_VERSION || header.key != key
+       || header.num_levels < 1 || header.num_levels > FC_LOAD_MAX_SURFACES || header.num_glyphs < 0
+       || header.num_glyphs > (end - cursor) / (Sint64)sizeof(FC_AtlasGlyph) || header.num_skyline_nodes < 0
+       || header.num_skyline_nodes > (end - cursor - header.num_glyphs * (Sint64)sizeof(FC_AtlasGlyph)) / (Sint64)sizeof(FC_SkylineNode))
+    {
+        free(data);
+        return 0;
+    }
+
+    for(i = 0; i < header.num_glyphs; ++i)
+    {
+        memcpy(&glyph, cursor, sizeof(glyph));
+        cursor += sizeof(glyph);
+        if(glyph.data.cache_level < 0 || glyph.data.cache_level >= header.num_levels)
+            break;
+        FC_MapInsert(font->glyphs, glyph.codepoint, glyph.data);
+    }
+    cursor = data + sizeof(header) + header.num_glyphs * sizeof(FC_AtlasGlyph);
+
+    skyline = (FC_SkylineNode*)realloc(font->skyline, FC_MAX(32, 2 * header.num_skyline_nodes) * sizeof(FC_SkylineNode));
+    if(skyline != NULL)
+    {
+        font->skyline = skyline;
+        font->skyline_capacity = FC_MAX(32, 2 * header.num_skyline_nodes);
+        memcpy(font->skyline, cursor, header.num_skyline_nodes * sizeof(FC_SkylineNode));
+        font->skyline_size = header.num_skyline_nodes;
+    }
+    cursor += header.num_skyline_nodes * sizeof(FC_SkylineNode);
+
+    for(i = 0; i < header.num_levels && i == font->glyph_cache_count; ++i)
+    {
+        if(end - cursor < (Sint64)sizeof(level))
+            break;
+        memcpy(&level, cursor, sizeof(level));
+        cursor += sizeof(level);
+        if(level.w < 1 || level.h < 1 || level.w > FC_ATLAS_MAX_SIZE || level.h > FC_ATLAS_MAX_SIZE || end - cursor < 4 * (Sint64)level.w * level.h)
+            break;
+
+        surface = FC_CreateSurface32From(cursor, level.w, level.h);
+        cursor += 4 * level.w * level.h;
+        if(surface == NULL)
+            break;
+        FC_UploadGlyphCache(font, i, surface);
+        SDL_FreeSurface(surface);
+        #ifndef FC_USE_SDL_GPU
+        if(i < font->glyph_cache_count)
+            SDL_SetTextureBlendMode(font->glyph_cache[i], SDL_BLENDMODE_BLEND);
+        #endif
+    }
+    free(data);
+
+    if(font->glyph_cache_count != header.num_levels || FC_GetNumCodepoints(font) != (unsigned int)header.num_glyphs)
+    {
+        // Back to an empty font for rasterizing
+        FC_Log("SDL_FontCache: Ignoring damaged atlas cache %s\n", path);
+        for(i = 0; i < font->glyph_cache_count; ++i)
+        {
+            #ifdef FC_USE_SDL_GPU
+            GPU_FreeImage(font->glyph_cache[i]);
+            #else
+            SDL_DestroyTexture(font->glyph_cache[i]);
+            #endif
+        }
+        font->glyph_cache_count = 0;
+        FC_MapFree(font->glyphs);
+        font->glyphs = FC_MapCreate();
+        return 0;
+    }
+
+    font->last_glyph = header.last_glyph;
+    return 1;
+}
+
+static void FC_SaveAtlasCache(FC_Font* font, const char* path, Uint64 key, SDL_Surface** surfaces, int num_surfaces)
+{
+    SDL_RWops* rwops;
+    FC_AtlasHeader header;
+    FC_AtlasGlyph glyph;
+    FC_AtlasLevel level;
+    Uint32* codepoints;
+    char* temp_path;
+    Uint8 ok;
+    int i, y;
+
+    header.magic = FC_ATLAS_MAGIC;
+    header.version = FC_ATLAS_VERSION;
+    header.key = key;
+    header.num_levels = num_surfaces;
+    header.num_glyphs = FC_GetNumCodepoints(font);
+    header.num_skyline_nodes = font->skyline_size;
+    header.last_glyph = font->last_glyph;
+
+    codepoints = (Uint32*)malloc((header.num_glyphs + 1) * sizeof(Uint32));
+    temp_path = (char*)malloc(strlen(path) + 5);
+    if(codepoints == NULL || temp_path == NULL)
+    {
+        free(codepoints);
+        free(temp_path);
+        return;
+    }
+    FC_GetCodepoints(font, codepoints);
+
+    // Written next to the real file and renamed over it, so a cut off write is never loaded
+    sprintf(temp_path, "%s.tmp", path);
+    rwops = SDL_RWFromFile(temp_path, "wb");
+    ok = (rwops != NULL);
+    if(ok)
+        ok = (SDL_RWwrite(rwops, &header, sizeof(header), 1) == 1);
+    // Peeked so that saving counts no cache hits and leaves the eviction order alone
+    for(i = 0; ok && i < header.num_glyphs; ++i)
+    {
+        glyph.codepoint = codepoints[i];
+        glyph.data = *FC_MapPeek(font->glyphs, codepoints[i]);
+        ok = (SDL_RWwrite(rwops, &glyph, sizeof(glyph), 1) == 1);
+    }
+    if(ok && font->skyline_size > 0)
+        ok = (SDL_RWwrite(rwops, font->skyline, font->skyline_size * sizeof(FC_SkylineNode), 1) == 1);
+    for(i = 0; ok && i < num_surfaces; ++i)
+    {
+        level.w = surfaces[i]->w;
+        level.h = surfaces[i]->h;
+        ok = (SDL_RWwrite(rwops, &level, sizeof(level), 1) == 1);
+        for(y = 0; ok && y < level.h; ++y)
+            ok = (SDL_RWwrite(rwops, (Uint8*)surfaces[i]->pixels + y * surfaces[i]->pitch, 4 * level.w, 1) == 1);
+    }
+    if(rwops != NULL && SDL_RWclose(rwops) != 0)
+        ok = 0;
+
+    if(ok)
+    {
+        remove(path);
+        ok = (rename(temp_path, path) == 0);
+    }
+    if(!ok)
+    {
+        FC_Log("SDL_FontCache: Could not write atlas cache %s\n", path);
+        remove(temp_path);
+    }
+
+    free(codepoints);
+    free(temp_path);
+}
+
+#ifdef FC_USE_SDL_GPU
+static Uint8 FC_LoadFontFromSource(FC_Font* font, TTF_Font* ttf, SDL_Color color, const FC_TTFSource* source)
+#else
+static Uint8 FC_LoadFontFromSource(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color, const FC_TTFSource* source)
+#endif
+{
+    Uint64 atlas_key = 0;
+    char* atlas_path = NULL;  // Set when the atlas is to be saved
+
+    if(font == NULL || ttf == NULL)
+        return 0;
+    #ifndef FC_USE_SDL_GPU
+    if(renderer == NULL)
+        return 0;
+    #endif
+
+    FC_ClearFont(font);
+
+
+    // Might as well check render target support here
+    #ifdef FC_USE_SDL_GPU
+    fc_has_render_target_support = GPU_IsFeatureEnabled(GPU_FEATURE_RENDER_TARGETS);
+    #else
+    SDL_RendererInfo info;
+    SDL_GetRendererInfo(renderer, &info);
+    fc_has_render_target_support = (info.flags & SDL_RENDERER_TARGETTEXTURE);
+
+    font->renderer = renderer;
+    #endif
 
     font->ttf_source = ttf;
 
@@ -1180,39 +2065,92 @@ Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, S
 
     font->default_color = color;
 
+    if(font->distance_field)
+    {
+        // Fields are made to be sampled between texels
+        font->filter = FC_FILTER_LINEAR;
+    }
+
+    if(source != NULL && font->atlas_cache_dir != NULL)
+    {
+        atlas_key = FC_GetAtlasKey(font, ttf, source);
+        atlas_path = FC_GetAtlasPath(font, atlas_key);
+        if(atlas_path != NULL && FC_LoadAtlasCache(font, atlas_path, atlas_key))
+        {
+            free(atlas_path);
+            return 1;
+        }
+    }
+
     {
-        SDL_Color white = {255, 255, 255, 255};
         SDL_Surface* glyph_surf;
-        char buff[5];
-        const char* buff_ptr = buff;
+        char (*glyphs)[5];
+        SDL_Surface** glyph_surfaces;
+        int max_glyphs;
+        int num_glyphs = 0;
+        int glyph_index;
+        const char* buff_ptr;
         const char* source_string;
         Uint8 packed = 0;
+        int i;
+
+        int glyph_top, glyph_h;
 
         // Copy glyphs from the surface to the font texture and store the position data
-        // Pack row by row into a square texture
+        // Skyline packing into a square texture, each glyph cropped to its inked rows
         // Try figuring out dimensions that make sense for the font size.
         unsigned int w = font->height*12;
         unsigned int h = font->height*12;
+        // The last cache level is cut down to its used rows plus room for a full height glyph, glyphs added later go to new levels
+        unsigned int spare_h = font->height + FC_CACHE_PADDING + 1;
         SDL_Surface* surfaces[FC_LOAD_MAX_SURFACES];
         int num_surfaces = 1;
-        surfaces[0] = FC_CreateSurface32(w, h);
+        surfaces[0] = FC_CreateSurface32(w, font->load_mode == FC_LOAD_ON_DEMAND? FC_MIN(h, FC_CACHE_PADDING + 2*spare_h) : h);
         font->last_glyph.rect.x = FC_CACHE_PADDING;
         font->last_glyph.rect.y = FC_CACHE_PADDING;
         font->last_glyph.rect.w = 0;
-        font->last_glyph.rect.h = font->height;
-
-        source_string = font->loading_string;
+        font->last_glyph.rect.h = 0;
+        font->skyline_size = 0;
+
+        source_string = (font->load_mode == FC_LOAD_ON_DEMAND? "" : font->loading_string);
+        max_glyphs = U8_strlen(source_string) + 1;
+        glyphs = (char (*)[5])malloc(max_glyphs * sizeof(*glyphs));
+        glyph_surfaces = (SDL_Surface**)malloc(max_glyphs * sizeof(SDL_Surface*));
+        if(glyphs == NULL || glyph_surfaces == NULL)
+        {
+            free(glyphs);
+            free(glyph_surfaces);
+            glyphs = NULL;
+            glyph_surfaces = NULL;
+            source_string = "";
+        }
         for(; *source_string != '\0'; source_string = U8_next(source_string))
         {
-            memset(buff, 0, 5);
-            if(!U8_charcpy(buff, source_string, 5))
+            memset(glyphs[num_glyphs], 0, 5);
+            if(!U8_charcpy(glyphs[num_glyphs], source_string, 5))
                 continue;
-            glyph_surf = TTF_RenderUTF8_Blended(ttf, buff, white);
+            // Declared glyph sets are usually the strings themselves, with repeated characters
+            for(glyph_index = 0; glyph_index < num_glyphs; ++glyph_index)
+            {
+                if(strcmp(glyphs[glyph_index], glyphs[num_glyphs]) == 0)
+                    break;
+            }
+            if(glyph_index == num_glyphs)
+                num_glyphs++;
+        }
+
+        FC_RasterizeLoadingGlyphs(font, ttf, source, glyphs, glyph_surfaces, num_glyphs);
+
+        for(glyph_index = 0; glyph_index < num_glyphs; ++glyph_index)
+        {
+            buff_ptr = glyphs[glyph_index];
+            glyph_surf = glyph_surfaces[glyph_index];
             if(glyph_surf == NULL)
                 continue;
+            FC_GetGlyphRows(glyph_surf, &glyph_top, &glyph_h);
 
             // Try packing.  If it fails, create a new surface for the next cache level.
-            packed = (FC_PackGlyphData(font, FC_GetCodepointFromUTF8(&buff_ptr, 0), glyph_surf->w, surfaces[num_surfaces-1]->w, surfaces[num_surfaces-1]->h) != NULL);
+            packed = (FC_PackGlyphData(font, FC_GetCodepointFromUTF8(&buff_ptr, 0), glyph_surf->w, glyph_h, glyph_top, surfaces[num_surfaces-1]->w, surfaces[num_surfaces-1]->h) != NULL);
             if(!packed)
             {
                 int i = num_surfaces-1;
@@ -1220,13 +2158,15 @@ Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, S
                 {
                     // Can't do any more!
                     FC_Log("SDL_FontCache error: Could not create enough cache surfaces to fit all of the loading string!\n");
-                    SDL_FreeSurface(glyph_surf);
+                    for(; glyph_index < num_glyphs; ++glyph_index)
+                        SDL_FreeSurface(glyph_surfaces[glyph_index]);
                     break;
                 }
 
                 // Upload the current surface to the glyph cache now so we can keep the cache level packing cursor up to date as we go.
                 FC_UploadGlyphCache(font, i, surfaces[i]);
-                SDL_FreeSurface(surfaces[i]);
+                if(atlas_path == NULL)
+                    SDL_FreeSurface(surfaces[i]);
                 #ifndef FC_USE_SDL_GPU
                 SDL_SetTextureBlendMode(font->glyph_cache[i], SDL_BLENDMODE_BLEND);
                 #endif
@@ -1239,30 +2179,67 @@ Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, S
             }
 
             // Try packing for the new surface, then blit onto it.
-            if(packed || FC_PackGlyphData(font, FC_GetCodepointFromUTF8(&buff_ptr, 0), glyph_surf->w, surfaces[num_surfaces-1]->w, surfaces[num_surfaces-1]->h) != NULL)
+            if(!packed)
+                packed = (FC_PackGlyphData(font, FC_GetCodepointFromUTF8(&buff_ptr, 0), glyph_surf->w, glyph_h, glyph_top, surfaces[num_surfaces-1]->w, surfaces[num_surfaces-1]->h) != NULL);
+            if(packed && glyph_h > 0)
             {
                 SDL_SetSurfaceBlendMode(glyph_surf, SDL_BLENDMODE_NONE);
-                SDL_Rect srcRect = {0, 0, glyph_surf->w, glyph_surf->h};
+                SDL_Rect srcRect = {0, glyph_top, glyph_surf->w, glyph_h};
                 SDL_Rect destrect = font->last_glyph.rect;
                 SDL_BlitSurface(glyph_surf, &srcRect, surfaces[num_surfaces-1], &destrect);
             }
 
             SDL_FreeSurface(glyph_surf);
         }
+        free(glyphs);
+        free(glyph_surfaces);
 
         {
             int i = num_surfaces-1;
+            unsigned int used_h = FC_SkylineTop(font) + spare_h;
+            if(used_h < (unsigned int)surfaces[i]->h)
+            {
+                SDL_Surface* cropped = FC_CreateSurface32(w, used_h);
+                if(cropped != NULL)
+                {
+                    SDL_SetSurfaceBlendMode(surfaces[i], SDL_BLENDMODE_NONE);
+                    SDL_BlitSurface(surfaces[i], NULL, cropped, NULL);
+                    SDL_FreeSurface(surfaces[i]);
+                    surfaces[i] = cropped;
+                }
+            }
             FC_UploadGlyphCache(font, i, surfaces[i]);
-            SDL_FreeSurface(surfaces[i]);
             #ifndef FC_USE_SDL_GPU
             SDL_SetTextureBlendMode(font->glyph_cache[i], SDL_BLENDMODE_BLEND);
             #endif
+            if(atlas_path == NULL)
+                SDL_FreeSurface(surfaces[i]);
+        }
+
+        if(atlas_path != NULL)
+        {
+            FC_SaveAtlasCache(font, atlas_path, atlas_key, surfaces, num_surfaces);
+            for(i = 0; i < num_surfaces; ++i)
+                SDL_FreeSurface(surfaces[i]);
+            free(atlas_path);
         }
     }
 
     return 1;
 }
 
+#ifdef FC_USE_SDL_GPU
+Uint8 FC_LoadFontFromTTF(FC_Font* font, TTF_Font* ttf, SDL_Color color)
+{
+    return FC_LoadFontFromSource(font, ttf, color, NULL);
+}
+#else
+Uint8 FC_LoadFontFromTTF(FC_Font* font, SDL_Renderer* renderer, TTF_Font* ttf, SDL_Color color)
+{
+    return FC_LoadFontFromSource(font, renderer, ttf, color, NULL);
+}
+#endif
+
 
 #ifdef FC_USE_SDL_GPU
 Uint8 FC_LoadFont(FC_Font* font, const char* filename_ttf, Uint32 pointSize, SDL_Color color, int style)
@@ -1299,6 +2276,9 @@ Uint8 FC_LoadFont_RW(FC_Font* font, FC_Target* renderer, SDL_RWops* file_rwops_t
     Uint8 result;
     TTF_Font* ttf;
     Uint8 outline;
+    Sint64 start, size;
+    void* data = NULL;
+    FC_TTFSource source;
 
     if(font == NULL)
         return 0;
@@ -1311,12 +2291,35 @@ Uint8 FC_LoadFont_RW(FC_Font* font, FC_Target* renderer, SDL_RWops* file_rwops_t
         return 0;
     }
 
-    ttf = TTF_OpenFontRW(file_rwops_ttf, own_rwops, pointSize);
+    // Read the font into memory, so the glyphs can be rasterized on several threads that each open it
+    start = SDL_RWtell(file_rwops_ttf);
+    size = SDL_RWsize(file_rwops_ttf) - start;
+    if(start >= 0 && size > 0 && size <= 0x7FFFFFFF)
+    {
+        data = malloc((size_t)size);
+        if(data != NULL && SDL_RWread(file_rwops_ttf, data, 1, (size_t)size) != (size_t)size)
+        {
+            free(data);
+            data = NULL;
+            SDL_RWseek(file_rwops_ttf, start, RW_SEEK_SET);
+        }
+    }
+
+    if(data != NULL)
+    {
+        if(own_rwops)
+            SDL_RWclose(file_rwops_ttf);
+        ttf = TTF_OpenFontRW(SDL_RWFromConstMem(data, (int)size), 1, pointSize);
+    }
+    else
+        ttf = TTF_OpenFontRW(file_rwops_ttf, own_rwops, pointSize);
 
     if(ttf == NULL)
     {
         FC_Log("Unable to load TrueType font: %s \n", TTF_GetError());
-        if(own_rwops)
+        if(data != NULL)
+            free(data);
+        else if(own_rwops)
             SDL_RWclose(file_rwops_ttf);
         return 0;
     }
@@ -1329,18 +2332,27 @@ Uint8 FC_LoadFont_RW(FC_Font* font, FC_Target* renderer, SDL_RWops* file_rwops_t
     }
     TTF_SetFontStyle(ttf, style);
 
+    source.data = data;
+    source.size = (int)size;
+    source.pointSize = pointSize;
+
     #ifdef FC_USE_SDL_GPU
-    result = FC_LoadFontFromTTF(font, ttf, color);
+    result = FC_LoadFontFromSource(font, ttf, color, data != NULL? &source : NULL);
     #else
-    result = FC_LoadFontFromTTF(font, renderer, ttf, color);
+    result = FC_LoadFontFromSource(font, renderer, ttf, color, data != NULL? &source : NULL);
     #endif
 
+    // Set after loading, which clears the font and frees the previous file data
+    font->ttf_data = data;
+
     // Can only load new (uncached) glyphs if we can keep the SDL_RWops open.
     font->owns_ttf_source = own_rwops;
     if(!own_rwops)
     {
         TTF_CloseFont(font->ttf_source);
         font->ttf_source = NULL;
+        free(font->ttf_data);
+        font->ttf_data = NULL;
     }
 
     return result;
@@ -1353,6 +2365,7 @@ void FC_ResetFontFromRendererReset(FC_Font* font, SDL_Renderer* renderer, Uint32
     TTF_Font* ttf;
     SDL_Color col;
     Uint8 owns_ttf;
+    void* ttf_data;
     if (font == NULL)
         return;
 
@@ -1367,12 +2380,18 @@ void FC_ResetFontFromRendererReset(FC_Font* font, SDL_Renderer* renderer, Uint32
     ttf = font->ttf_source;
     col = font->default_color;
     owns_ttf = font->owns_ttf_source;
+    ttf_data = font->ttf_data;
     FC_Init(font);
 
+    // Loading clears the font, which must not close the source it reloads from
+    font->owns_ttf_source = 0;
+    font->ttf_data = NULL;
+
     // Can only reload glyphs if we own the SDL_RWops.
     if (owns_ttf)
         FC_LoadFontFromTTF(font, renderer, ttf, col);
     font->owns_ttf_source = owns_ttf;
+    font->ttf_data = ttf_data;
 }
 #endif
 
@@ -1385,9 +2404,11 @@ void FC_ClearFont(FC_Font* font)
     // Release resources
     if(font->owns_ttf_source)
         TTF_CloseFont(font->ttf_source);
+    free(font->ttf_data);
 
     font->owns_ttf_source = 0;
     font->ttf_source = NULL;
+    font->ttf_data = NULL;
 
     // Delete glyph map
     FC_MapFree(font->glyphs);
@@ -1419,6 +2440,7 @@ void FC_FreeFont(FC_Font* font)
     // Release resources
     if(font->owns_ttf_source)
         TTF_CloseFont(font->ttf_source);
+    free(font->ttf_data);
 
     // Delete glyph map
     FC_MapFree(font->glyphs);
@@ -1435,7 +2457,11 @@ void FC_FreeFont(FC_Font* font)
     free(font->glyph_cache);
 
     free(font->loading_string);
+    free(font->atlas_cache_dir);
+    free(font->skyline);
 
+    SDL_DestroyCond(font->glyphs_cond);
+    SDL_DestroyMutex(font->glyphs_mutex);
     free(font);
 }
 
@@ -1517,59 +2543,283 @@ Uint8 FC_AddGlyphToCache(FC_Font* font, SDL_Surface* glyph_surface)
 
 unsigned int FC_GetNumCodepoints(FC_Font* font)
 {
-    FC_Map* glyphs;
-    int i;
-    unsigned int result = 0;
     if(font == NULL || font->glyphs == NULL)
         return 0;
 
-    glyphs = font->glyphs;
-
-    for(i = 0; i < glyphs->num_buckets; ++i)
-    {
-        FC_MapNode* node;
-        for(node = glyphs->buckets[i]; node != NULL; node = node->next)
-        {
-            result++;
-        }
-    }
-
-    return result;
+    return font->glyphs->num_direct + font->glyphs->count;
 }
 
 void FC_GetCodepoints(FC_Font* font, Uint32* result)
 {
     FC_Map* glyphs;
-    int i;
+    unsigned int i;
     unsigned int count = 0;
     if(font == NULL || font->glyphs == NULL)
         return;
 
     glyphs = font->glyphs;
 
-    for(i = 0; i < glyphs->num_buckets; ++i)
+    for(i = 0; i < FC_MAP_DIRECT_SIZE; ++i)
+    {
+        if(glyphs->direct_used[i])
+        {
+            result[count] = i;
+            count++;
+        }
+    }
+
+    for(i = 0; i < glyphs->capacity; ++i)
     {
-        FC_MapNode* node;
-        for(node = glyphs->buckets[i]; node != NULL; node = node->next)
+        if(glyphs->entries[i].key != FC_MAP_EMPTY_KEY)
         {
-            result[count] = node->key;
+            result[count] = glyphs->entries[i].key;
             count++;
         }
     }
 }
 
+typedef struct FC_CachedGlyph
+{
+    Uint32 codepoint;
+    FC_GlyphData data;
+    Uint32 last_use;
+    Uint8 keep;
+} FC_CachedGlyph;
+
+// Most recently used first
+static int FC_CompareGlyphUse(const void* a, const void* b)
+{
+    Uint32 use_a = ((const FC_CachedGlyph*)a)->last_use;
+    Uint32 use_b = ((const FC_CachedGlyph*)b)->last_use;
+    return (use_a < use_b) - (use_a > use_b);
+}
+
+// Copies the most recently used glyphs into new cache levels and drops the rest, along with the old levels.
+// The kept glyphs fill at most half of the levels the budget allows, leaving room for the glyphs that caused this.
+static Uint8 FC_RepackGlyphCache(FC_Font* font)
+{
+    FC_Map* glyphs = font->glyphs;
+    FC_Map* new_glyphs;
+    FC_CachedGlyph* list;
+    FC_CachedGlyph* g;
+    int num_glyphs = 0;
+    int old_count = font->glyph_cache_count;
+    int level = old_count;
+    int level_size = font->height * 12;
+    Uint32 level_bytes = 4 * level_size * level_size;
+    int max_levels = FC_MAX(1, (int)(font->cache_budget / level_bytes));
+    Uint32 keep_bytes = max_levels * (level_bytes / 2);
+    Uint32 kept_bytes = 0;
+    Uint32 bytes;
+    int num_evicted = 0;
+    int i, x, y;
+    unsigned int j;
+    #ifdef FC_USE_SDL_GPU
+    GPU_Target* target = NULL;
+    GPU_Rect srcrect;
+    #else
+    SDL_Renderer* renderer = font->renderer;
+    SDL_Texture* prev_target;
+    SDL_Rect prev_clip, prev_viewport;
+    int prev_logicalw, prev_logicalh;
+    Uint8 prev_clip_enabled;
+    float prev_scalex, prev_scaley;
+    SDL_Rect destrect;
+    #endif
+
+    list = (FC_CachedGlyph*)malloc((FC_GetNumCodepoints(font) + 1) * sizeof(FC_CachedGlyph));
+    new_glyphs = FC_MapCreate();
+    if(list == NULL || new_glyphs == NULL)
+    {
+        free(list);
+        FC_MapFree(new_glyphs);
+        return 0;
+    }
+
+    for(j = 0; j < FC_MAP_DIRECT_SIZE; ++j)
+    {
+        if(glyphs->direct_used[j])
+        {
+            list[num_glyphs].codepoint = j;
+            list[num_glyphs].data = glyphs->direct[j];
+            list[num_glyphs].last_use = glyphs->direct_last_use[j];
+            num_glyphs++;
+        }
+    }
+    for(j = 0; j < glyphs->capacity; ++j)
+    {
+        if(glyphs->entries[j].key != FC_MAP_EMPTY_KEY)
+        {
+            list[num_glyphs].codepoint = glyphs->entries[j].key;
+            list[num_glyphs].data = glyphs->entries[j].value;
+            list[num_glyphs].last_use = glyphs->entries[j].last_use;
+            num_glyphs++;
+        }
+    }
+    qsort(list, num_glyphs, sizeof(FC_CachedGlyph), &FC_CompareGlyphUse);
+
+    // The new levels go after the old ones until the copy is done
+    if(!FC_GrowGlyphCache(font))
+    {
+        free(list);
+        FC_MapFree(new_glyphs);
+        return 0;
+    }
+    font->skyline_size = 0;
+
+    #ifdef FC_USE_SDL_GPU
+    for(i = 0; i < old_count; ++i)
+    {
+        GPU_SetBlendMode(font->glyph_cache[i], GPU_BLEND_SET);
+        set_color(font->glyph_cache[i], 255, 255, 255, 255);
+    }
+    target = GPU_LoadTarget(font->glyph_cache[level]);
+    #else
+    for(i = 0; i < old_count; ++i)
+    {
+        SDL_SetTextureBlendMode(font->glyph_cache[i], SDL_BLENDMODE_NONE);
+        set_color(font->glyph_cache[i], 255, 255, 255, 255);
+    }
+    prev_target = SDL_GetRenderTarget(renderer);
+    // only backup if previous target existed (SDL will preserve them for the default target)
+    if (prev_target) {
+        prev_clip_enabled = has_clip(renderer);
+        if (prev_clip_enabled)
+            prev_clip = get_clip(renderer);
+        SDL_RenderGetViewport(renderer, &prev_viewport);
+        SDL_RenderGetScale(renderer, &prev_scalex, &prev_scaley);
+        SDL_RenderGetLogicalSize(renderer, &prev_logicalw, &prev_logicalh);
+    }
+    SDL_SetRenderTarget(renderer, font->glyph_cache[level]);
+    #endif
+
+    for(i = 0; i < num_glyphs; ++i)
+    {
+        g = &list[i];
+        g->keep = 0;
+
+        // Blank glyphs take no room
+        if(g->data.rect.h == 0)
+        {
+            g->keep = 1;
+            continue;
+        }
+
+        bytes = 4 * (g->data.rect.w + FC_CACHE_PADDING) * (g->data.rect.h + FC_CACHE_PADDING);
+        if(kept_bytes + bytes > keep_bytes)
+            continue;
+
+        if(!FC_SkylineInsert(font, g->data.rect.w + FC_CACHE_PADDING, g->data.rect.h + FC_CACHE_PADDING, level_size, level_size, &x, &y))
+        {
+            if(level - old_count + 1 >= max_levels || !FC_GrowGlyphCache(font))
+                continue;
+            level++;
+            font->skyline_size = 0;
+            #ifdef FC_USE_SDL_GPU
+            GPU_FreeTarget(target);
+            target = GPU_LoadTarget(font->glyph_cache[level]);
+            #else
+            SDL_SetRenderTarget(renderer, font->glyph_cache[level]);
+            #endif
+            if(!FC_SkylineInsert(font, g->data.rect.w + FC_CACHE_PADDING, g->data.rect.h + FC_CACHE_PADDING, level_size, level_size, &x, &y))
+                continue;
+        }
+
+        #ifdef FC_USE_SDL_GPU
+        if(target != NULL)
+        {
+            srcrect.x = g->data.rect.x;
+            srcrect.y = g->data.rect.y;
+            srcrect.w = g->data.rect.w;
+            srcrect.h = g->data.rect.h;
+            GPU_Blit(font->glyph_cache[g->data.cache_level], &srcrect, target, x + srcrect.w/2, y + srcrect.h/2);
+        }
+        #else
+        destrect.x = x;
+        destrect.y = y;
+        destrect.w = g->data.rect.w;
+        destrect.h = g->data.rect.h;
+        SDL_RenderCopy(renderer, font->glyph_cache[g->data.cache_level], &g->data.rect, &destrect);
+        #endif
+
+        g->data.rect.x = x;
+        g->data.rect.y = y;
+        g->data.cache_level = level - old_count;
+        g->keep = 1;
+        kept_bytes += bytes;
+    }
+
+    #ifdef FC_USE_SDL_GPU
+    GPU_FreeTarget(target);
+    #else
+    SDL_SetRenderTarget(renderer, prev_target);
+    if (prev_target) {
+        if (prev_clip_enabled)
+            set_clip(renderer, &prev_clip);
+        if (prev_logicalw && prev_logicalh)
+            SDL_RenderSetLogicalSize(renderer, prev_logicalw, prev_logicalh);
+        else {
+            SDL_RenderSetViewport(renderer, &prev_viewport);
+            SDL_RenderSetScale(renderer, prev_scalex, prev_scaley);
+        }
+    }
+    #endif
+
+    for(i = 0; i < old_count; ++i)
+    {
+        #ifdef FC_USE_SDL_GPU
+        GPU_FreeImage(font->glyph_cache[i]);
+        #else
+        SDL_DestroyTexture(font->glyph_cache[i]);
+        #endif
+    }
+    memmove(font->glyph_cache, font->glyph_cache + old_count, (font->glyph_cache_count - old_count) * sizeof(FC_Image*));
+    font->glyph_cache_count -= old_count;
+
+    // Coldest first, so the new map's use clock keeps the order
+    for(i = num_glyphs - 1; i >= 0; --i)
+    {
+        g = &list[i];
+        if(!g->keep)
+        {
+            num_evicted++;
+            continue;
+        }
+        if(g->data.rect.h == 0)
+            g->data.cache_level = 0;
+        FC_MapInsert(new_glyphs, g->codepoint, g->data);
+    }
+    FC_BeginGlyphWrite(font);
+    FC_MapFree(font->glyphs);
+    font->glyphs = new_glyphs;
+    FC_EndGlyphWrite(font);
+    free(list);
+
+    font->last_glyph.cache_level = font->glyph_cache_count - 1;
+    font->cache_evictions += num_evicted;
+    font->cache_repacks++;
+    font->layout_generation++;
+    return 1;
+}
+
 Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint)
 {
     FC_GlyphData* e = FC_MapFind(font->glyphs, codepoint);
-    if(e == NULL)
+    if(e != NULL)
+        font->cache_hits++;
+    else
     {
         char buff[5];
         int w, h;
+        int top, rows;
+        Uint32 level_size;
         SDL_Color white = {255, 255, 255, 255};
         SDL_Surface* surf;
+        SDL_Surface* cropped;
         FC_Image* cache_image;
 
-        if(font->ttf_source == NULL)
+        // Only the thread that loaded the font adds glyphs, the others just measure with the cached ones
+        if(font->ttf_source == NULL || SDL_ThreadID() != font->owner_thread)
             return 0;
 
         FC_GetUTF8FromCodepoint(buff, codepoint);
@@ -1593,15 +2843,44 @@ Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint)
         {
             return 0;
         }
-
-        e = FC_PackGlyphData(font, codepoint, surf->w, w, h);
+        if(font->distance_field)
+            FC_MakeDistanceField(surf);
+        FC_GetGlyphRows(surf, &top, &rows);
+        font->cache_misses++;
+
+        e = FC_PackGlyphData(font, codepoint, surf->w, rows, top, w, h);
+        level_size = font->height * 12;
+        if(e == NULL && font->cache_budget > 0 && FC_GetCacheMemory(font) + 4 * level_size * level_size > font->cache_budget
+           && FC_RepackGlyphCache(font))
+        {
+            // Another level would go past the budget, the repack dropped cold glyphs instead
+            cache_image = FC_GetGlyphCacheLevel(font, font->last_glyph.cache_level);
+            #ifdef FC_USE_SDL_GPU
+            w = cache_image->w;
+            h = cache_image->h;
+            #else
+            SDL_QueryTexture(cache_image, NULL, NULL, &w, &h);
+            #endif
+            e = FC_PackGlyphData(font, codepoint, surf->w, rows, top, w, h);
+        }
         if(e == NULL)
         {
             // Grow the cache
-            FC_GrowGlyphCache(font);
+            if(!FC_GrowGlyphCache(font))
+            {
+                SDL_FreeSurface(surf);
+                return 0;
+            }
+            cache_image = FC_GetGlyphCacheLevel(font, font->last_glyph.cache_level);
+            #ifdef FC_USE_SDL_GPU
+            w = cache_image->w;
+            h = cache_image->h;
+            #else
+            SDL_QueryTexture(cache_image, NULL, NULL, &w, &h);
+            #endif
 
             // Try packing again
-            e = FC_PackGlyphData(font, codepoint, surf->w, w, h);
+            e = FC_PackGlyphData(font, codepoint, surf->w, rows, top, w, h);
             if(e == NULL)
             {
                 SDL_FreeSurface(surf);
@@ -1609,8 +2888,13 @@ Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint)
             }
         }
 
-        // Render onto the cache texture
-        FC_AddGlyphToCache(font, surf);
+        // Render the inked rows onto the cache texture
+        if(rows > 0)
+        {
+            cropped = FC_CropGlyphRows(surf, top, rows);
+            FC_AddGlyphToCache(font, cropped);
+            SDL_FreeSurface(cropped);
+        }
 
         SDL_FreeSurface(surf);
     }
@@ -1622,15 +2906,32 @@ Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint)
 }
 
 
+// FC_GetGlyphData() for the functions measuring text, which may run on other threads than the one that loaded the font.
+// There it only reads the cache, between FC_BeginGlyphRead() and FC_EndGlyphRead(): missing glyphs aren't added and
+// lookups don't count for the eviction order or the stats.
+static Uint8 FC_MeasureGlyph(FC_Font* font, FC_GlyphData* result, Uint32 codepoint, Uint8 owner_thread)
+{
+    FC_GlyphData* e;
+    if(owner_thread)
+        return FC_GetGlyphData(font, result, codepoint);
+
+    e = FC_MapPeek(font->glyphs, codepoint);
+    if(e == NULL)
+        return 0;
+    *result = *e;
+    return 1;
+}
+
 FC_GlyphData* FC_SetGlyphData(FC_Font* font, Uint32 codepoint, FC_GlyphData glyph_data)
 {
-    return FC_MapInsert(font->glyphs, codepoint, glyph_data);
+    return FC_InsertGlyph(font, codepoint, glyph_data);
 }
 
 
 
 // Drawing
-static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text)
+// Draws the text up to end, or its terminator when end is NULL
+static FC_Rect FC_RenderLeftSpan(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text, const char* end)
 {
     const char* c = text;
     FC_Rect srcRect;
@@ -1658,7 +2959,7 @@ static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, F
 
     int newlineX = x;
 
-    for(; *c != '\0'; c++)
+    for(; c != end && *c != '\0'; c++)
     {
         if(*c == '\n')
         {
@@ -1693,7 +2994,9 @@ static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, F
         #else
         srcRect = glyph.rect;
         #endif
-        dstRect = fc_render_callback(FC_GetGlyphCacheLevel(font, glyph.cache_level), &srcRect, dest, destX, destY, scale.x, scale.y);
+        fc_render_callback(FC_GetGlyphCacheLevel(font, glyph.cache_level), &srcRect, dest, destX, destY + glyph.offset_y*scale.y, scale.x, scale.y);
+        // The whole character cell, as when glyphs were cached at the full line height
+        dstRect = FC_MakeRect(destX, destY, glyph.rect.w*scale.x, font->height*scale.y);
         if(dirtyRect.w == 0 || dirtyRect.h == 0)
             dirtyRect = dstRect;
         else
@@ -1705,244 +3008,143 @@ static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, F
     return dirtyRect;
 }
 
+static FC_Rect FC_RenderLeft(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text)
+{
+    return FC_RenderLeftSpan(font, dest, x, y, scale, text, NULL);
+}
+
 static void set_color_for_all_caches(FC_Font* font, SDL_Color color)
 {
     // TODO: How can I predict which glyph caches are to be used?
     FC_Image* img;
     int i;
     int num_levels = FC_GetNumCacheLevels(font);
-    for(i = 0; i < num_levels; ++i)
-    {
-        img = FC_GetGlyphCacheLevel(font, i);
-        set_color(img, color.r, color.g, color.b, FC_GET_ALPHA(color));
-    }
-}
-
-FC_Rect FC_Draw(FC_Font* font, FC_Target* dest, float x, float y, const char* formatted_text, ...)
-{
-    if(formatted_text == NULL || font == NULL)
-        return FC_MakeRect(x, y, 0, 0);
-
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
-
-    set_color_for_all_caches(font, font->default_color);
-
-    return FC_RenderLeft(font, dest, x, y, FC_MakeScale(1,1), fc_buffer);
-}
-
-
-
-typedef struct FC_StringList
-{
-    char* value;
-    struct FC_StringList* next;
-} FC_StringList;
-
-void FC_StringListFree(FC_StringList* node)
-{
-    // Delete the nodes in order
-    while(node != NULL)
-    {
-        FC_StringList* last = node;
-        node = node->next;
 
-        free(last->value);
-        free(last);
-    }
-}
-
-FC_StringList** FC_StringListPushBack(FC_StringList** node, char* value, Uint8 copy)
-{
-    if(node == NULL)
-    {
-        return node;
-    }
-    
-    // Get to the last node
-    while(*node != NULL)
-    {
-        node = &(*node)->next;
-    }
-
-    *node = (FC_StringList*)malloc(sizeof(FC_StringList));
-
-    (*node)->value = (copy? U8_strdup(value) : value);
-    (*node)->next = NULL;
-
-    return node;
-}
-
-static FC_StringList* FC_Explode(const char* text, char delimiter)
-{
-    FC_StringList* head;
-    FC_StringList* new_node;
-    FC_StringList** node;
-    const char* start;
-    const char* end;
-    unsigned int size;
-    if(text == NULL)
-        return NULL;
-
-    head = NULL;
-    node = &head;
-
-    // Doesn't technically support UTF-8, but it's probably fine, right?
-    size = 0;
-    start = end = text;
-    while(1)
+    for(i = 0; i < num_levels; ++i)
     {
-        if(*end == delimiter || *end == '\0')
-        {
-            *node = (FC_StringList*)malloc(sizeof(FC_StringList));
-            new_node = *node;
+        img = FC_GetGlyphCacheLevel(font, i);
+        set_color(img, color.r, color.g, color.b, FC_GET_ALPHA(color));
+    }
+}
 
-            new_node->value = (char*)malloc(size + 1);
-            memcpy(new_node->value, start, size);
-            new_node->value[size] = '\0';
+FC_Rect FC_Draw(FC_Font* font, FC_Target* dest, float x, float y, const char* formatted_text, ...)
+{
+    const char* buffer;
+    if(formatted_text == NULL || font == NULL)
+        return FC_MakeRect(x, y, 0, 0);
 
-            new_node->next = NULL;
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-            if(*end == '\0')
-                break;
+    set_color_for_all_caches(font, font->default_color);
 
-            node = &((*node)->next);
-            start = end+1;
-            size = 0;
-        }
-        else
-            ++size;
+    return FC_RenderLeft(font, dest, x, y, FC_MakeScale(1,1), buffer);
+}
 
-        ++end;
-    }
 
-    return head;
-}
 
-static FC_StringList* FC_ExplodeAndKeep(const char* text, char delimiter)
+// Lays text out into scratch->lines no wider than width (no limit when width <= 0), breaking at spaces.  A line
+// always keeps at least one word and wrapped lines keep the space they broke at.  With keep_newlines, each line after a
+// newline starts with it, so indices into the lines still count every character of the text.
+// Returns the number of lines in scratch->lines, or -1 when they don't fit in memory.
+static int FC_WrapLines(FC_Font* font, FC_Scratch* scratch, const char* text, int width, Uint8 keep_newlines)
 {
-    FC_StringList* head;
-    FC_StringList* new_node;
-    FC_StringList** node;
-    const char* start;
-    const char* end;
-    unsigned int size;
-    if(text == NULL)
-        return NULL;
-
-    head = NULL;
-    node = &head;
+    int num_lines = 0;
+    const char* line_start = text;
+    const char* line_end;
+    const char* start;  // Of the wrapped line being built
+    const char* word;
+    const char* word_end;
+    int line_width;
+    int word_width;
+    int space_width = 0;
+
+    if(width > 0)
+        space_width = FC_GetSpanWidth(font, " ", NULL);
 
-    // Doesn't technically support UTF-8, but it's probably fine, right?
-    size = 0;
-    start = end = text;
     while(1)
     {
-        if(*end == delimiter || *end == '\0')
+        line_end = line_start;
+        if(keep_newlines && *line_end == '\n')
+            ++line_end;
+        while(*line_end != '\n' && *line_end != '\0')
+            ++line_end;
+
+        start = line_start;
+        if(width > 0 && FC_GetSpanWidth(font, line_start, line_end) > width)
         {
-            *node = (FC_StringList*)malloc(sizeof(FC_StringList));
-            new_node = *node;
-
-            new_node->value = (char*)malloc(size + 1);
-            memcpy(new_node->value, start, size);
-            new_node->value[size] = '\0';
+            // Add words one at a time until we go over.  Widths add up, so each word is measured once.
+            word_end = line_start;
+            while(word_end != line_end && *word_end != ' ')
+                ++word_end;
+            line_width = FC_GetSpanWidth(font, line_start, word_end) + space_width;
 
-            new_node->next = NULL;
-
-            if(*end == '\0')
-                break;
+            while(word_end != line_end)
+            {
+                word = word_end + 1;
+                word_end = word;
+                while(word_end != line_end && *word_end != ' ')
+                    ++word_end;
+                word_width = FC_GetSpanWidth(font, word, word_end);
 
-            node = &((*node)->next);
-            start = end;
-            size = 1;
+                if(line_width + word_width > width)
+                {
+                    if(num_lines == scratch->line_capacity && !FC_GrowScratchLines(scratch))
+                        return -1;
+                    scratch->lines[num_lines].start = start;
+                    scratch->lines[num_lines].end = word;
+                    ++num_lines;
+
+                    start = word;
+                    line_width = word_width + space_width;
+                }
+                else
+                    line_width += word_width + space_width;
+            }
         }
-        else
-            ++size;
 
-        ++end;
+        if(num_lines == scratch->line_capacity && !FC_GrowScratchLines(scratch))
+            return -1;
+        scratch->lines[num_lines].start = start;
+        scratch->lines[num_lines].end = line_end;
+        ++num_lines;
+
+        if(*line_end == '\0')
+            break;
+        line_start = (keep_newlines? line_end : line_end + 1);
     }
 
-    return head;
+    return num_lines;
 }
 
-static void FC_RenderAlign(FC_Font* font, FC_Target* dest, float x, float y, int width, FC_Scale scale, FC_AlignEnum align, const char* text)
+// Draws one laid out line within a column of the given width
+static void FC_RenderAlign(FC_Font* font, FC_Target* dest, float x, float y, int width, FC_Scale scale, FC_AlignEnum align, const FC_LineSpan* line)
 {
     switch(align)
     {
         case FC_ALIGN_LEFT:
-            FC_RenderLeft(font, dest, x, y, scale, text);
+            FC_RenderLeftSpan(font, dest, x, y, scale, line->start, line->end);
             break;
         case FC_ALIGN_CENTER:
-            FC_RenderCenter(font, dest, x + width/2, y, scale, text);
+            FC_RenderAlignedSpan(font, dest, x + width/2, y, scale, align, line->start, line->end);
             break;
         case FC_ALIGN_RIGHT:
-            FC_RenderRight(font, dest, x + width, y, scale, text);
+            FC_RenderAlignedSpan(font, dest, x + width, y, scale, align, line->start, line->end);
             break;
     }
 }
 
-static FC_StringList* FC_GetBufferFitToColumn(FC_Font* font, int width, FC_Scale scale, Uint8 keep_newlines)
-{
-    FC_StringList* result = NULL;
-    FC_StringList** current = &result;
-
-    FC_StringList *ls, *iter;
-
-    ls = (keep_newlines? FC_ExplodeAndKeep(fc_buffer, '\n') : FC_Explode(fc_buffer, '\n'));
-    for(iter = ls; iter != NULL; iter = iter->next)
-    {
-        char* line = iter->value;
-
-        // If line is too long, then add words one at a time until we go over.
-        if(width > 0 && FC_GetWidth(font, "%s", line) > width)
-        {
-            FC_StringList *words, *word_iter;
-
-            words = FC_Explode(line, ' ');
-            // Skip the first word for the iterator, so there will always be at least one word per line
-            line = new_concat(words->value, " ");
-            for(word_iter = words->next; word_iter != NULL; word_iter = word_iter->next)
-            {
-                char* line_plus_word = new_concat(line, word_iter->value);
-                char* word_plus_space = new_concat(word_iter->value, " ");
-                if(FC_GetWidth(font, "%s", line_plus_word) > width)
-                {
-                    current = FC_StringListPushBack(current, line, 0);
-
-                    line = word_plus_space;
-                }
-                else
-                {
-                    replace_concat(&line, word_plus_space);
-                    free(word_plus_space);
-                }
-                free(line_plus_word);
-            }
-            current = FC_StringListPushBack(current, line, 0);
-            FC_StringListFree(words);
-        }
-        else
-        {
-            current = FC_StringListPushBack(current, line, 0);
-            iter->value = NULL;
-        }
-    }
-    FC_StringListFree(ls);
-
-    return result;
-}
-
-static void FC_DrawColumnFromBuffer(FC_Font* font, FC_Target* dest, FC_Rect box, int* total_height, FC_Scale scale, FC_AlignEnum align)
+static void FC_DrawColumnFromBuffer(FC_Font* font, FC_Target* dest, FC_Rect box, int* total_height, FC_Scale scale, FC_AlignEnum align, const char* buffer)
 {
     int y = box.y;
-    FC_StringList *ls, *iter;
+    int i, num_lines;
+    FC_Scratch* scratch = FC_GetScratch();
 
-    ls = FC_GetBufferFitToColumn(font, box.w, scale, 0);
-    for(iter = ls; iter != NULL; iter = iter->next)
+    num_lines = (scratch != NULL? FC_WrapLines(font, scratch, buffer, box.w, 0) : -1);
+    for(i = 0; i < num_lines; ++i)
     {
-        FC_RenderAlign(font, dest, box.x, y, box.w, scale, align, iter->value);
+        FC_RenderAlign(font, dest, box.x, y, box.w, scale, align, &scratch->lines[i]);
         y += FC_GetLineHeight(font);
     }
-    FC_StringListFree(ls);
 
     if(total_height != NULL)
         *total_height = y - box.y;
@@ -1950,11 +3152,12 @@ static void FC_DrawColumnFromBuffer(FC_Font* font, FC_Target* dest, FC_Rect box,
 
 FC_Rect FC_DrawBox(FC_Font* font, FC_Target* dest, FC_Rect box, const char* formatted_text, ...)
 {
+    const char* buffer;
     Uint8 useClip;
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(box.x, box.y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     useClip = has_clip(dest);
     FC_Rect oldclip, newclip;
@@ -1970,7 +3173,7 @@ FC_Rect FC_DrawBox(FC_Font* font, FC_Target* dest, FC_Rect box, const char* form
 
     set_color_for_all_caches(font, font->default_color);
 
-    FC_DrawColumnFromBuffer(font, dest, box, NULL, FC_MakeScale(1,1), FC_ALIGN_LEFT);
+    FC_DrawColumnFromBuffer(font, dest, box, NULL, FC_MakeScale(1,1), FC_ALIGN_LEFT, buffer);
 
     if(useClip)
         set_clip(dest, &oldclip);
@@ -1982,11 +3185,12 @@ FC_Rect FC_DrawBox(FC_Font* font, FC_Target* dest, FC_Rect box, const char* form
 
 FC_Rect FC_DrawBoxAlign(FC_Font* font, FC_Target* dest, FC_Rect box, FC_AlignEnum align, const char* formatted_text, ...)
 {
+    const char* buffer;
     Uint8 useClip;
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(box.x, box.y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     useClip = has_clip(dest);
     FC_Rect oldclip, newclip;
@@ -2001,7 +3205,7 @@ FC_Rect FC_DrawBoxAlign(FC_Font* font, FC_Target* dest, FC_Rect box, FC_AlignEnu
 
     set_color_for_all_caches(font, font->default_color);
 
-    FC_DrawColumnFromBuffer(font, dest, box, NULL, FC_MakeScale(1,1), align);
+    FC_DrawColumnFromBuffer(font, dest, box, NULL, FC_MakeScale(1,1), align, buffer);
 
     if(useClip)
         set_clip(dest, &oldclip);
@@ -2013,11 +3217,12 @@ FC_Rect FC_DrawBoxAlign(FC_Font* font, FC_Target* dest, FC_Rect box, FC_AlignEnu
 
 FC_Rect FC_DrawBoxScale(FC_Font* font, FC_Target* dest, FC_Rect box, FC_Scale scale, const char* formatted_text, ...)
 {
+    const char* buffer;
     Uint8 useClip;
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(box.x, box.y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     useClip = has_clip(dest);
     FC_Rect oldclip, newclip;
@@ -2032,7 +3237,7 @@ FC_Rect FC_DrawBoxScale(FC_Font* font, FC_Target* dest, FC_Rect box, FC_Scale sc
 
     set_color_for_all_caches(font, font->default_color);
 
-    FC_DrawColumnFromBuffer(font, dest, box, NULL, scale, FC_ALIGN_LEFT);
+    FC_DrawColumnFromBuffer(font, dest, box, NULL, scale, FC_ALIGN_LEFT, buffer);
 
     if(useClip)
         set_clip(dest, &oldclip);
@@ -2044,11 +3249,12 @@ FC_Rect FC_DrawBoxScale(FC_Font* font, FC_Target* dest, FC_Rect box, FC_Scale sc
 
 FC_Rect FC_DrawBoxColor(FC_Font* font, FC_Target* dest, FC_Rect box, SDL_Color color, const char* formatted_text, ...)
 {
+    const char* buffer;
     Uint8 useClip;
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(box.x, box.y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     useClip = has_clip(dest);
     FC_Rect oldclip, newclip;
@@ -2063,7 +3269,7 @@ FC_Rect FC_DrawBoxColor(FC_Font* font, FC_Target* dest, FC_Rect box, SDL_Color c
 
     set_color_for_all_caches(font, color);
 
-    FC_DrawColumnFromBuffer(font, dest, box, NULL, FC_MakeScale(1,1), FC_ALIGN_LEFT);
+    FC_DrawColumnFromBuffer(font, dest, box, NULL, FC_MakeScale(1,1), FC_ALIGN_LEFT, buffer);
 
     if(useClip)
         set_clip(dest, &oldclip);
@@ -2075,11 +3281,12 @@ FC_Rect FC_DrawBoxColor(FC_Font* font, FC_Target* dest, FC_Rect box, SDL_Color c
 
 FC_Rect FC_DrawBoxEffect(FC_Font* font, FC_Target* dest, FC_Rect box, FC_Effect effect, const char* formatted_text, ...)
 {
+    const char* buffer;
     Uint8 useClip;
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(box.x, box.y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     useClip = has_clip(dest);
     FC_Rect oldclip, newclip;
@@ -2094,7 +3301,7 @@ FC_Rect FC_DrawBoxEffect(FC_Font* font, FC_Target* dest, FC_Rect box, FC_Effect
 
     set_color_for_all_caches(font, effect.color);
 
-    FC_DrawColumnFromBuffer(font, dest, box, NULL, effect.scale, effect.alignment);
+    FC_DrawColumnFromBuffer(font, dest, box, NULL, effect.scale, effect.alignment, buffer);
 
     if(useClip)
         set_clip(dest, &oldclip);
@@ -2106,30 +3313,32 @@ FC_Rect FC_DrawBoxEffect(FC_Font* font, FC_Target* dest, FC_Rect box, FC_Effect
 
 FC_Rect FC_DrawColumn(FC_Font* font, FC_Target* dest, float x, float y, Uint16 width, const char* formatted_text, ...)
 {
+    const char* buffer;
     FC_Rect box = {x, y, width, 0};
     int total_height;
 
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(x, y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     set_color_for_all_caches(font, font->default_color);
 
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, FC_MakeScale(1,1), FC_ALIGN_LEFT);
+    FC_DrawColumnFromBuffer(font, dest, box, &total_height, FC_MakeScale(1,1), FC_ALIGN_LEFT, buffer);
 
     return FC_MakeRect(box.x, box.y, width, total_height);
 }
 
 FC_Rect FC_DrawColumnAlign(FC_Font* font, FC_Target* dest, float x, float y, Uint16 width, FC_AlignEnum align, const char* formatted_text, ...)
 {
+    const char* buffer;
     FC_Rect box = {x, y, width, 0};
     int total_height;
 
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(x, y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     set_color_for_all_caches(font, font->default_color);
 
@@ -2145,54 +3354,57 @@ FC_Rect FC_DrawColumnAlign(FC_Font* font, FC_Target* dest, float x, float y, Uin
         break;
     }
 
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, FC_MakeScale(1,1), align);
+    FC_DrawColumnFromBuffer(font, dest, box, &total_height, FC_MakeScale(1,1), align, buffer);
 
     return FC_MakeRect(box.x, box.y, width, total_height);
 }
 
 FC_Rect FC_DrawColumnScale(FC_Font* font, FC_Target* dest, float x, float y, Uint16 width, FC_Scale scale, const char* formatted_text, ...)
 {
+    const char* buffer;
     FC_Rect box = {x, y, width, 0};
     int total_height;
 
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(x, y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     set_color_for_all_caches(font, font->default_color);
 
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, scale, FC_ALIGN_LEFT);
+    FC_DrawColumnFromBuffer(font, dest, box, &total_height, scale, FC_ALIGN_LEFT, buffer);
 
     return FC_MakeRect(box.x, box.y, width, total_height);
 }
 
 FC_Rect FC_DrawColumnColor(FC_Font* font, FC_Target* dest, float x, float y, Uint16 width, SDL_Color color, const char* formatted_text, ...)
 {
+    const char* buffer;
     FC_Rect box = {x, y, width, 0};
     int total_height;
 
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(x, y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     set_color_for_all_caches(font, color);
 
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, FC_MakeScale(1,1), FC_ALIGN_LEFT);
+    FC_DrawColumnFromBuffer(font, dest, box, &total_height, FC_MakeScale(1,1), FC_ALIGN_LEFT, buffer);
 
     return FC_MakeRect(box.x, box.y, width, total_height);
 }
 
 FC_Rect FC_DrawColumnEffect(FC_Font* font, FC_Target* dest, float x, float y, Uint16 width, FC_Effect effect, const char* formatted_text, ...)
 {
+    const char* buffer;
     FC_Rect box = {x, y, width, 0};
     int total_height;
 
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(x, y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     set_color_for_all_caches(font, effect.color);
 
@@ -2208,95 +3420,81 @@ FC_Rect FC_DrawColumnEffect(FC_Font* font, FC_Target* dest, float x, float y, Ui
         break;
     }
 
-    FC_DrawColumnFromBuffer(font, dest, box, &total_height, effect.scale, effect.alignment);
+    FC_DrawColumnFromBuffer(font, dest, box, &total_height, effect.scale, effect.alignment, buffer);
 
     return FC_MakeRect(box.x, box.y, width, total_height);
 }
 
-static FC_Rect FC_RenderCenter(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text)
+// Draws each line of the text up to end (or its terminator) with its center or right edge at x.
+// Unlike FC_RenderLeft(), the lines are a font height apart, without the line spacing.
+static FC_Rect FC_RenderAlignedSpan(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, FC_AlignEnum align, const char* text, const char* end)
 {
     FC_Rect result = {x, y, 0, 0};
-    if(text == NULL || font == NULL)
-        return result;
-
-    char* str = U8_strdup(text);
-    char* del = str;
-    char* c;
+    const char* line = text;
+    const char* c;
+    float offset;
 
-    // Go through str, when you find a \n, replace it with \0 and print it
-    // then move down, back, and continue.
-    for(c = str; *c != '\0';)
+    for(c = text;; ++c)
     {
-        if(*c == '\n')
+        if(c == end || *c == '\0' || *c == '\n')
         {
-            *c = '\0';
-            result = FC_RectUnion(FC_RenderLeft(font, dest, x - scale.x*FC_GetWidth(font, "%s", str)/2.0f, y, scale, str), result);
-            *c = '\n';
-            c++;
-            str = c;
+            offset = scale.x*FC_GetSpanWidth(font, line, c);
+            if(align == FC_ALIGN_CENTER)
+                offset /= 2.0f;
+            else if(align != FC_ALIGN_RIGHT)
+                offset = 0;
+            result = FC_RectUnion(FC_RenderLeftSpan(font, dest, x - offset, y, scale, line, c), result);
+
+            if(c == end || *c == '\0')
+                break;
+            line = c + 1;
             y += scale.y*font->height;
         }
-        else
-            c++;
     }
 
-    result = FC_RectUnion(FC_RenderLeft(font, dest, x - scale.x*FC_GetWidth(font, "%s", str)/2.0f, y, scale, str), result);
-
-    free(del);
     return result;
 }
 
-static FC_Rect FC_RenderRight(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text)
+static FC_Rect FC_RenderCenter(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text)
 {
     FC_Rect result = {x, y, 0, 0};
     if(text == NULL || font == NULL)
         return result;
 
-    char* str = U8_strdup(text);
-    char* del = str;
-    char* c;
-
-    for(c = str; *c != '\0';)
-    {
-        if(*c == '\n')
-        {
-            *c = '\0';
-            result = FC_RectUnion(FC_RenderLeft(font, dest, x - scale.x*FC_GetWidth(font, "%s", str), y, scale, str), result);
-            *c = '\n';
-            c++;
-            str = c;
-            y += scale.y*font->height;
-        }
-        else
-            c++;
-    }
+    return FC_RenderAlignedSpan(font, dest, x, y, scale, FC_ALIGN_CENTER, text, NULL);
+}
 
-    result = FC_RectUnion(FC_RenderLeft(font, dest, x - scale.x*FC_GetWidth(font, "%s", str), y, scale, str), result);
+static FC_Rect FC_RenderRight(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* text)
+{
+    FC_Rect result = {x, y, 0, 0};
+    if(text == NULL || font == NULL)
+        return result;
 
-    free(del);
-    return result;
+    return FC_RenderAlignedSpan(font, dest, x, y, scale, FC_ALIGN_RIGHT, text, NULL);
 }
 
 
 
 FC_Rect FC_DrawScale(FC_Font* font, FC_Target* dest, float x, float y, FC_Scale scale, const char* formatted_text, ...)
 {
+    const char* buffer;
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(x, y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     set_color_for_all_caches(font, font->default_color);
 
-    return FC_RenderLeft(font, dest, x, y, scale, fc_buffer);
+    return FC_RenderLeft(font, dest, x, y, scale, buffer);
 }
 
 FC_Rect FC_DrawAlign(FC_Font* font, FC_Target* dest, float x, float y, FC_AlignEnum align, const char* formatted_text, ...)
 {
+    const char* buffer;
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(x, y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     set_color_for_all_caches(font, font->default_color);
 
@@ -2304,13 +3502,13 @@ FC_Rect FC_DrawAlign(FC_Font* font, FC_Target* dest, float x, float y, FC_AlignE
     switch(align)
     {
         case FC_ALIGN_LEFT:
-            result = FC_RenderLeft(font, dest, x, y, FC_MakeScale(1,1), fc_buffer);
+            result = FC_RenderLeft(font, dest, x, y, FC_MakeScale(1,1), buffer);
             break;
         case FC_ALIGN_CENTER:
-            result = FC_RenderCenter(font, dest, x, y, FC_MakeScale(1,1), fc_buffer);
+            result = FC_RenderCenter(font, dest, x, y, FC_MakeScale(1,1), buffer);
             break;
         case FC_ALIGN_RIGHT:
-            result = FC_RenderRight(font, dest, x, y, FC_MakeScale(1,1), fc_buffer);
+            result = FC_RenderRight(font, dest, x, y, FC_MakeScale(1,1), buffer);
             break;
         default:
             result = FC_MakeRect(x, y, 0, 0);
@@ -2322,23 +3520,25 @@ FC_Rect FC_DrawAlign(FC_Font* font, FC_Target* dest, float x, float y, FC_AlignE
 
 FC_Rect FC_DrawColor(FC_Font* font, FC_Target* dest, float x, float y, SDL_Color color, const char* formatted_text, ...)
 {
+    const char* buffer;
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(x, y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     set_color_for_all_caches(font, color);
 
-    return FC_RenderLeft(font, dest, x, y, FC_MakeScale(1,1), fc_buffer);
+    return FC_RenderLeft(font, dest, x, y, FC_MakeScale(1,1), buffer);
 }
 
 
 FC_Rect FC_DrawEffect(FC_Font* font, FC_Target* dest, float x, float y, FC_Effect effect, const char* formatted_text, ...)
 {
+    const char* buffer;
     if(formatted_text == NULL || font == NULL)
         return FC_MakeRect(x, y, 0, 0);
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     set_color_for_all_caches(font, effect.color);
 
@@ -2346,13 +3546,13 @@ FC_Rect FC_DrawEffect(FC_Font* font, FC_Target* dest, float x, float y, FC_Effec
     switch(effect.alignment)
     {
         case FC_ALIGN_LEFT:
-            result = FC_RenderLeft(font, dest, x, y, effect.scale, fc_buffer);
+            result = FC_RenderLeft(font, dest, x, y, effect.scale, buffer);
             break;
         case FC_ALIGN_CENTER:
-            result = FC_RenderCenter(font, dest, x, y, effect.scale, fc_buffer);
+            result = FC_RenderCenter(font, dest, x, y, effect.scale, buffer);
             break;
         case FC_ALIGN_RIGHT:
-            result = FC_RenderRight(font, dest, x, y, effect.scale, fc_buffer);
+            result = FC_RenderRight(font, dest, x, y, effect.scale, buffer);
             break;
         default:
             result = FC_MakeRect(x, y, 0, 0);
@@ -2363,6 +3563,195 @@ FC_Rect FC_DrawEffect(FC_Font* font, FC_Target* dest, float x, float y, FC_Effec
 }
 
 
+// Retained text
+
+typedef struct FC_TextGlyph
+{
+    FC_Rect src;
+    float x, y;  // Offset from the draw position
+    int cache_level;
+} FC_TextGlyph;
+
+struct FC_Text
+{
+    FC_Font* font;
+    char* string;  // Formatted content the layout was made for
+    int string_capacity;
+    Uint8 dirty;
+    Uint32 layout_generation;
+
+    FC_TextGlyph* glyphs;
+    int num_glyphs;
+    int glyph_capacity;
+    FC_Rect bounds;  // Relative to the draw position
+};
+
+FC_Text* FC_CreateText(FC_Font* font)
+{
+    FC_Text* text = (FC_Text*)malloc(sizeof(FC_Text));
+    if(text == NULL)
+        return NULL;
+
+    memset(text, 0, sizeof(FC_Text));
+    text->font = font;
+    text->dirty = 1;
+    return text;
+}
+
+void FC_FreeText(FC_Text* text)
+{
+    if(text == NULL)
+        return;
+
+    free(text->string);
+    free(text->glyphs);
+    free(text);
+}
+
+Uint8 FC_SetText(FC_Text* text, const char* formatted_text, ...)
+{
+    const char* buffer;
+    int length;
+    if(text == NULL || formatted_text == NULL)
+        return 0;
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    if(text->string != NULL && strcmp(text->string, buffer) == 0)
+        return 0;
+
+    length = strlen(buffer);
+    if(length + 1 > text->string_capacity)
+    {
+        char* new_string = (char*)realloc(text->string, length + 1);
+        if(new_string == NULL)
+            return 0;
+        text->string = new_string;
+        text->string_capacity = length + 1;
+    }
+    memcpy(text->string, buffer, length + 1);
+    text->dirty = 1;
+    return 1;
+}
+
+// Same placement as FC_RenderLeft() at scale 1, relative to the draw position
+static void FC_LayoutText(FC_Text* text)
+{
+    FC_Font* font = text->font;
+    const char* c = text->string;
+    FC_GlyphData glyph;
+    Uint32 codepoint;
+    FC_TextGlyph* g;
+    float destX = 0;
+    float destY = 0;
+
+    text->num_glyphs = 0;
+    text->bounds = FC_MakeRect(0, 0, 0, 0);
+    text->dirty = 0;
+    text->layout_generation = font->layout_generation;
+
+    if(c == NULL || font->glyph_cache_count == 0)
+        return;
+
+    for(; *c != '\0'; c++)
+    {
+        if(*c == '\n')
+        {
+            destX = 0;
+            destY += font->height + font->lineSpacing;
+            continue;
+        }
+
+        codepoint = FC_GetCodepointFromUTF8(&c, 1);  // Increments 'c' to skip the extra UTF-8 bytes
+        if(!FC_GetGlyphData(font, &glyph, codepoint))
+        {
+            codepoint = ' ';
+            if(!FC_GetGlyphData(font, &glyph, codepoint))
+                continue;  // Skip bad characters
+        }
+
+        if(codepoint != ' ')
+        {
+            if(text->num_glyphs == text->glyph_capacity)
+            {
+                int new_capacity = FC_MAX(16, text->glyph_capacity * 2);
+                FC_TextGlyph* new_glyphs = (FC_TextGlyph*)realloc(text->glyphs, new_capacity * sizeof(FC_TextGlyph));
+                if(new_glyphs == NULL)
+                    return;
+                text->glyphs = new_glyphs;
+                text->glyph_capacity = new_capacity;
+            }
+
+            g = &text->glyphs[text->num_glyphs++];
+            #ifdef FC_USE_SDL_GPU
+            g->src.x = glyph.rect.x;
+            g->src.y = glyph.rect.y;
+            g->src.w = glyph.rect.w;
+            g->src.h = glyph.rect.h;
+            #else
+            g->src = glyph.rect;
+            #endif
+            g->x = destX;
+            g->y = destY + glyph.offset_y;
+            g->cache_level = glyph.cache_level;
+
+            if(text->bounds.w == 0 || text->bounds.h == 0)
+                text->bounds = FC_MakeRect(destX, destY, glyph.rect.w, font->height);
+            else
+                text->bounds = FC_RectUnion(text->bounds, FC_MakeRect(destX, destY, glyph.rect.w, font->height));
+        }
+
+        destX += glyph.rect.w + font->letterSpacing;
+    }
+}
+
+static FC_Rect FC_DrawTextScaleColor(FC_Text* text, FC_Target* dest, float x, float y, FC_Scale scale, SDL_Color color)
+{
+    FC_Font* font;
+    FC_Rect bounds;
+    int i;
+    if(text == NULL || text->font == NULL || dest == NULL)
+        return FC_MakeRect(x, y, 0, 0);
+
+    font = text->font;
+    // A glyph rasterized during the layout can repack a budgeted cache and move the glyphs before it, so once more then
+    for(i = 0; i < 2 && (text->dirty || text->layout_generation != font->layout_generation); ++i)
+        FC_LayoutText(text);
+
+    bounds = FC_MakeRect(x + text->bounds.x * scale.x, y + text->bounds.y * scale.y, text->bounds.w * scale.x, text->bounds.h * scale.y);
+
+    set_color_for_all_caches(font, color);
+    for(i = 0; i < text->num_glyphs; ++i)
+    {
+        FC_TextGlyph* g = &text->glyphs[i];
+        fc_render_callback(FC_GetGlyphCacheLevel(font, g->cache_level), &g->src, dest, x + g->x * scale.x, y + g->y * scale.y, scale.x, scale.y);
+    }
+
+    return bounds;
+}
+
+FC_Rect FC_DrawTextColor(FC_Text* text, FC_Target* dest, float x, float y, SDL_Color color)
+{
+    return FC_DrawTextScaleColor(text, dest, x, y, FC_MakeScale(1, 1), color);
+}
+
+FC_Rect FC_DrawTextScale(FC_Text* text, FC_Target* dest, float x, float y, FC_Scale scale)
+{
+    if(text == NULL || text->font == NULL)
+        return FC_MakeRect(x, y, 0, 0);
+
+    return FC_DrawTextScaleColor(text, dest, x, y, scale, text->font->default_color);
+}
+
+FC_Rect FC_DrawText(FC_Text* text, FC_Target* dest, float x, float y)
+{
+    if(text == NULL || text->font == NULL)
+        return FC_MakeRect(x, y, 0, 0);
+
+    return FC_DrawTextColor(text, dest, x, y, text->font->default_color);
+}
+
+
 
 
 // Getters
@@ -2384,17 +3773,12 @@ Uint16 FC_GetLineHeight(FC_Font* font)
     return font->height;
 }
 
-Uint16 FC_GetHeight(FC_Font* font, const char* formatted_text, ...)
+static Uint16 FC_GetTextHeight(FC_Font* font, const char* text)
 {
-    if(formatted_text == NULL || font == NULL)
-        return 0;
-
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
-
     Uint16 numLines = 1;
     const char* c;
 
-    for (c = fc_buffer; *c != '\0'; c++)
+    for (c = text; *c != '\0'; c++)
     {
         if(*c == '\n')
             numLines++;
@@ -2404,18 +3788,28 @@ Uint16 FC_GetHeight(FC_Font* font, const char* formatted_text, ...)
     return font->height*numLines + font->lineSpacing*(numLines - 1);  //height*numLines;
 }
 
-Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...)
+Uint16 FC_GetHeight(FC_Font* font, const char* formatted_text, ...)
 {
+    const char* buffer;
     if(formatted_text == NULL || font == NULL)
         return 0;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_GetTextHeight(font, buffer);
+}
 
+// Width of the text up to end, or its terminator when end is NULL
+static Uint16 FC_GetSpanWidth(FC_Font* font, const char* text, const char* end)
+{
     const char* c;
     Uint16 width = 0;
     Uint16 bigWidth = 0;  // Allows for multi-line strings
+    Uint8 owner_thread = (SDL_ThreadID() == font->owner_thread);
 
-    for (c = fc_buffer; *c != '\0'; c++)
+    if(!owner_thread)
+        FC_BeginGlyphRead(font);
+    for (c = text; c != end && *c != '\0'; c++)
     {
         if(*c == '\n')
         {
@@ -2426,45 +3820,55 @@ Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...)
 
         FC_GlyphData glyph;
         Uint32 codepoint = FC_GetCodepointFromUTF8(&c, 1);
-        if(FC_GetGlyphData(font, &glyph, codepoint) || FC_GetGlyphData(font, &glyph, ' '))
+        if(FC_MeasureGlyph(font, &glyph, codepoint, owner_thread) || FC_MeasureGlyph(font, &glyph, ' ', owner_thread))
             width += glyph.rect.w;
     }
+    if(!owner_thread)
+        FC_EndGlyphRead(font);
     bigWidth = bigWidth >= width? bigWidth : width;
 
     return bigWidth;
 }
 
+Uint16 FC_GetWidth(FC_Font* font, const char* formatted_text, ...)
+{
+    const char* buffer;
+    if(formatted_text == NULL || font == NULL)
+        return 0;
+
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
+
+    return FC_GetSpanWidth(font, buffer, NULL);
+}
+
 // If width == -1, use no width limit
 FC_Rect FC_GetCharacterOffset(FC_Font* font, Uint16 position_index, int column_width, const char* formatted_text, ...)
 {
     FC_Rect result = {0, 0, 1, FC_GetLineHeight(font)};
-    FC_StringList *ls, *iter;
-    int num_lines = 0;
+    FC_Scratch* scratch;
+    const char* buffer;
+    int i, num_lines;
     Uint8 done = 0;
 
     if(formatted_text == NULL || column_width == 0 || position_index == 0 || font == NULL)
         return result;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    ls = FC_GetBufferFitToColumn(font, column_width, FC_MakeScale(1,1), 1);
-    for(iter = ls; iter != NULL;)
+    scratch = FC_GetScratch();
+    num_lines = (scratch != NULL? FC_WrapLines(font, scratch, buffer, column_width, 1) : -1);
+    for(i = 0; i < num_lines; ++i)
     {
-        char* line;
-        int i = 0;
-        FC_StringList* next_iter = iter->next;
+        const FC_LineSpan* line = &scratch->lines[i];
+        const char* c;
 
-        ++num_lines;
-        for(line = iter->value; line != NULL && *line != '\0'; line = (char*)U8_next(line))
+        for(c = line->start; c != line->end; c = U8_next(c))
         {
-            ++i;
             --position_index;
             if(position_index == 0)
             {
                 // FIXME: Doesn't handle box-wrapped newlines correctly
-                line = (char*)U8_next(line);
-                line[0] = '\0';
-                result.x = FC_GetWidth(font, "%s", iter->value);
+                result.x = FC_GetSpanWidth(font, line->start, U8_next(c));
                 done = 1;
                 break;
             }
@@ -2473,15 +3877,13 @@ FC_Rect FC_GetCharacterOffset(FC_Font* font, Uint16 position_index, int column_w
             break;
 
         // Prevent line wrapping if there are no more lines
-        if(next_iter == NULL && !done)
-            result.x = FC_GetWidth(font, "%s", iter->value);
-        iter = next_iter;
+        if(i + 1 == num_lines)
+            result.x = FC_GetSpanWidth(font, line->start, line->end);
     }
-    FC_StringListFree(ls);
 
-    if(num_lines > 1)
+    if(num_lines > 1 && i > 0)
     {
-        result.y = (num_lines - 1) * FC_GetLineHeight(font);
+        result.y = (FC_MIN(i, num_lines - 1)) * FC_GetLineHeight(font);
     }
 
     return result;
@@ -2490,9 +3892,9 @@ FC_Rect FC_GetCharacterOffset(FC_Font* font, Uint16 position_index, int column_w
 
 Uint16 FC_GetColumnHeight(FC_Font* font, Uint16 width, const char* formatted_text, ...)
 {
-    int y = 0;
-
-    FC_StringList *ls, *iter;
+    FC_Scratch* scratch;
+    const char* buffer;
+    int num_lines;
 
     if(font == NULL)
         return 0;
@@ -2500,44 +3902,56 @@ Uint16 FC_GetColumnHeight(FC_Font* font, Uint16 width, const char* formatted_tex
     if(formatted_text == NULL || width == 0)
         return font->height;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    ls = FC_GetBufferFitToColumn(font, width, FC_MakeScale(1,1), 0);
-    for(iter = ls; iter != NULL; iter = iter->next)
-    {
-        y += FC_GetLineHeight(font);
-    }
-    FC_StringListFree(ls);
+    scratch = FC_GetScratch();
+    num_lines = (scratch != NULL? FC_WrapLines(font, scratch, buffer, width, 0) : -1);
 
-    return y;
+    return FC_MAX(num_lines, 0) * FC_GetLineHeight(font);
 }
 
-static int FC_GetAscentFromCodepoint(FC_Font* font, Uint32 codepoint)
+// Whether FC_MeasureGlyph() finds the glyph, on any thread
+static Uint8 FC_HasGlyph(FC_Font* font, Uint32 codepoint)
 {
     FC_GlyphData glyph;
+    Uint8 found;
+    Uint8 owner_thread = (SDL_ThreadID() == font->owner_thread);
+
+    if(!owner_thread)
+        FC_BeginGlyphRead(font);
+    found = FC_MeasureGlyph(font, &glyph, codepoint, owner_thread);
+    if(!owner_thread)
+        FC_EndGlyphRead(font);
+    return found;
+}
 
+static int FC_GetAscentFromCodepoint(FC_Font* font, Uint32 codepoint)
+{
     if(font == NULL)
         return 0;
 
     // FIXME: Store ascent so we can return it here
-    FC_GetGlyphData(font, &glyph, codepoint);
-    return glyph.rect.h;
+    // Cached glyphs are cropped to their inked rows, SDL_ttf renders them all at the font height
+    if(!FC_HasGlyph(font, codepoint))
+        return 0;
+    return font->height;
 }
 
 static int FC_GetDescentFromCodepoint(FC_Font* font, Uint32 codepoint)
 {
-    FC_GlyphData glyph;
-
     if(font == NULL)
         return 0;
 
     // FIXME: Store descent so we can return it here
-    FC_GetGlyphData(font, &glyph, codepoint);
-    return glyph.rect.h;
+    // Cached glyphs are cropped to their inked rows, SDL_ttf renders them all at the font height
+    if(!FC_HasGlyph(font, codepoint))
+        return 0;
+    return font->height;
 }
 
 int FC_GetAscent(FC_Font* font, const char* formatted_text, ...)
 {
+    const char* buffer;
     Uint32 codepoint;
     int max, ascent;
     const char* c;
@@ -2548,10 +3962,10 @@ int FC_GetAscent(FC_Font* font, const char* formatted_text, ...)
     if(formatted_text == NULL)
         return font->ascent;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     max = 0;
-    c = fc_buffer;
+    c = buffer;
 
     while(*c != '\0')
     {
@@ -2569,6 +3983,7 @@ int FC_GetAscent(FC_Font* font, const char* formatted_text, ...)
 
 int FC_GetDescent(FC_Font* font, const char* formatted_text, ...)
 {
+    const char* buffer;
     Uint32 codepoint;
     int max, descent;
     const char* c;
@@ -2579,10 +3994,10 @@ int FC_GetDescent(FC_Font* font, const char* formatted_text, ...)
     if(formatted_text == NULL)
         return font->descent;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
     max = 0;
-    c = fc_buffer;
+    c = buffer;
 
     while(*c != '\0')
     {
@@ -2641,19 +4056,84 @@ SDL_Color FC_GetDefaultColor(FC_Font* font)
     return font->default_color;
 }
 
+Uint32 FC_GetCacheMemory(FC_Font* font)
+{
+    int i;
+    int w, h;
+    Uint32 result = 0;
+    if(font == NULL)
+        return 0;
+
+    for(i = 0; i < font->glyph_cache_count; ++i)
+    {
+        #ifdef FC_USE_SDL_GPU
+        w = font->glyph_cache[i]->w;
+        h = font->glyph_cache[i]->h;
+        #else
+        if(SDL_QueryTexture(font->glyph_cache[i], NULL, NULL, &w, &h) < 0)
+            continue;
+        #endif
+        result += 4 * w * h;
+    }
+
+    return result;
+}
+
+void FC_GetCacheStats(FC_Font* font, FC_CacheStats* stats)
+{
+    FC_Map* glyphs;
+    FC_Rect* rect;
+    unsigned int i;
+
+    if(stats == NULL)
+        return;
+    memset(stats, 0, sizeof(FC_CacheStats));
+    if(font == NULL || font->glyphs == NULL)
+        return;
+
+    glyphs = font->glyphs;
+    stats->num_levels = font->glyph_cache_count;
+    stats->num_glyphs = FC_GetNumCodepoints(font);
+    stats->texture_bytes = FC_GetCacheMemory(font);
+    stats->budget_bytes = font->cache_budget;
+    stats->hits = font->cache_hits;
+    stats->misses = font->cache_misses;
+    stats->evictions = font->cache_evictions;
+    stats->repacks = font->cache_repacks;
+
+    for(i = 0; i < FC_MAP_DIRECT_SIZE; ++i)
+    {
+        if(glyphs->direct_used[i])
+        {
+            rect = &glyphs->direct[i].rect;
+            stats->glyph_bytes += 4 * rect->w * rect->h;
+        }
+    }
+    for(i = 0; i < glyphs->capacity; ++i)
+    {
+        if(glyphs->entries[i].key != FC_MAP_EMPTY_KEY)
+        {
+            rect = &glyphs->entries[i].value.rect;
+            stats->glyph_bytes += 4 * rect->w * rect->h;
+        }
+    }
+
+    if(stats->texture_bytes > 0)
+        stats->utilization = stats->glyph_bytes / (float)stats->texture_bytes;
+}
+
 FC_Rect FC_GetBounds(FC_Font* font, float x, float y, FC_AlignEnum align, FC_Scale scale, const char* formatted_text, ...)
 {
     FC_Rect result = {x, y, 0, 0};
+    const char* buffer;
     
-    if(formatted_text == NULL)
+    if(formatted_text == NULL || font == NULL)
         return result;
     
-    // Create a temp buffer while GetWidth and GetHeight use fc_buffer.
-    char* temp = (char*)malloc(fc_buffer_size);
-    FC_EXTRACT_VARARGS(temp, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
     
-    result.w = FC_GetWidth(font, "%s", temp) * scale.x;
-    result.h = FC_GetHeight(font, "%s", temp) * scale.y;
+    result.w = FC_GetSpanWidth(font, buffer, NULL) * scale.x;
+    result.h = FC_GetTextHeight(font, buffer) * scale.y;
     
     switch(align)
     {
@@ -2669,8 +4149,6 @@ FC_Rect FC_GetBounds(FC_Font* font, float x, float y, FC_AlignEnum align, FC_Sca
             break;
     }
     
-    free(temp);
-    
     return result;
 }
 
@@ -2682,7 +4160,10 @@ Uint8 FC_InRect(float x, float y, FC_Rect input_rect)
 // TODO: Make it work with alignment
 Uint16 FC_GetPositionFromOffset(FC_Font* font, float x, float y, int column_width, FC_AlignEnum align, const char* formatted_text, ...)
 {
-    FC_StringList *ls, *iter;
+    FC_Scratch* scratch;
+    const char* buffer;
+    int i, num_lines;
+    Uint8 owner_thread;
     Uint8 done = 0;
     int height = FC_GetLineHeight(font);
     Uint16 position = 0;
@@ -2693,18 +4174,22 @@ Uint16 FC_GetPositionFromOffset(FC_Font* font, float x, float y, int column_widt
     if(formatted_text == NULL || column_width == 0 || font == NULL)
         return 0;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    ls = FC_GetBufferFitToColumn(font, column_width, FC_MakeScale(1,1), 1);
-    for(iter = ls; iter != NULL; iter = iter->next)
+    owner_thread = (SDL_ThreadID() == font->owner_thread);
+    scratch = FC_GetScratch();
+    num_lines = (scratch != NULL? FC_WrapLines(font, scratch, buffer, column_width, 1) : -1);
+    if(!owner_thread)
+        FC_BeginGlyphRead(font);
+    for(i = 0; i < num_lines; ++i)
     {
-        char* line;
+        const char* c;
 
-        for(line = iter->value; line != NULL && *line != '\0'; line = (char*)U8_next(line))
+        for(c = scratch->lines[i].start; c != scratch->lines[i].end; c = U8_next(c))
         {
-            if(FC_GetGlyphData(font, &glyph_data, FC_GetCodepointFromUTF8((const char**)&line, 0)))
+            if(FC_MeasureGlyph(font, &glyph_data, FC_GetCodepointFromUTF8(&c, 0), owner_thread))
             {
-                if(FC_InRect(x, y, FC_MakeRect(current_x, current_y, glyph_data.rect.w, glyph_data.rect.h)))
+                if(FC_InRect(x, y, FC_MakeRect(current_x, current_y, glyph_data.rect.w, font->height)))
                 {
                     done = 1;
                     break;
@@ -2722,43 +4207,47 @@ Uint16 FC_GetPositionFromOffset(FC_Font* font, float x, float y, int column_widt
         if(y < current_y)
             break;
     }
-    FC_StringListFree(ls);
+    if(!owner_thread)
+        FC_EndGlyphRead(font);
 
     return position;
 }
 
 int FC_GetWrappedText(FC_Font* font, char* result, int max_result_size, Uint16 width, const char* formatted_text, ...)
 {
-    FC_StringList *ls, *iter;
+    FC_Scratch* scratch;
+    const char* buffer;
+    int i, num_lines;
+    int size_so_far = 0;
+    int size_remaining = max_result_size-1; // reserve for \0
 
-    if(font == NULL)
+    if(font == NULL || result == NULL || max_result_size < 1)
         return 0;
 
     if(formatted_text == NULL || width == 0)
         return 0;
 
-    FC_EXTRACT_VARARGS(fc_buffer, formatted_text);
+    FC_EXTRACT_VARARGS(buffer, formatted_text);
 
-    ls = FC_GetBufferFitToColumn(font, width, FC_MakeScale(1,1), 0);
-    int size_so_far = 0;
-    int size_remaining = max_result_size-1; // reserve for \0
-    for(iter = ls; iter != NULL && size_remaining > 0; iter = iter->next)
+    scratch = FC_GetScratch();
+    num_lines = (scratch != NULL? FC_WrapLines(font, scratch, buffer, width, 0) : -1);
+    for(i = 0; i < num_lines && size_remaining > 0; ++i)
     {
         // Copy as much of this line as we can
-        int len = strlen(iter->value);
+        int len = scratch->lines[i].end - scratch->lines[i].start;
         int num_bytes = FC_MIN(len, size_remaining);
-        memcpy(&result[size_so_far], iter->value, num_bytes);
+        memcpy(&result[size_so_far], scratch->lines[i].start, num_bytes);
         size_so_far += num_bytes;
+        size_remaining -= num_bytes;
         
         // If there's another line, add newline character
-        if(size_remaining > 0 && iter->next != NULL)
+        if(size_remaining > 0 && i + 1 < num_lines)
         {
             --size_remaining;
             result[size_so_far] = '\n';
             ++size_so_far;
         }
     }
-    FC_StringListFree(ls);
     
     result[size_so_far] = '\0';
 
@@ -2803,6 +4292,7 @@ void FC_SetSpacing(FC_Font* font, int LetterSpacing)
         return;
 
     font->letterSpacing = LetterSpacing;
+    font->layout_generation++;
 }
 
 void FC_SetLineSpacing(FC_Font* font, int LineSpacing)
@@ -2811,6 +4301,7 @@ void FC_SetLineSpacing(FC_Font* font, int LineSpacing)
         return;
 
     font->lineSpacing = LineSpacing;
+    font->layout_generation++;
 }
 
 void FC_SetDefaultColor(FC_Font* font, SDL_Color color)
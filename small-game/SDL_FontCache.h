@@ -82,6 +82,12 @@ typedef enum
     FC_FILTER_LINEAR
 } FC_FilterEnum;
 
+typedef enum
+{
+    FC_LOAD_STRING,  // Rasterize the loading string when the font is loaded, the rest on first use
+    FC_LOAD_ON_DEMAND  // Rasterize every glyph on first use, needs render target support
+} FC_LoadModeEnum;
+
 typedef struct FC_Scale
 {
     float x;
@@ -100,14 +106,33 @@ typedef struct FC_Effect
 // Opaque type
 typedef struct FC_Font FC_Font;
 
+// Opaque type, a string laid out once and redrawn from the layout until its content changes
+typedef struct FC_Text FC_Text;
+
 
 typedef struct FC_GlyphData
 {
     SDL_Rect rect;
     int cache_level;
+    int offset_y;  // Empty rows above the glyph's rect, which are not stored in the cache
 
 } FC_GlyphData;
 
+typedef struct FC_CacheStats
+{
+    int num_levels;
+    int num_glyphs;
+    Uint32 texture_bytes;
+    Uint32 glyph_bytes;  // Part of texture_bytes covered by glyphs
+    float utilization;  // glyph_bytes / texture_bytes
+    Uint32 budget_bytes;  // 0 when the cache is unbounded
+    Uint32 hits;  // Lookups of cached glyphs
+    Uint32 misses;  // Glyphs rasterized after loading
+    Uint32 evictions;  // Glyphs dropped to stay within the budget
+    Uint32 repacks;
+
+} FC_CacheStats;
+
 
 
 
@@ -215,10 +240,22 @@ void U8_strdel(char* string, int position);
 /*! Sets the string from which to load the initial glyphs.  Use this if you need upfront loading for any reason (such as lack of render-target support). */
 void FC_SetLoadingString(FC_Font* font, const char* string);
 
-/*! Returns the size of the internal buffer which is used for unpacking variadic text data.  This buffer is shared by all FC_Fonts. */
+/*! Sets which glyphs are rasterized when the font is loaded.  Pass a short loading string with FC_LOAD_STRING to declare the only glyphs a font needs. */
+void FC_SetLoadMode(FC_Font* font, FC_LoadModeEnum mode);
+
+/*! Sets a directory for packed glyph atlases.  Fonts loaded from a file save their atlas there and later loads of the same file, size, style and loading string read it back instead of rasterizing.  NULL, the default, disables it and "" is the working directory. */
+void FC_SetAtlasCacheDir(FC_Font* font, const char* directory);
+
+/*! Makes the next load build distance field glyphs, baked into a steep alpha ramp that stays sharp through FC_DrawScale() and FC_DrawTextScale() up to about twice the loaded size, so one atlas serves the smaller sizes too.  Sets FC_FILTER_LINEAR. */
+void FC_SetDistanceField(FC_Font* font, Uint8 enable);
+
+/*! Caps the texture memory of the glyph cache levels.  When a new glyph needs another level past the budget, the least recently used glyphs are evicted and the rest repacked, which moves glyphs and lays FC_Text handles out again.  0, the default, never evicts.  At least one level is always kept, and a repack briefly holds the old and new levels. */
+void FC_SetCacheBudget(FC_Font* font, Uint32 max_bytes);
+
+/*! Returns the size of the buffers which are used for unpacking variadic text data.  Each thread has its own, shared by all FC_Fonts, so the FC_Get*() functions can measure and wrap text on worker threads.  Only glyphs already cached are seen there, the rest measure as spaces.  Drawing stays on the thread that loaded the font, which may keep adding and evicting glyphs meanwhile, as the glyph map is locked against it.  Loading, clearing and freeing the font must not overlap with other threads using it. */
 unsigned int FC_GetBufferSize(void);
 
-/*! Changes the size of the internal buffer which is used for unpacking variadic text data.  This buffer is shared by all FC_Fonts. */
+/*! Changes the size of the buffers which are used for unpacking variadic text data.  Each thread resizes its buffer the next time it formats text, so set this before starting threads that use the font cache. */
 void FC_SetBufferSize(unsigned int size);
 
 void FC_SetRenderCallback(FC_Rect (*callback)(FC_Image* src, FC_Rect* srcrect, FC_Target* dest, float x, float y, float xscale, float yscale));
@@ -251,7 +288,7 @@ void FC_GetCodepoints(FC_Font* font, Uint32* result);
 /*! Stores the glyph data for the given codepoint in 'result'.  Returns 0 if the codepoint was not found in the cache. */
 Uint8 FC_GetGlyphData(FC_Font* font, FC_GlyphData* result, Uint32 codepoint);
 
-/*! Sets the glyph data for the given codepoint.  Duplicates are not checked.  Returns a pointer to the stored data. */
+/*! Sets the glyph data for the given codepoint, replacing any existing data.  Returns a pointer to the stored data, valid until the next glyph is added. */
 FC_GlyphData* FC_SetGlyphData(FC_Font* font, Uint32 codepoint, FC_GlyphData glyph_data);
 
 
@@ -276,6 +313,19 @@ FC_Rect FC_DrawColumnColor(FC_Font* font, FC_Target* dest, float x, float y, Uin
 FC_Rect FC_DrawColumnEffect(FC_Font* font, FC_Target* dest, float x, float y, Uint16 width, FC_Effect effect, const char* formatted_text, ...);
 
 
+// Retained text
+
+FC_Text* FC_CreateText(FC_Font* font);
+void FC_FreeText(FC_Text* text);
+
+/*! Formats the text content.  Returns 1 if it changed, which lays the text out again on its next draw. */
+Uint8 FC_SetText(FC_Text* text, const char* formatted_text, ...);
+
+FC_Rect FC_DrawText(FC_Text* text, FC_Target* dest, float x, float y);
+FC_Rect FC_DrawTextColor(FC_Text* text, FC_Target* dest, float x, float y, SDL_Color color);
+FC_Rect FC_DrawTextScale(FC_Text* text, FC_Target* dest, float x, float y, FC_Scale scale);
+
+
 // Getters
 
 FC_FilterEnum FC_GetFilterMode(FC_Font* font);
@@ -294,6 +344,9 @@ int FC_GetSpacing(FC_Font* font);
 int FC_GetLineSpacing(FC_Font* font);
 Uint16 FC_GetMaxWidth(FC_Font* font);
 SDL_Color FC_GetDefaultColor(FC_Font* font);
+// Bytes of texture memory held by the glyph cache levels
+Uint32 FC_GetCacheMemory(FC_Font* font);
+void FC_GetCacheStats(FC_Font* font, FC_CacheStats* stats);
 
 FC_Rect FC_GetBounds(FC_Font* font, float x, float y, FC_AlignEnum align, FC_Scale scale, const char* formatted_text, ...);
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <type_traits>
 #include <stdint.h>
 
 // The logical screen width and height being rendered to
@@ -21,6 +22,8 @@
 #define polarToCar(r, theta) {SCREEN_WIDTH / 2 + r * cos(degToRad(theta)), SCREEN_HEIGHT / 2 + r * sin(degToRad(theta))}
 
 #define MAX_CONTROLLERS 4
+#define MAX_PLAYERS MAX_CONTROLLERS
+#define MAX_DESTS 5
 
 #ifdef DEBUG
 	#define LogDebug(...) SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, __VA_ARGS__);
@@ -169,6 +172,14 @@ inline Vector2f operator/(Vector2f a, real32 b) {
 }
 
 
+#define MAX_INPUT_EDGES 64
+
+// A change of the movement direction, so the physics step can apply it at the time it happened
+struct InputEdge {
+	uint32 timestamp; // SDL event timestamp (ms)
+	Vector2f move; // dir_right - dir_left, dir_down - dir_up after the change
+};
+
 struct ControllerInput {
 	real32 dir_left;
 	real32 dir_right;
@@ -192,17 +203,40 @@ struct ControllerInput {
 	bool button_r2;
 	bool button_select;
 	bool button_start;
+
+	// SDL event timestamps (ms) of the latest change and of the oldest change not yet presented, 0 if none
+	uint32 change_timestamp;
+	uint32 unpresented_change_timestamp;
+
+	// Save state hotkeys, 1 based slot or 0, cleared once handled
+	int32 save_slot;
+	int32 load_slot;
+
+	// Movement changes not yet consumed by a tick, oldest first, and the movement before them
+	Vector2f move_before_edges;
+	InputEdge move_edges[MAX_INPUT_EDGES];
+	uint32 num_move_edges;
+	// Real time window (SDL ms) the current tick covers
+	real64 tick_start_ms;
+	real64 tick_end_ms;
 };
 
 enum State {
 	MainMenu, Beginning, Playing, Dead, Paused, GameOver, Shaking, Ending
 };
 
+struct Player {
+	Vector2f pos = { SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2 };
+	Vector2f speed = {};
+	uint32 lives = 5;
+	bool active = true; // false once hit with no lives left
+};
+
 struct GameState {
-	Vector2f player_pos = { SCREEN_WIDTH / 2, SCREEN_HEIGHT /2 };
-	Vector2f player_speed = {};
+	Player players[MAX_PLAYERS];
+	uint32 num_players = 1;
+	uint32 hit_player = 0; // the crab that blinks after a hit
 	bool player_visible = true;
-	uint32 player_lives = 5;
 
 	Vector2f ball_pos = { SCREEN_WIDTH / 2, 40 };
 	Vector2f next_ball_pos;
@@ -230,12 +264,29 @@ struct GameState {
 	uint32 shaking_frames = 0;
 	uint32 beginning_frames = 0;
 	bool shaking_for_dead = false;
+	uint8 enemy_message = 0;
 
 	bool dests_visible = false;
 	SDL_Color dests_color = {};
+
+	// Ball phase working values
+	Vector2f phase_org_pos = {}; // where the ball was when the current easing phase started
+	real32 spiral_b = -4.f;
+	real32 center_x = SCREEN_WIDTH / 2;
+	real32 center_y = SCREEN_HEIGHT / 2;
+	real32 dests[MAX_DESTS] = {}; // angles of the points the ball travels between
+	uint8 num_dests = 2;
+	uint8 current_dest = 0;
+
+	int32 player_sprite_x = 0;
+	int32 enemy_sprite_x = 0;
+	bool last_pause_press = false;
 };
 
-extern GameState * state;
+// Everything the simulation depends on lives in GameState, so copying it is a whole snapshot
+static_assert(std::is_trivially_copyable<GameState>::value, "GameState must stay trivially copyable");
+
+extern thread_local GameState * state;
 
 struct BallPhase {
 	uint32 total_frames;
@@ -243,11 +294,18 @@ struct BallPhase {
 
 	void update() {
 		if (ballPhaseCheck(total_frames)) {
-			execute();
+			if (execute) {
+				execute();
+			}
 			state->ball_phase_frames++;
 		}
 	}
 
+	// Idle phases don't touch the ball, so it can be advanced analytically through them
+	bool isIdle() const {
+		return !execute;
+	}
+
 	static bool ballPhaseCheck(uint32 frame_limit) {
 		if (state->ball_phase_frames < frame_limit) {
 			return true;
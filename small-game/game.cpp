@@ -2,12 +2,15 @@
 #include <string>
 #include <sstream> 
 #include <iostream>
+#include <float.h>
 #include <SDL.h>
 #include <SDL_mixer.h>
 #include <SDL_image.h>
 #include <SDL_ttf.h>
 #include "definitions.h"
 #include "SDL_FontCache.h"
+#include "net.h"
+#include "gamepad.h"
 
 
 static const int32 player_width = 64;
@@ -16,20 +19,75 @@ static const int32 ball_radius = 512;
 static const int32 player_radius = 28;
 static real32 ppm = 32; // pixels per meter
 
-GameState * state;
+// Simulation globals are per thread, so checkpoints can be simulated in the background
+thread_local GameState * state;
 static int screen_physical_width = 1280;
 static int screen_physical_height = 720;
 static bool closing = false;
+// In versus the one player at this machine, whose Select alone closes the game. -1 when every player is local.
+static int32 closing_player = -1;
 static uint64 frame_count = 0;
-static int player_sprite_x = 0;
-static int enemy_sprite_x = 0;
-static bool last_pause_press = false;
-SDL_GameController *gamepad_handles[MAX_CONTROLLERS];
+static bool show_ball_path = false;
+#ifdef DEBUG
+static thread_local bool last_skip_press = false;
+#endif
+// Running without audio and without a player that can be hit, e.g. to build practice checkpoints
+static thread_local bool headless_simulation = false;
+// Set while rollback re-simulates frames whose sounds and scrolling already happened the first time
+static thread_local bool resimulating = false;
+// Set while any versus frame runs. Its state may still be rolled back, so the music follows the confirmed frames instead.
+static thread_local bool rollback_simulation = false;
+
+// Rendering into a logical resolution texture and scaling it once at present time,
+// instead of rasterizing every sprite at the window resolution
+struct RenderSettings {
+	bool offscreen;
+	int32 offscreen_width;
+	int32 offscreen_height;
+	bool integer_scale;
+	bool shake_with_render_target; // the old shake, drawing the frame to a texture and copying that back offset
+};
+static RenderSettings render_settings = { false, SCREEN_WIDTH, SCREEN_HEIGHT, false, false };
+static SDL_Texture * frame_texture = NULL;
+
+#ifdef DEBUG
+struct FrameProfile {
+	uint64 frame_counter;
+	uint32 frames;
+	uint32 ticks;
+	uint32 input_latency_min; // ms from the SDL event timestamp to present
+	uint32 input_latency_max;
+	uint32 input_latency_sum;
+	uint32 input_latency_count;
+	uint64 ball_counter;
+	uint32 ball_steps;
+	uint32 ball_segments;
+	uint32 ball_segments_max;
+	uint64 rewind_counter;
+	uint32 rewind_frames;
+	uint32 rewind_bytes;
+	uint64 rollback_counter;
+	uint32 rollback_ticks;
+	uint32 rollback_frames_max;
+};
+static thread_local FrameProfile profile = {};
+#endif
+
 int32 music_volume = MIX_MAX_VOLUME / 8;
 
 FC_Font* font;
 FC_Font* large_font;
-static int32 gamepad_index = 0;
+const char * large_font_glyphs = "Beware the Orb Game Over";
+// Packed glyph atlases are saved here after the first launch, next to the save states
+const char * font_cache_dir = "";
+// Cache levels each font's glyph cache may fill before it evicts glyphs it has not drawn lately, see fontCacheBudget
+const uint32 font_cache_levels = 2;
+// HUD strings, laid out again only when their content changes
+FC_Text* lives_texts[MAX_PLAYERS];
+FC_Text* game_over_text;
+FC_Text* enemy_text;
+FC_Text* title_text;
+FC_Text* menu_text;
 static void SDLInitGamepads()
 {
 	SDL_GameControllerAddMapping("030000001008000001e5000000000000,NEXT SNES Controller,a:b2,b:b1,back:b8,dpdown:+a1,dpleft:-a0,dpright:+a0,dpup:-a1,leftshoulder:b4,rightshoulder:b5,start:b9,x:b3,y:b0,");
@@ -37,41 +95,122 @@ static void SDLInitGamepads()
 	int32 max_joysticks = SDL_NumJoysticks();
 	for (int32 joystick_index = 0; joystick_index < max_joysticks; ++joystick_index)
 	{
-		if (!SDL_IsGameController(joystick_index))
-		{
-			continue;
-		}
-		if (gamepad_index >= MAX_CONTROLLERS)
-		{
-			break;
-		}
-		gamepad_handles[gamepad_index] = SDL_GameControllerOpen(joystick_index);
+		gamepadAdd(joystick_index);
+	}
+}
+
+
+// Only changes to what the game reacts to count for the input to present latency, not mouse motion or unused buttons
+static bool gameplayInputChanged(const ControllerInput &before, const ControllerInput &after) {
+	return before.dir_up != after.dir_up || before.dir_down != after.dir_down || before.dir_left != after.dir_left || before.dir_right != after.dir_right ||
+		before.button_start != after.button_start || before.button_select != after.button_select || before.button_l != after.button_l || before.button_r != after.button_r ||
+		before.save_slot != after.save_slot || before.load_slot != after.load_slot;
+}
+
+static void tagInputChange(ControllerInput &controller, uint32 timestamp) {
+	controller.change_timestamp = timestamp;
+	if (controller.unpresented_change_timestamp == 0) {
+		controller.unpresented_change_timestamp = timestamp;
+	}
+}
+
+static Vector2f getMoveInput(const ControllerInput &controller) {
+	return { controller.dir_right - controller.dir_left, controller.dir_down - controller.dir_up };
+}
+
+static void pushMoveEdge(ControllerInput &controller, uint32 timestamp) {
+	// When full, the newest edge is overwritten so the latest direction is never lost
+	uint32 index = MIN(controller.num_move_edges, MAX_INPUT_EDGES - 1);
+	controller.move_edges[index] = { timestamp, getMoveInput(controller) };
+	controller.num_move_edges = index + 1;
+}
+
+// Drops the edges a finished tick has applied
+static void consumeMoveEdges(ControllerInput &controller, real64 until_ms) {
+	uint32 consumed = 0;
+	while (consumed < controller.num_move_edges && controller.move_edges[consumed].timestamp <= until_ms) {
+		controller.move_before_edges = controller.move_edges[consumed].move;
+		consumed++;
+	}
+	controller.num_move_edges -= consumed;
+	memmove(controller.move_edges, controller.move_edges + consumed, controller.num_move_edges * sizeof(InputEdge));
+}
+
+// Last snapshot applied per slot, so only what changed is applied and the keyboard keeps driving the rest of player 1
+static GamepadSnapshot applied_snapshots[MAX_CONTROLLERS];
+
+static bool gamepadButton(const GamepadSnapshot * snapshot, SDL_GameControllerButton button) {
+	return (snapshot->buttons >> button) & 1;
+}
 
-		char *mapping;
-		mapping = SDL_GameControllerMapping(gamepad_handles[gamepad_index]);
-		SDL_Log("Controller %i is mapped as \"%s\".", joystick_index, mapping);
+static void applyGamepadButton(bool * target, const GamepadSnapshot * old_snapshot, const GamepadSnapshot * snapshot, SDL_GameControllerButton button) {
+	if (gamepadButton(old_snapshot, button) != gamepadButton(snapshot, button)) {
+		*target = gamepadButton(snapshot, button);
+	}
+}
 
-		gamepad_index++;
+// Applies one axis of the left stick merged with the d-pad, if either changed
+static void applyGamepadAxis(real32 * negative, real32 * positive, int16 old_value, int16 value, uint16 changed_buttons, const GamepadSnapshot * snapshot, SDL_GameControllerButton negative_button, SDL_GameControllerButton positive_button) {
+	if (old_value == value && !((changed_buttons >> negative_button) & 1) && !((changed_buttons >> positive_button) & 1)) {
+		return;
 	}
+	real32 axis = value > 0 ? value / 32767.f : value / 32768.f;
+	*negative = MAX(-axis, gamepadButton(snapshot, negative_button) ? 1.0f : 0);
+	*positive = MAX(axis, gamepadButton(snapshot, positive_button) ? 1.0f : 0);
 }
 
+// Gamepad state comes from the polling thread rather than events, timestamped when it was polled
+static void applyGamepadSnapshot(ControllerInput &controller, int32 slot, const GamepadSnapshot * snapshot) {
+	const GamepadSnapshot * old_snapshot = &applied_snapshots[slot];
+	const ControllerInput old_controller = controller;
+	const Vector2f old_move = getMoveInput(controller);
+	uint16 changed_buttons = old_snapshot->buttons ^ snapshot->buttons;
+	applyGamepadAxis(&controller.dir_left, &controller.dir_right, old_snapshot->left_x, snapshot->left_x, changed_buttons, snapshot, SDL_CONTROLLER_BUTTON_DPAD_LEFT, SDL_CONTROLLER_BUTTON_DPAD_RIGHT);
+	applyGamepadAxis(&controller.dir_up, &controller.dir_down, old_snapshot->left_y, snapshot->left_y, changed_buttons, snapshot, SDL_CONTROLLER_BUTTON_DPAD_UP, SDL_CONTROLLER_BUTTON_DPAD_DOWN);
+	applyGamepadButton(&controller.button_a, old_snapshot, snapshot, SDL_CONTROLLER_BUTTON_A);
+	applyGamepadButton(&controller.button_b, old_snapshot, snapshot, SDL_CONTROLLER_BUTTON_B);
+	applyGamepadButton(&controller.button_c, old_snapshot, snapshot, SDL_CONTROLLER_BUTTON_X);
+	applyGamepadButton(&controller.button_d, old_snapshot, snapshot, SDL_CONTROLLER_BUTTON_Y);
+	applyGamepadButton(&controller.button_l, old_snapshot, snapshot, SDL_CONTROLLER_BUTTON_LEFTSHOULDER);
+	applyGamepadButton(&controller.button_r, old_snapshot, snapshot, SDL_CONTROLLER_BUTTON_RIGHTSHOULDER);
+	applyGamepadButton(&controller.button_start, old_snapshot, snapshot, SDL_CONTROLLER_BUTTON_START);
+	applyGamepadButton(&controller.button_select, old_snapshot, snapshot, SDL_CONTROLLER_BUTTON_BACK);
+	applied_snapshots[slot] = *snapshot;
+
+	if (gameplayInputChanged(old_controller, controller)) {
+		tagInputChange(controller, snapshot->timestamp);
+	}
+	const Vector2f new_move = getMoveInput(controller);
+	if (new_move.x != old_move.x || new_move.y != old_move.y) {
+		pushMoveEdge(controller, snapshot->timestamp);
+	}
+}
 
-void handleEvents(ControllerInput &controller) {
+// controllers has MAX_CONTROLLERS entries, one per player
+void handleEvents(ControllerInput * controllers) {
 	SDL_Event event;
 	while (SDL_PollEvent(&event)) {
+		// Keyboard and mouse drive player 1
+		ControllerInput &controller = controllers[0];
+		const ControllerInput old_controller = controller;
+		const Vector2f old_move = getMoveInput(controller);
+
 		if (event.type == SDL_QUIT) {
 			closing = true;
 		}
 		else if (event.type == SDL_CONTROLLERDEVICEADDED) {
 			LogInfo("Controller added: %d\n", event.cdevice.which);
-			int32 device_index = event.cdevice.which;
-			if (SDL_IsGameController(device_index)) {
-				SDL_GameController* game_controller = SDL_GameControllerOpen(device_index);
-			}
+			gamepadAdd(event.cdevice.which);
 		}
 		else if (event.type == SDL_CONTROLLERDEVICEREMOVED) {
 			LogInfo("Controller removed: %d\n", event.cdevice.which);
-			int32 instance_id = event.cdevice.which;
+			int32 slot = gamepadSlot(event.cdevice.which);
+			if (slot >= 0) {
+				gamepadRemove(event.cdevice.which);
+				// Let go of everything the pad was holding
+				GamepadSnapshot released = { event.common.timestamp, 0, 0, 0 };
+				applyGamepadSnapshot(controllers[slot], slot, &released);
+			}
 		}
 		else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && !event.key.repeat) {
 			bool is_down = event.type == SDL_KEYDOWN;
@@ -100,84 +239,30 @@ void handleEvents(ControllerInput &controller) {
 			case SDLK_ESCAPE:
 				controller.button_select = is_down;
 				break;
-			}
-		}
-		else if (event.type == SDL_CONTROLLERAXISMOTION) {
-
-			real32 value;
-			if (event.caxis.value > 0) {
-				value = ((real32)event.caxis.value) / 32767.f;
-			}
-			else {
-				value = ((real32)event.caxis.value) / 32768.f;
-			}
-
-			switch (event.caxis.axis) {
-			case SDL_CONTROLLER_AXIS_LEFTX:
-				if (value < 0) {
-					controller.dir_left = -value;
-					controller.dir_right = 0;
-				}
-				else {
-					controller.dir_right = value;
-					controller.dir_left = 0;
-				}
+			case SDLK_r:
+				controller.button_l = is_down;
 				break;
-			case SDL_CONTROLLER_AXIS_LEFTY:
-				if (value < 0) {
-					controller.dir_up = -value;
-					controller.dir_down = 0;
-				}
-				else {
-					controller.dir_down = value;
-					controller.dir_up = 0;
+			case SDLK_F1:
+			case SDLK_F2:
+			case SDLK_F3:
+			case SDLK_F4:
+				if (is_down) {
+					controller.save_slot = event.key.keysym.sym - SDLK_F1 + 1;
 				}
 				break;
-			}
-		}
-		else if (event.type == SDL_CONTROLLERBUTTONDOWN || event.type == SDL_CONTROLLERBUTTONUP) {
-
-			bool is_pressed = event.cbutton.state == SDL_PRESSED;
-
-			switch (event.cbutton.button) {
-			case SDL_CONTROLLER_BUTTON_DPAD_UP:
-				controller.dir_up = is_pressed ? 1.0f : 0;
-				break;
-			case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
-				controller.dir_down = is_pressed ? 1.0f : 0;
-				break;
-			case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
-				controller.dir_left = is_pressed ? 1.0f : 0;
-				break;
-			case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
-				controller.dir_right = is_pressed ? 1.0f : 0;
-				break;
-			case SDL_CONTROLLER_BUTTON_A:
-				controller.button_a = is_pressed;
-				break;
-			case SDL_CONTROLLER_BUTTON_B:
-				controller.button_b = is_pressed;
-				break;
-			case SDL_CONTROLLER_BUTTON_X:
-				controller.button_c = is_pressed;
-				break;
-			case SDL_CONTROLLER_BUTTON_Y:
-				controller.button_d = is_pressed;
-				break;
-			case SDL_CONTROLLER_BUTTON_LEFTSHOULDER:
-				controller.button_l = is_pressed;
-				break;
-			case SDL_CONTROLLER_BUTTON_RIGHTSHOULDER:
-				controller.button_r = is_pressed;
-				break;
-			case SDL_CONTROLLER_BUTTON_START:
-				controller.button_start = is_pressed;
+			case SDLK_F5:
+			case SDLK_F6:
+			case SDLK_F7:
+			case SDLK_F8:
+				if (is_down) {
+					controller.load_slot = event.key.keysym.sym - SDLK_F5 + 1;
+				}
 				break;
-			case SDL_CONTROLLER_BUTTON_BACK:
-				controller.button_select = is_pressed;
+#ifdef DEBUG
+			case SDLK_f:
+				controller.button_r = is_down;
 				break;
-			default:
-				LogWarn("Unknown controller button pressed");
+#endif
 			}
 		}
 		else if (event.type == SDL_MOUSEMOTION) {
@@ -204,6 +289,21 @@ void handleEvents(ControllerInput &controller) {
 		else if (event.type == SDL_MOUSEWHEEL) {
 			controller.mouseWheel += event.wheel.y;
 		}
+
+		if (gameplayInputChanged(old_controller, controller)) {
+			tagInputChange(controller, event.common.timestamp);
+		}
+		const Vector2f new_move = getMoveInput(controller);
+		if (new_move.x != old_move.x || new_move.y != old_move.y) {
+			pushMoveEdge(controller, event.common.timestamp);
+		}
+	}
+
+	for (int32 slot = 0; slot < MAX_CONTROLLERS; slot++) {
+		GamepadSnapshot snapshot;
+		while (gamepadPop(slot, &snapshot)) {
+			applyGamepadSnapshot(controllers[slot], slot, &snapshot);
+		}
 	}
 }
 
@@ -224,6 +324,34 @@ SDL_Texture * loadTexture(SDL_Renderer * renderer, std::string filepath, SDL_Sur
 	return texture;
 }
 
+// Tells the crabs apart when more than one is playing
+static const SDL_Color player_tints[MAX_PLAYERS] = { { 255, 255, 255, 255 }, { 150, 200, 255, 255 }, { 255, 170, 150, 255 }, { 170, 255, 150, 255 } };
+
+// The crab sprite sheet repeated in one row per player with the tint baked in, so all crabs are drawn
+// from the same texture without render state changes in between and the copies batch together
+static SDL_Texture * loadPlayerTexture(SDL_Renderer * renderer) {
+	SDL_Surface * crab_surface = IMG_Load("assets/crab.png");
+	if (crab_surface == NULL) {
+		LogError("Could not load the crab sprite! SDL_image Error: %s\n", IMG_GetError());
+		return NULL;
+	}
+	SDL_Surface * sheet = SDL_CreateRGBSurfaceWithFormat(0, crab_surface->w, player_height * MAX_PLAYERS, 32, SDL_PIXELFORMAT_RGBA32);
+	SDL_Texture * texture = NULL;
+	if (sheet != NULL) {
+		SDL_SetSurfaceBlendMode(crab_surface, SDL_BLENDMODE_NONE);
+		for (int32 i = 0; i < MAX_PLAYERS; i++) {
+			SDL_Rect src_rect = { 0, 0, crab_surface->w, player_height };
+			SDL_Rect dst_rect = { 0, i * player_height, crab_surface->w, player_height };
+			SDL_SetSurfaceColorMod(crab_surface, player_tints[i].r, player_tints[i].g, player_tints[i].b);
+			SDL_BlitSurface(crab_surface, &src_rect, sheet, &dst_rect);
+		}
+		texture = SDL_CreateTextureFromSurface(renderer, sheet);
+		SDL_FreeSurface(sheet);
+	}
+	SDL_FreeSurface(crab_surface);
+	return texture;
+}
+
 
 SDL_Surface * collision_surface = NULL;
 SDL_Surface * player_surface = NULL;
@@ -235,9 +363,19 @@ SDL_Texture * big_circle_texture = NULL;
 SDL_Texture * player_texture = NULL;
 SDL_Texture * enemy_texture = NULL;
 SDL_Texture * ball_texture = NULL;
-SDL_Texture * frozen_texture = NULL;
+SDL_Texture * frozen_texture = NULL; // only with render_settings.shake_with_render_target
 SDL_Texture * ending_texture = NULL;
 
+// A vertically repeating background tile, scrolled by wrapping the source rectangle
+struct ScrollLayer {
+	SDL_Texture * texture;
+	int32 tile_height;
+	real32 speed; // pixels per frame
+	real32 offset; // tile row drawn at the top of the screen
+	real32 prev_offset; // offset at the previous tick, for interpolation
+};
+static ScrollLayer bg_layer = {};
+
 Mix_Music * title_music = NULL;
 Mix_Music * level1_music = NULL;
 Mix_Music * level2_music = NULL;
@@ -250,15 +388,57 @@ Mix_Chunk * bounces[4];
 
 
 
+static bool silentSimulation() {
+	return headless_simulation || resimulating;
+}
+
+// Gameplay sounds go through these so headless and re-simulated frames stay silent
+static void playChannel(int32 channel, Mix_Chunk * chunk) {
+	if (!silentSimulation()) {
+		Mix_PlayChannel(channel, chunk, 0);
+	}
+}
+
+// Music is left alone by silent and by versus frames, see syncVersusMusic
+static bool simulationDrivesMusic() {
+	return !silentSimulation() && !rollback_simulation;
+}
+
+static void playMusic(Mix_Music * music) {
+	if (simulationDrivesMusic()) {
+		Mix_PlayMusic(music, -1);
+	}
+}
+
+static void fadeOutMusic(int32 ms) {
+	if (simulationDrivesMusic()) {
+		Mix_FadeOutMusic(ms);
+	}
+}
+
+static void setMusicVolume(int32 volume) {
+	if (simulationDrivesMusic()) {
+		Mix_VolumeMusic(volume);
+	}
+}
+
+// Spreads the crabs out evenly across the middle row
+static void placePlayers() {
+	for (uint32 i = 0; i < state->num_players; i++) {
+		state->players[i].pos = { SCREEN_WIDTH * (i + 1.f) / (state->num_players + 1), SCREEN_HEIGHT / 2 };
+		state->players[i].speed = {};
+	}
+}
+
 void changeCurrentState(State new_state) {
 	if (state->current_state == Playing) {
 		if (new_state == GameOver) {
-			Mix_FadeOutMusic(300);
-			Mix_PlayChannel(-1, game_over, 0);
+			fadeOutMusic(300);
+			playChannel(-1, game_over);
 			state->gameover_frames = 0;
 		}
 		else if (new_state == Paused) {
-			Mix_VolumeMusic(music_volume / 2);
+			setMusicVolume(music_volume / 2);
 		}
 		else if (new_state == Shaking) {
 			state->shaking_frames = 0;
@@ -271,18 +451,21 @@ void changeCurrentState(State new_state) {
 	}
 	else if (state->current_state == Paused) {
 		if (new_state == Playing) {
-			Mix_VolumeMusic(music_volume);
+			setMusicVolume(music_volume);
 		}
 	}
 	else if (state->current_state == MainMenu) {
 		if (new_state == Beginning) {
-			Mix_PlayMusic(level1_music, -1);
+			playMusic(level1_music);
+			uint32 num_players = state->num_players;
 			*state = GameState();
+			state->num_players = num_players;
+			placePlayers();
 		}
 	}
 	else if (state->current_state == GameOver) {
 		if (new_state == MainMenu) {
-			Mix_PlayMusic(title_music, -1);
+			playMusic(title_music);
 		}
 	}
 	else if (state->current_state == Shaking) {
@@ -309,7 +492,7 @@ void playBounceSound(real32 ball_scale) {
 		index = 3;
 	}
 
-	Mix_PlayChannel(3, bounces[index], 0);
+	playChannel(3, bounces[index]);
 }
 
 void bounceEffect() {
@@ -319,12 +502,24 @@ void bounceEffect() {
 	}
 }
 
+// A cache level is (line height * 12) texels square, so a byte budget has to follow the font size
+// or a large font can't fit even one level
+static uint32 fontCacheBudget(FC_Font * font, uint32 levels) {
+	uint32 level_size = FC_GetLineHeight(font) * 12;
+	return levels * 4 * level_size * level_size;
+}
+
 void initialize(GameState * state, SDL_Renderer * renderer) {
-	frozen_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+	if (render_settings.shake_with_render_target) {
+		frozen_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+	}
 	overlay_texture = loadTexture(renderer, "overlay.png", &player_surface);
 	controls_texture = loadTexture(renderer, "controls.png", &player_surface);
 	bg_texture = loadTexture(renderer, "bg.png", &player_surface);
-	player_texture = loadTexture(renderer, "crab.png");
+	bg_layer.texture = bg_texture;
+	SDL_QueryTexture(bg_texture, NULL, NULL, NULL, &bg_layer.tile_height);
+	bg_layer.speed = 2;
+	player_texture = loadPlayerTexture(renderer);
 	enemy_texture = loadTexture(renderer, "crab_evil.png");
 	ball_texture = loadTexture(renderer, "ball.png");
 	big_circle_texture = loadTexture(renderer, "big_circle.png");
@@ -354,6 +549,19 @@ void initialize(GameState * state, SDL_Renderer * renderer) {
 	}
 
 	SDL_RenderSetLogicalSize(renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
+	if (render_settings.offscreen) {
+		char old_filter_mode[16];
+		snprintf(old_filter_mode, 16, "%s", SDL_GetHint(SDL_HINT_RENDER_SCALE_QUALITY));
+		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, render_settings.integer_scale ? "0" : "1");
+		frame_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, render_settings.offscreen_width, render_settings.offscreen_height);
+		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, old_filter_mode);
+		if (frame_texture == NULL) {
+			LogError("Could not create the offscreen frame texture! SDL_Error: %s\n", SDL_GetError());
+		}
+		if (render_settings.integer_scale) {
+			SDL_RenderSetIntegerScale(renderer, SDL_TRUE);
+		}
+	}
 
 	Mix_VolumeMusic(music_volume);
 	Mix_PlayMusic(title_music, -1);
@@ -362,10 +570,34 @@ void initialize(GameState * state, SDL_Renderer * renderer) {
 	state->ball_direction.normalize();
 
 	// Text
+	uint64 font_counter = SDL_GetPerformanceCounter();
+	(void)font_counter;
 	font = FC_CreateFont();  
 	large_font = FC_CreateFont();
+	// The large font only shows the title and Game Over, anything else gets rasterized on first use
+	FC_SetLoadingString(large_font, large_font_glyphs);
+	FC_SetAtlasCacheDir(font, font_cache_dir);
+	FC_SetAtlasCacheDir(large_font, font_cache_dir);
 	FC_LoadFont(font, renderer, "assets/8bitOperatorPlus-Regular.ttf", 28, FC_MakeColor(255, 255, 255, 255), TTF_STYLE_NORMAL);
 	FC_LoadFont(large_font, renderer, "assets/8bitOperatorPlus-Regular.ttf", 96, FC_MakeColor(255, 255, 255, 255), TTF_STYLE_NORMAL);
+	FC_SetCacheBudget(font, fontCacheBudget(font, font_cache_levels));
+	FC_SetCacheBudget(large_font, fontCacheBudget(large_font, font_cache_levels));
+	LogInfo("Fonts loaded in %.02f ms, %u KB of glyph textures", (1000.0 * (real64)(SDL_GetPerformanceCounter() - font_counter)) / (real64)SDL_GetPerformanceFrequency(), (FC_GetCacheMemory(font) + FC_GetCacheMemory(large_font)) / 1024);
+	FC_Font * loaded_fonts[] = { font, large_font };
+	for (uint32 i = 0; i < LEN(loaded_fonts); i++) {
+		FC_CacheStats stats;
+		FC_GetCacheStats(loaded_fonts[i], &stats);
+		LogInfo("Font %u: %d glyphs on %d cache levels, %.0f%% of the texture used", i, stats.num_glyphs, stats.num_levels, 100.0f * stats.utilization);
+	}
+	for (uint32 i = 0; i < MAX_PLAYERS; i++) {
+		lives_texts[i] = FC_CreateText(font);
+	}
+	game_over_text = FC_CreateText(large_font);
+	FC_SetText(game_over_text, "Game Over");
+	enemy_text = FC_CreateText(font);
+	title_text = FC_CreateText(large_font);
+	FC_SetText(title_text, "Beware \nthe Orb");
+	menu_text = FC_CreateText(font);
 }
 
 std::vector<BallPhase> ball_physical_phases = {
@@ -376,38 +608,38 @@ std::vector<BallPhase> ball_physical_phases = {
 			state->v_reflect = true;
 			state->ball_direction = {0.5, 0.4};
 			state->ball_direction.normalize(); } },
-	{360, [&] {} },
+	{360, nullptr },
 	{180, [&] {state->ball_speed *= MUL_UP_1; }},
-	{270, [&] {} },
+	{270, nullptr },
 	{180, [&] {state->ball_speed *= MUL_UP_1; }},
-	{360, [&] {} },
+	{360, nullptr },
 	{360, [&] {state->ball_speed *= MUL_DOWN_1;
 			   state->ball_scale *= MUL_UP_2L; }},
-	{270, [&] {} },
+	{270, nullptr },
 	{180, [&] {state->ball_scale *= MUL_DOWN_2L; }},
-	{180, [&] {} },
+	{180, nullptr },
 	{180, [&] {state->ball_scale *= MUL_DOWN_2L; }},
-	{90, [&] {}},
+	{90, nullptr },
 
 	{360, [&] {state->h_reflect = false; state->v_reflect = false;  }},
 	{180, [&] {state->ball_speed *= MUL_UP_2; }},
-	{180, [&] {} },
+	{180, nullptr },
 	{180, [&] {state->ball_speed *= MUL_DOWN_2;
 			   state->ball_scale *= MUL_UP_2L; }},
-	{180, [&] {} },
+	{180, nullptr },
 	{180, [&] {state->ball_speed *= MUL_UP_2;}},
-	{180, [&] {} },
+	{180, nullptr },
 	{180, [&] {state->ball_speed *= MUL_DOWN_2;
 			   state->ball_scale *= MUL_DOWN_2L; }},
 
 	{ 90, [&] {state->h_reflect = false; state->v_reflect = true;  } },
 	{ 90, [&] {state->ball_speed *= MUL_UP_2; }},
-	{ 180, [&] {} },
+	{ 180, nullptr },
 	{ 90, [&] {state->ball_speed *= MUL_UP_2; }},
-	{ 270, [&] {}},
+	{ 270, nullptr },
 
 	{ 1, [&] {state->h_reflect = true; state->v_reflect = false;  } },
-	{ 359, [&] {}},
+	{ 359, nullptr },
 	{ 180, [&] {state->h_reflect = false; state->v_reflect = true;  } },
 	{ 180, [&] {state->h_reflect = true; state->v_reflect = false;  } },
 	{ 180, [&] {state->h_reflect = true; state->v_reflect = true; }},
@@ -415,15 +647,14 @@ std::vector<BallPhase> ball_physical_phases = {
 
 	{1, [&] {state->ball_moves_physically = false; }},
 	{120, [&] {
-		static Vector2f org_pos = state->ball_pos;
+		if (state->ball_phase_frames == 0) {
+			state->phase_org_pos = state->ball_pos;
+		}
 		Vector2f dest = { 360, 40 };
-		state->next_ball_pos = org_pos + (dest - org_pos) * sin(0.5f*Pi32*(state->ball_phase_frames / 120.f));
+		state->next_ball_pos = state->phase_org_pos + (dest - state->phase_org_pos) * sin(0.5f*Pi32*(state->ball_phase_frames / 120.f));
 	}},
 };
 
-real32 b = -4.f;
-real32 center_x = SCREEN_WIDTH / 2;
-real32 center_y = SCREEN_HEIGHT / 2;
 
 std::vector<BallPhase> ball_geo_phases = {
 	{1, [&] {state->ball_moves_physically = false; state->ball_moves_linearly = false; }},
@@ -434,38 +665,38 @@ std::vector<BallPhase> ball_geo_phases = {
 	}},
 	{712, [&] { // spiral
 	real32 t = (state->ball_phase_frames / 540.f)*22.f*Pi32;
-	state->next_ball_pos.x = SCREEN_WIDTH/2 + (b * t) * cos(t);
-	state->next_ball_pos.y = SCREEN_HEIGHT/2 + (b * t) * sin(t);
+	state->next_ball_pos.x = SCREEN_WIDTH/2 + (state->spiral_b * t) * cos(t);
+	state->next_ball_pos.y = SCREEN_HEIGHT/2 + (state->spiral_b * t) * sin(t);
 	}},
 	{348, [&] { // 1 fold circle. start x = 720 y = 371
 	real32 speed = 15.0f + (state->ball_phase_frames / 540.f) * 25.f;
 	real32 t = ((state->ball_phase_frames / 540.f))*speed*Pi32;
-	center_x = (SCREEN_WIDTH / 2);
-	center_y = (SCREEN_HEIGHT / 2);
-	state->next_ball_pos.x = center_x + (SCREEN_WIDTH / 2) * cos(t);
-	state->next_ball_pos.y = center_y + (SCREEN_HEIGHT / 2) * sin(t);
+	state->center_x = (SCREEN_WIDTH / 2);
+	state->center_y = (SCREEN_HEIGHT / 2);
+	state->next_ball_pos.x = state->center_x + (SCREEN_WIDTH / 2) * cos(t);
+	state->next_ball_pos.y = state->center_y + (SCREEN_HEIGHT / 2) * sin(t);
 	}},
 	{458, [&] { // 2 fold circle. start x = 840 y = 360
 	real32 t = ((state->ball_phase_frames / 540.f))*40.f*Pi32;
-	center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 3) * cos(t / 8);
-	center_y = (SCREEN_HEIGHT / 2) + (SCREEN_WIDTH / 3) * sin(t / 8);
-	state->next_ball_pos.x = center_x + (SCREEN_WIDTH / 3) * cos(t);
-	state->next_ball_pos.y = center_y + (SCREEN_HEIGHT / 3) * sin(t);
+	state->center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 3) * cos(t / 8);
+	state->center_y = (SCREEN_HEIGHT / 2) + (SCREEN_WIDTH / 3) * sin(t / 8);
+	state->next_ball_pos.x = state->center_x + (SCREEN_WIDTH / 3) * cos(t);
+	state->next_ball_pos.y = state->center_y + (SCREEN_HEIGHT / 3) * sin(t);
 	}},
 	{433, [&] { // 3 fold circle. start x = 788 y = 491
 	real32 t = ((state->ball_phase_frames / 540.f))*40.f*Pi32;
-	center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 3) * cos(t / 8);
-	center_y = (SCREEN_HEIGHT / 2) + (SCREEN_WIDTH / 3) * sin(t / 8);
-	state->next_ball_pos.x = center_x + (SCREEN_WIDTH / 6) * cos(t) + (SCREEN_WIDTH / 6) * cos(4 * t);
-	state->next_ball_pos.y = center_y + (SCREEN_HEIGHT / 6) * sin(t) + (SCREEN_HEIGHT / 6) * sin(4 * t);
+	state->center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 3) * cos(t / 8);
+	state->center_y = (SCREEN_HEIGHT / 2) + (SCREEN_WIDTH / 3) * sin(t / 8);
+	state->next_ball_pos.x = state->center_x + (SCREEN_WIDTH / 6) * cos(t) + (SCREEN_WIDTH / 6) * cos(4 * t);
+	state->next_ball_pos.y = state->center_y + (SCREEN_HEIGHT / 6) * sin(t) + (SCREEN_HEIGHT / 6) * sin(4 * t);
 	}},
 	{500, [&] { // 3 fold circle back x: 788 y: 491
 	real32 speed = 30.f - (state->ball_phase_frames / 540.f) * 20.f;
 	real32 t = ((state->ball_phase_frames / 540.f))*speed*Pi32;
-	center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 3) * cos(t / 8);
-	center_y = (SCREEN_HEIGHT / 2) + (SCREEN_WIDTH / 3) * sin(t / 8);
-	state->next_ball_pos.x = center_x + (SCREEN_WIDTH / 6) * cos(t) + (SCREEN_WIDTH / 6) * cos(4 * t);
-	state->next_ball_pos.y = center_y + (SCREEN_HEIGHT / 6) * sin(t) + (SCREEN_HEIGHT / 6) * sin(4 * t);
+	state->center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 3) * cos(t / 8);
+	state->center_y = (SCREEN_HEIGHT / 2) + (SCREEN_WIDTH / 3) * sin(t / 8);
+	state->next_ball_pos.x = state->center_x + (SCREEN_WIDTH / 6) * cos(t) + (SCREEN_WIDTH / 6) * cos(4 * t);
+	state->next_ball_pos.y = state->center_y + (SCREEN_HEIGHT / 6) * sin(t) + (SCREEN_HEIGHT / 6) * sin(4 * t);
 	}},
 		
 	{40, [&] {
@@ -475,58 +706,54 @@ std::vector<BallPhase> ball_geo_phases = {
 	}},
 
 	{1080, [&] { // circle + spiral x: 519 y: 459
-	b = -1.8f;
+	state->spiral_b = -1.8f;
 	real32 t = 4.f + ((state->ball_phase_frames / 540.f))*40.f*Pi32;
-	center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 4) * cos(t / 8);
-	center_y = (SCREEN_HEIGHT / 2) + (SCREEN_HEIGHT / 4) * sin(t / 8);
-	state->next_ball_pos.x = center_x + (b * t) * cos(t);
-	state->next_ball_pos.y = center_y + (b * t) * sin(t);
+	state->center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 4) * cos(t / 8);
+	state->center_y = (SCREEN_HEIGHT / 2) + (SCREEN_HEIGHT / 4) * sin(t / 8);
+	state->next_ball_pos.x = state->center_x + (state->spiral_b * t) * cos(t);
+	state->next_ball_pos.y = state->center_y + (state->spiral_b * t) * sin(t);
 	}},
 	{540, [&] { // circle + spiral back x: -40 y: 302  
-	b = -1.8f;
+	state->spiral_b = -1.8f;
 	real32 t = -(1 - (state->ball_phase_frames / 540.f))*40.f*Pi32;
-	center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 4) * cos(t / 8);
-	center_y = (SCREEN_HEIGHT / 2) + (SCREEN_HEIGHT / 4) * sin(t / 8);
-	state->next_ball_pos.x = center_x + (b * t) * cos(t + Pi32);
-	state->next_ball_pos.y = center_y + (b * t) * sin(t + Pi32);
+	state->center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 4) * cos(t / 8);
+	state->center_y = (SCREEN_HEIGHT / 2) + (SCREEN_HEIGHT / 4) * sin(t / 8);
+	state->next_ball_pos.x = state->center_x + (state->spiral_b * t) * cos(t + Pi32);
+	state->next_ball_pos.y = state->center_y + (state->spiral_b * t) * sin(t + Pi32);
 	}},
 	
 	{1080, [&] { // circle + spiral counter clockwise
-	b = -1.8f;
+	state->spiral_b = -1.8f;
 	real32 t = -((state->ball_phase_frames / 540.f))*40.f*Pi32;
-	center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 4) * cos(t / 8);
-	center_y = (SCREEN_HEIGHT / 2) + (SCREEN_HEIGHT / 4) * sin(t / 8);
-	state->next_ball_pos.x = center_x + (b * t) * cos(t);
-	state->next_ball_pos.y = center_y + (b * t) * sin(t);
+	state->center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 4) * cos(t / 8);
+	state->center_y = (SCREEN_HEIGHT / 2) + (SCREEN_HEIGHT / 4) * sin(t / 8);
+	state->next_ball_pos.x = state->center_x + (state->spiral_b * t) * cos(t);
+	state->next_ball_pos.y = state->center_y + (state->spiral_b * t) * sin(t);
 	}},
 	{540, [&] { // circle + spiral back counter clockwise
-	b = -1.8f;
+	state->spiral_b = -1.8f;
 	real32 t = (1 - (state->ball_phase_frames / 540.f))*40.f*Pi32;
-	center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 4) * cos(t / 8);
-	center_y = (SCREEN_HEIGHT / 2) + (SCREEN_HEIGHT / 4) * sin(t / 8);
-	state->next_ball_pos.x = center_x + (b * t) * cos(t + Pi32);
-	state->next_ball_pos.y = center_y + (b * t) * sin(t + Pi32);
+	state->center_x = (SCREEN_WIDTH / 2) + (SCREEN_WIDTH / 4) * cos(t / 8);
+	state->center_y = (SCREEN_HEIGHT / 2) + (SCREEN_HEIGHT / 4) * sin(t / 8);
+	state->next_ball_pos.x = state->center_x + (state->spiral_b * t) * cos(t + Pi32);
+	state->next_ball_pos.y = state->center_y + (state->spiral_b * t) * sin(t + Pi32);
 	}},
 
 	{120, [&] {
-	static Vector2f org_pos = state->ball_pos;
+	if (state->ball_phase_frames == 0) {
+		state->phase_org_pos = state->ball_pos;
+	}
 	Vector2f dest = { 360, 40 };
-	state->next_ball_pos = org_pos + (dest - org_pos) * sin(0.5f*Pi32*(state->ball_phase_frames / 120.f));
+	state->next_ball_pos = state->phase_org_pos + (dest - state->phase_org_pos) * sin(0.5f*Pi32*(state->ball_phase_frames / 120.f));
 	}},
 };
 
 const real32 delta = 0.017f; //fake time delta TEMPORARY
-real32 r = SCREEN_HEIGHT / 2;
-real32 theta = 0;
+static const real32 r = SCREEN_HEIGHT / 2;
 
-real32 x = SCREEN_WIDTH / 2 + r * cos(theta);
-real32 y = SCREEN_HEIGHT / 2 + r * sin(theta);
-
-real32 pentagram_dests[] = { 54, 198, 342, 126, 270 };
-real32 line_dests[] = { 90, 270 };
-real32 * dests;
-uint8 num_dests = 2;
-uint8 current_dest = 0;
+// Starting angles, copied into the state when a pattern begins
+static const real32 pentagram_dests[] = { 54, 198, 342, 126, 270 };
+static const real32 line_dests[] = { 90, 270 };
 
 std::vector<BallPhase> ball_final_phases = {
 	{1, [&] {
@@ -538,8 +765,8 @@ std::vector<BallPhase> ball_final_phases = {
 			Vector2f dest = {SCREEN_WIDTH, SCREEN_HEIGHT};
 			state->ball_direction = (dest - state->ball_pos);
 			state->ball_direction.normalize();
-			dests = line_dests;
-			num_dests = 2;
+			memcpy(state->dests, line_dests, sizeof(line_dests));
+			state->num_dests = LEN(line_dests);
 } },
 	// line
 	{1440, [&] {
@@ -548,18 +775,18 @@ std::vector<BallPhase> ball_final_phases = {
 			}
 			else if(state->ball_phase_frames < 675) {
 				real32 angle = sin(((state->ball_phase_frames - 270) / 405.0)*Pi32);
-				dests[0] += angle;
-				dests[1] += angle;
+				state->dests[0] += angle;
+				state->dests[1] += angle;
 			}
 			else {
 				real32 angle = 2*sin(((state->ball_phase_frames - 675) / 405.0)*Pi32);
-				dests[0] -= angle;
-				dests[1] -= angle;
+				state->dests[0] -= angle;
+				state->dests[1] -= angle;
 				if (state->ball_phase_frames > 1080) {
 					state->ball_speed *= MUL_DOWN_1;
 				}
 			}
-			Vector2f car_dest = polarToCar(r, dests[current_dest]);
+			Vector2f car_dest = polarToCar(r, state->dests[state->current_dest]);
 			Vector2f dir = (car_dest - state->next_ball_pos);
 			real32 mag = dir.getMagnitude();
 			dir.normalize();
@@ -567,7 +794,7 @@ std::vector<BallPhase> ball_final_phases = {
 			if (mag <= step) {
 				// Going past the destination
 				state->next_ball_pos = car_dest;
-				current_dest = (current_dest + 1) % num_dests;
+				state->current_dest = (state->current_dest + 1) % state->num_dests;
 				bounceEffect();
 
 				//playBounceSound(state->ball_scale);
@@ -581,8 +808,8 @@ std::vector<BallPhase> ball_final_phases = {
 
 
 	{1, [&] {
-			dests = pentagram_dests;
-			num_dests = 5;
+			memcpy(state->dests, pentagram_dests, sizeof(pentagram_dests));
+			state->num_dests = LEN(pentagram_dests);
 			state->dests_visible = true;
 			state->dests_color = {};
 } },
@@ -595,7 +822,7 @@ std::vector<BallPhase> ball_final_phases = {
 				state->dests_color.r = (uint8)(255.f * (state->ball_phase_frames / 540.f));
 				state->dests_color.a = MAX(0, state->dests_color.r - 128.f);
 			}
-			Vector2f car_dest = polarToCar(r, dests[current_dest]);
+			Vector2f car_dest = polarToCar(r, state->dests[state->current_dest]);
 			Vector2f dir = (car_dest - state->next_ball_pos);
 			real32 mag = dir.getMagnitude();
 			dir.normalize();
@@ -603,7 +830,7 @@ std::vector<BallPhase> ball_final_phases = {
 			if (mag <= step) {
 				// Going past the destination
 				state->next_ball_pos = car_dest;
-				current_dest = (current_dest + 1) % num_dests;
+				state->current_dest = (state->current_dest + 1) % state->num_dests;
 				bounceEffect();
 
 				//playBounceSound(state->ball_scale);
@@ -616,27 +843,27 @@ std::vector<BallPhase> ball_final_phases = {
 	{1440, [&] {
 			if (state->ball_phase_frames < 360) {
 				real32 angle = sin((state->ball_phase_frames / 360.0)*Pi32);
-				dests[0] += angle;
-				dests[1] += angle;
-				dests[2] += angle;
-				dests[3] += angle;
-				dests[4] += angle;
+				state->dests[0] += angle;
+				state->dests[1] += angle;
+				state->dests[2] += angle;
+				state->dests[3] += angle;
+				state->dests[4] += angle;
 			}
 		else if (state->ball_phase_frames < 540) {
 		}
 		else if (state->ball_phase_frames < 1260) {
 		   real32 angle = 2*sin(((state->ball_phase_frames - 540) / 720.0)*Pi32);
-		   dests[0] -= angle;
-		   dests[1] -= angle;
-		   dests[2] -= angle;
-		   dests[3] -= angle;
-		   dests[4] -= angle;
+		   state->dests[0] -= angle;
+		   state->dests[1] -= angle;
+		   state->dests[2] -= angle;
+		   state->dests[3] -= angle;
+		   state->dests[4] -= angle;
 		}
 		else if (state->ball_phase_frames < 1440) {
 		   state->ball_speed *= MUL_DOWN_2;
 		}
 
-		Vector2f car_dest = polarToCar(r, dests[current_dest]);
+		Vector2f car_dest = polarToCar(r, state->dests[state->current_dest]);
 		Vector2f dir = (car_dest - state->next_ball_pos);
 		real32 mag = dir.getMagnitude();
 		dir.normalize();
@@ -644,7 +871,7 @@ std::vector<BallPhase> ball_final_phases = {
 		if (mag <= step) {
 			// Going past the destination
 			state->next_ball_pos = car_dest;
-			current_dest = (current_dest + 1) % num_dests;
+			state->current_dest = (state->current_dest + 1) % state->num_dests;
 			bounceEffect();
 
 			//playBounceSound(state->ball_scale);
@@ -659,11 +886,11 @@ std::vector<BallPhase> ball_final_phases = {
 		if (state->ball_phase_frames < 360) {
 			state->ball_scale *= MUL_UP_1L;
 			real32 angle = sin((state->ball_phase_frames / 360.0)*Pi32);
-			dests[0] += angle;
-			dests[1] += angle;
-			dests[2] += angle;
-			dests[3] += angle;
-			dests[4] += angle;
+			state->dests[0] += angle;
+			state->dests[1] += angle;
+			state->dests[2] += angle;
+			state->dests[3] += angle;
+			state->dests[4] += angle;
 
 			state->dests_color.a = MAX(0, 128 - 128*(state->ball_phase_frames/360.0f));
 		}
@@ -679,17 +906,17 @@ std::vector<BallPhase> ball_final_phases = {
 				state->ball_speed *= MUL_UP_1;
 			}
 		   real32 angle = sin(((state->ball_phase_frames - 540) / 720.0)*Pi32);
-		   dests[0] -= angle;
-		   dests[1] -= angle;
-		   dests[2] -= angle;
-		   dests[3] -= angle;
-		   dests[4] -= angle;
+		   state->dests[0] -= angle;
+		   state->dests[1] -= angle;
+		   state->dests[2] -= angle;
+		   state->dests[3] -= angle;
+		   state->dests[4] -= angle;
 		}
 		else if (state->ball_phase_frames < 1440) {
 		   state->ball_speed *= MUL_DOWN_2;
 		}
 
-		Vector2f car_dest = polarToCar(r, dests[current_dest]);
+		Vector2f car_dest = polarToCar(r, state->dests[state->current_dest]);
 		Vector2f dir = (car_dest - state->next_ball_pos);
 		real32 mag = dir.getMagnitude();
 		dir.normalize();
@@ -697,7 +924,7 @@ std::vector<BallPhase> ball_final_phases = {
 		if (mag <= step) {
 			// Going past the destination
 			state->next_ball_pos = car_dest;
-			current_dest = (current_dest + 1) % num_dests;
+			state->current_dest = (state->current_dest + 1) % state->num_dests;
 			bounceEffect();
 
 			//playBounceSound(state->ball_scale);
@@ -712,113 +939,350 @@ std::vector<BallPhase> ball_final_phases = {
 
 std::vector<BallPhase> * ball_stages[] = { &ball_geo_phases, &ball_physical_phases, &ball_final_phases };
 
-inline static bool collisionCheck(Vector2f a, Vector2f b, real32 limit) {
-	return (a - b).getMagnitude() < limit;
+// Polyline the ball center follows during one tick, one segment per wall bounce. Past MAX_BALL_PATH_POINTS - 2
+// bounces the last segment is a chord straight to where the ball ends up, and bounces keeps counting them all.
+#define MAX_BALL_PATH_POINTS 32
+struct BallPath {
+	Vector2f points[MAX_BALL_PATH_POINTS];
+	uint32 num_points;
+	uint32 bounces;
+};
+
+// Distance the ball center can travel along one axis before reaching lo or hi
+static real32 distanceToBound(real32 pos, real32 direction, real32 lo, real32 hi) {
+	if (direction == 0) {
+		return FLT_MAX;
+	}
+	return MAX(((direction > 0 ? hi : lo) - pos) / direction, 0.f);
 }
 
-void deadUpdate(ControllerInput * controller, real32 time_delta) {
-	if (state->dead_frames % 20 == 0) {
-		state->player_visible = !state->player_visible;
+enum BallEventType {
+	BallEventNone, BallEventBounceX, BallEventBounceY, BallEventWrapX, BallEventWrapY
+};
+
+struct BallEvent {
+	BallEventType type;
+	real32 time; // seconds from now
+	Vector2f pos; // ball center when it happens
+};
+
+// Exact time and position of the next wall bounce, or of leaving the screen on a non reflecting axis,
+// for a ball moving in a straight line
+BallEvent predictNextBallEvent(Vector2f pos, Vector2f direction, real32 speed, real32 radius, bool h_reflect, bool v_reflect) {
+	BallEvent event = { BallEventNone, FLT_MAX, pos };
+	if (speed <= 0) {
+		return event;
 	}
-	if (state->dead_frames >= 90) {
-		state->player_visible = true;
-		changeCurrentState(Playing);
+	real32 distance_x = h_reflect ? distanceToBound(pos.x, direction.x, radius, SCREEN_WIDTH - radius) : distanceToBound(pos.x, direction.x, -radius, SCREEN_WIDTH + radius);
+	real32 distance_y = v_reflect ? distanceToBound(pos.y, direction.y, radius, SCREEN_HEIGHT - radius) : distanceToBound(pos.y, direction.y, -radius, SCREEN_HEIGHT + radius);
+	real32 distance = MIN(distance_x, distance_y);
+	if (distance == FLT_MAX) {
+		return event;
 	}
-	state->dead_frames++;
+	if (distance_x <= distance_y) {
+		event.type = h_reflect ? BallEventBounceX : BallEventWrapX;
+	}
+	else {
+		event.type = v_reflect ? BallEventBounceY : BallEventWrapY;
+	}
+	event.time = distance / speed;
+	event.pos = pos + direction * distance;
+	return event;
 }
 
-void playingUpdate(ControllerInput * controller, real32 time_delta) {
-	bool pausePress = controller->button_select || controller->button_start;
-	if (!last_pause_press && pausePress) {
-		changeCurrentState(Paused);
-		last_pause_press = pausePress;
-		return;
+// Applies an event predicted by predictNextBallEvent, the same way a tick would
+static void applyBallEvent(const BallEvent * event, Vector2f * pos, Vector2f * direction, real32 radius) {
+	*pos = event->pos;
+	switch (event->type) {
+	case BallEventBounceX:
+		direction->x = -direction->x;
+		break;
+	case BallEventBounceY:
+		direction->y = -direction->y;
+		break;
+	case BallEventWrapX:
+		pos->x = direction->x > 0 ? radius + 1 : SCREEN_WIDTH - radius - 1;
+		break;
+	case BallEventWrapY:
+		pos->y = direction->y > 0 ? radius + 1 : SCREEN_HEIGHT - radius - 1;
+		break;
+	default:
+		break;
 	}
-	last_pause_press = pausePress;
+}
 
-	bool player_invul = false;
-	if (state->dead_frames < 60) {
-		player_invul = true;
-		if (state->dead_frames % 20 == 0) {
-			state->player_visible = !state->player_visible;
+// Jumps a linearly moving ball seconds ahead, one event at a time instead of one tick at a time.
+// Returns the number of events passed.
+uint32 advanceBall(Vector2f * pos, Vector2f * direction, real32 speed, real32 radius, bool h_reflect, bool v_reflect, real32 seconds) {
+	uint32 events = 0;
+	while (seconds > 0) {
+		BallEvent event = predictNextBallEvent(*pos, *direction, speed, radius, h_reflect, v_reflect);
+		if (event.time > seconds) {
+			*pos += *direction * (speed * seconds);
+			break;
 		}
-		state->dead_frames++;
+		applyBallEvent(&event, pos, direction, radius);
+		seconds -= event.time;
+		events++;
 	}
-	else {
-		state->player_visible = true;
+	return events;
+}
+
+// Moves pos along direction for distance pixels between the walls at lo and hi as if bouncing off them,
+// in constant time however many bounces that takes. Returns the number of bounces.
+static uint32 foldBetweenWalls(real32 * pos, real32 * direction, real32 distance, real32 lo, real32 hi) {
+	const real32 span = hi - lo;
+	if (*direction == 0 || span <= 0) {
+		return 0;
+	}
+	// Distance along the axis from the wall the ball moves away from, as if the walls weren't there
+	const bool forward = *direction > 0;
+	const real32 unfolded = (forward ? *pos - lo : hi - *pos) + fabsf(*direction) * distance;
+	const real32 crossings = floorf(unfolded / span);
+	const real32 rest = unfolded - crossings * span;
+	const bool flipped = fmodf(crossings, 2.f) != 0;
+	*pos = forward != flipped ? lo + rest : hi - rest;
+	if (flipped) {
+		*direction = -*direction;
+	}
+	return (uint32)crossings;
+}
+
+// Moves a ball of the given radius along direction for distance pixels, reflecting exactly at the
+// reflecting walls. Cost grows with the number of bounces in the tick, capped by the path size: whatever
+// distance is left once the path is full gets folded between the walls in one step.
+static void traceBallPath(Vector2f pos, Vector2f * direction, real32 distance, real32 radius, bool h_reflect, bool v_reflect, BallPath * path) {
+	path->points[0] = pos;
+	path->num_points = 1;
+	path->bounces = 0;
+	while (distance > 0 && path->num_points < MAX_BALL_PATH_POINTS) {
+		real32 distance_x = h_reflect ? distanceToBound(pos.x, direction->x, radius, SCREEN_WIDTH - radius) : FLT_MAX;
+		real32 distance_y = v_reflect ? distanceToBound(pos.y, direction->y, radius, SCREEN_HEIGHT - radius) : FLT_MAX;
+		real32 travel = MIN(distance, MIN(distance_x, distance_y));
+
+		pos += *direction * travel;
+		distance -= travel;
+		if (travel == distance_x) {
+			pos.x = direction->x > 0 ? SCREEN_WIDTH - radius : radius;
+			direction->x = -direction->x;
+			path->bounces++;
+		}
+		else if (travel == distance_y) {
+			pos.y = direction->y > 0 ? SCREEN_HEIGHT - radius : radius;
+			direction->y = -direction->y;
+			path->bounces++;
+		}
+		path->points[path->num_points++] = pos;
+	}
+	if (distance > 0) {
+		if (h_reflect) {
+			path->bounces += foldBetweenWalls(&pos.x, &direction->x, distance, radius, SCREEN_WIDTH - radius);
+		}
+		else {
+			pos.x += direction->x * distance;
+		}
+		if (v_reflect) {
+			path->bounces += foldBetweenWalls(&pos.y, &direction->y, distance, radius, SCREEN_HEIGHT - radius);
+		}
+		else {
+			pos.y += direction->y * distance;
+		}
+		path->points[path->num_points - 1] = pos;
 	}
+}
 
-	const real32 acc_const = 12000.f;
-	Vector2f move_dir = { controller->dir_right - controller->dir_left, controller->dir_down - controller->dir_up };
-	move_dir.normalize();
-	Vector2f acceleration = move_dir * acc_const;
+// Player positions split into x and y arrays. Unused lanes sit far off screen, so every test runs over all
+// MAX_PLAYERS lanes and costs the same for one crab as for four.
+struct PlayerLanes {
+	real32 x[MAX_PLAYERS];
+	real32 y[MAX_PLAYERS];
+};
+
+static const real32 unused_lane_position = -1.0e6f;
+
+// Earliest point along the segment from a to b where a circle center comes within limit of a player, solved
+// for every lane at once without branches or early exits so the compiler can vectorize it.
+// Returns the lane hit first, or -1.
+static int32 sweptCollisionCheckLanes(Vector2f a, Vector2f b, const PlayerLanes * lanes, real32 limit, real32 * hit_t) {
+	const Vector2f d = b - a;
+	const real32 dd = dot(d, d);
+	const real32 safe_dd = dd > 0 ? dd : 1;
+	real32 ts[MAX_PLAYERS];
+	for (uint32 i = 0; i < MAX_PLAYERS; i++) {
+		const real32 mx = a.x - lanes->x[i];
+		const real32 my = a.y - lanes->y[i];
+		const real32 c = mx * mx + my * my - limit * limit;
+		const real32 md = mx * d.x + my * d.y;
+		const real32 discriminant = md * md - dd * c;
+		const real32 t = (-md - sqrtf(discriminant > 0 ? discriminant : 0)) / safe_dd;
+		const bool swept_hit = dd > 0 && md < 0 && discriminant >= 0 && t <= 1;
+		ts[i] = c < 0 ? 0 : (swept_hit ? t : FLT_MAX);
+	}
+	int32 hit_lane = -1;
+	real32 earliest_t = FLT_MAX;
+	for (uint32 i = 0; i < MAX_PLAYERS; i++) {
+		if (ts[i] < earliest_t) {
+			earliest_t = ts[i];
+			hit_lane = i;
+		}
+	}
+	*hit_t = earliest_t;
+	return hit_lane;
+}
 
-	state->player_speed += acceleration * time_delta;
+// Player motion is dv/dt = a - k*v, solved exactly over the step so any step rate gives the same trajectory.
+// k matches the old 0.75 friction applied every 1/60 s, a keeps the old 600 px/s top speed.
+static const real32 player_damping = 17.2609f; // -ln(0.75) * 60
+static const real32 player_max_speed = 600.f;
+static const real32 player_acceleration = player_max_speed * player_damping;
+
+static void integratePlayer(Vector2f * pos, Vector2f * speed, Vector2f acceleration, real32 time_delta) {
+	const Vector2f terminal_speed = acceleration / player_damping;
+	const real32 decay = expf(-player_damping * time_delta);
+	const Vector2f speed_diff = *speed - terminal_speed;
+	*pos += terminal_speed * time_delta + speed_diff * ((1.f - decay) / player_damping);
+	*speed = terminal_speed + speed_diff * decay;
+}
 
-	const real32 friction = 0.75f;
-	state->player_speed *= friction;
-	if (state->player_speed.getMagnitude() < 0.2f) {
-		state->player_speed.x = 0;
-		state->player_speed.y = 0;
+void deadUpdate(ControllerInput * controller, real32 time_delta) {
+	if (state->dead_frames % 20 == 0) {
+		state->player_visible = !state->player_visible;
+	}
+	if (state->dead_frames >= 90) {
+		state->player_visible = true;
+		changeCurrentState(Playing);
 	}
+	state->dead_frames++;
+}
 
-	state->player_pos += state->player_speed * time_delta;
+static void movePlayer(Player * player, const ControllerInput * controller, real32 time_delta) {
+	// Integrate piecewise between the direction changes inside this tick's input window,
+	// so a tap moves the crab for as long as it was held instead of a whole tick
+	Vector2f move_dir = controller->move_before_edges;
+	const real64 window_ms = controller->tick_end_ms - controller->tick_start_ms;
+	real32 tick_fraction = 0;
+	for (uint32 i = 0; i < controller->num_move_edges; i++) {
+		const InputEdge * edge = &controller->move_edges[i];
+		if (edge->timestamp > controller->tick_end_ms) {
+			break;
+		}
+		real32 edge_fraction = 0;
+		if (window_ms > 0) {
+			edge_fraction = (real32)MAX(0.0, MIN(1.0, (edge->timestamp - controller->tick_start_ms) / window_ms));
+		}
+		if (edge_fraction > tick_fraction) {
+			integratePlayer(&player->pos, &player->speed, move_dir.getNormalized() * player_acceleration, (edge_fraction - tick_fraction) * time_delta);
+			tick_fraction = edge_fraction;
+		}
+		move_dir = edge->move;
+	}
+	integratePlayer(&player->pos, &player->speed, move_dir.getNormalized() * player_acceleration, (1.f - tick_fraction) * time_delta);
 
 	if (state->ball_stage == 2) {
 		Vector2f center = {SCREEN_WIDTH/2, SCREEN_HEIGHT/2};
-		real32 dist = (state->player_pos - center).getMagnitude();
+		real32 dist = (player->pos - center).getMagnitude();
 		real32 limit = SCREEN_WIDTH / 2 - player_radius;
 		if (dist >= limit) {
-			Vector2f step = center - state->player_pos;
+			Vector2f step = center - player->pos;
 			step.normalize();
 			step *= (dist - limit + 1);
-			state->player_pos += step;
+			player->pos += step;
 		}
 	}
 
 	if (state->h_reflect) {
-		if (state->player_pos.x + player_radius >= SCREEN_WIDTH) {
-			state->player_pos.x = SCREEN_WIDTH - player_radius - 1;
+		if (player->pos.x + player_radius >= SCREEN_WIDTH) {
+			player->pos.x = SCREEN_WIDTH - player_radius - 1;
 		}
-		else if (state->player_pos.x - player_radius <= 0.f) {
-			state->player_pos.x = player_radius + 1;
+		else if (player->pos.x - player_radius <= 0.f) {
+			player->pos.x = player_radius + 1;
 		}
 	}
 	else {
-		if (state->player_pos.x - player_radius >= SCREEN_WIDTH) {
-			state->player_pos.x = player_radius + 1;
+		if (player->pos.x - player_radius >= SCREEN_WIDTH) {
+			player->pos.x = player_radius + 1;
 		}
-		else if (state->player_pos.x + player_radius <= 0.f) {
-			state->player_pos.x = SCREEN_WIDTH - player_radius - 1;
+		else if (player->pos.x + player_radius <= 0.f) {
+			player->pos.x = SCREEN_WIDTH - player_radius - 1;
 		}
 	}
 	if (state->v_reflect) {
-		if (state->player_pos.y + player_radius >= SCREEN_HEIGHT) {
-			state->player_pos.y = SCREEN_HEIGHT - player_radius - 1;
+		if (player->pos.y + player_radius >= SCREEN_HEIGHT) {
+			player->pos.y = SCREEN_HEIGHT - player_radius - 1;
 		}
-		else if (state->player_pos.y - player_radius <= 0.f) {
-			state->player_pos.y = player_radius + 1;
+		else if (player->pos.y - player_radius <= 0.f) {
+			player->pos.y = player_radius + 1;
 		}
 	}
 	else {
-		if (state->player_pos.y - player_radius >= SCREEN_HEIGHT) {
-			state->player_pos.y = player_radius + 1;
+		if (player->pos.y - player_radius >= SCREEN_HEIGHT) {
+			player->pos.y = player_radius + 1;
+		}
+		else if (player->pos.y + player_radius <= 0.f) {
+			player->pos.y = SCREEN_HEIGHT - player_radius - 1;
+		}
+	}
+}
+
+// controllers has one entry per player
+void playingUpdate(ControllerInput * controllers, real32 time_delta) {
+	bool pausePress = false;
+	for (uint32 i = 0; i < state->num_players; i++) {
+		pausePress = pausePress || controllers[i].button_select || controllers[i].button_start;
+	}
+	if (!state->last_pause_press && pausePress) {
+		changeCurrentState(Paused);
+		state->last_pause_press = pausePress;
+		return;
+	}
+	state->last_pause_press = pausePress;
+
+	bool player_invul = false;
+	if (state->dead_frames < 60) {
+		player_invul = true;
+		if (state->dead_frames % 20 == 0) {
+			state->player_visible = !state->player_visible;
 		}
-		else if (state->player_pos.y + player_radius <= 0.f) {
-			state->player_pos.y = SCREEN_HEIGHT - player_radius - 1;
+		state->dead_frames++;
+	}
+	else {
+		state->player_visible = true;
+	}
+
+	bool moving = false;
+	for (uint32 i = 0; i < state->num_players; i++) {
+		if (!state->players[i].active) {
+			continue;
 		}
+		movePlayer(&state->players[i], &controllers[i], time_delta);
+		moving = moving || controllers[i].dir_right - controllers[i].dir_left != 0 || controllers[i].dir_down - controllers[i].dir_up != 0;
 	}
 
-	if (controller->dir_right - controller->dir_left != 0 || controller->dir_down - controller->dir_up != 0) {
-		if (!Mix_Playing(1)) {
-			Mix_PlayChannel(1, step, 0);
+	if (moving) {
+		if (!silentSimulation() && !Mix_Playing(1)) {
+			playChannel(1, step);
 		}
 
 		if (state->playing_frames % 10 == 0) {
-			player_sprite_x = player_sprite_x == 0 ? player_width : 0;
+			state->player_sprite_x = state->player_sprite_x == 0 ? player_width : 0;
 		}
 	}
 
+#ifdef DEBUG
+	// Fast forward through the rest of an idle phase, jumping from bounce to bounce
+	if (controllers[0].button_r && !last_skip_press && state->ball_moves_physically && state->ball_stage < 3 && state->ball_phase < ball_stages[state->ball_stage]->size()) {
+		const BallPhase * phase = &(*ball_stages[state->ball_stage])[state->ball_phase];
+		if (phase->isIdle()) {
+			uint32 skipped_frames = phase->total_frames - state->ball_phase_frames;
+			advanceBall(&state->ball_pos, &state->ball_direction, state->ball_speed, state->ball_scale * ball_radius, state->h_reflect, state->v_reflect, skipped_frames * time_delta);
+			state->next_ball_pos = state->ball_pos;
+			state->ball_phase_frames = phase->total_frames;
+			state->playing_frames += skipped_frames;
+		}
+	}
+	last_skip_press = controllers[0].button_r;
+#endif
+
 	// Ball movement
 	state->prev_ball_pos = state->ball_pos;
 	if (state->ball_stage < 3) {
@@ -828,10 +1292,10 @@ void playingUpdate(ControllerInput * controller, real32 time_delta) {
 		else {
 			state->ball_stage++;
 			if (state->ball_stage == 1) {
-				Mix_PlayMusic(level2_music, -1);
+				playMusic(level2_music);
 			}
 			if (state->ball_stage == 2) {
-				Mix_PlayMusic(level3_music, -1);
+				playMusic(level3_music);
 			}
 			state->ball_phase = 0;
 			state->ball_phase_frames = 0;
@@ -839,88 +1303,88 @@ void playingUpdate(ControllerInput * controller, real32 time_delta) {
 	}
 	else {
 		changeCurrentState(Ending);
-		Mix_PlayMusic(ending_music, -1);
+		playMusic(ending_music);
 	}
 
+#ifdef DEBUG
+	uint64 ball_start_counter = SDL_GetPerformanceCounter();
+#endif
+	BallPath ball_path;
+	ball_path.points[0] = state->ball_pos;
+	ball_path.points[1] = state->next_ball_pos;
+	ball_path.num_points = 2;
+	ball_path.bounces = 0;
 	if (state->ball_moves_physically) {
-		state->next_ball_pos = state->ball_pos + state->ball_direction * state->ball_speed * time_delta;
-
-		if (state->h_reflect) {
-			if (state->next_ball_pos.x + state->ball_scale * ball_radius >= SCREEN_WIDTH) {
-				state->next_ball_pos.x = SCREEN_WIDTH - state->ball_scale * ball_radius - 1;
-				state->ball_direction.x = -state->ball_direction.x;
-				bounceEffect();
-			}
-			else if (state->next_ball_pos.x - state->ball_scale * ball_radius <= 0.f) {
-				state->next_ball_pos.x = state->ball_scale * ball_radius + 1;
-				state->ball_direction.x = -state->ball_direction.x;
-				bounceEffect();
-			}
+		const real32 effective_ball_radius = state->ball_scale * ball_radius;
+		traceBallPath(state->ball_pos, &state->ball_direction, state->ball_speed * time_delta, effective_ball_radius, state->h_reflect, state->v_reflect, &ball_path);
+		state->next_ball_pos = ball_path.points[ball_path.num_points - 1];
+		for (uint32 i = 0; i < ball_path.bounces; i++) {
+			bounceEffect();
 		}
-		else {
-			if (state->next_ball_pos.x - state->ball_scale * ball_radius >= SCREEN_WIDTH) {
-				state->next_ball_pos.x = state->ball_scale * ball_radius + 1;
-				state->prev_ball_pos = state->ball_pos = state->next_ball_pos;
+
+		bool wrapped = false;
+		if (!state->h_reflect) {
+			if (state->next_ball_pos.x - effective_ball_radius >= SCREEN_WIDTH) {
+				state->next_ball_pos.x = effective_ball_radius + 1;
+				wrapped = true;
 			}
-			else if (state->next_ball_pos.x + state->ball_scale * ball_radius <= 0.f) {
-				state->next_ball_pos.x = SCREEN_WIDTH - state->ball_scale * ball_radius - 1;
-				state->prev_ball_pos = state->ball_pos = state->next_ball_pos;
+			else if (state->next_ball_pos.x + effective_ball_radius <= 0.f) {
+				state->next_ball_pos.x = SCREEN_WIDTH - effective_ball_radius - 1;
+				wrapped = true;
 			}
 		}
-		if (state->v_reflect) {
-			if (state->next_ball_pos.y + state->ball_scale * ball_radius >= SCREEN_HEIGHT) {
-				state->next_ball_pos.y = SCREEN_HEIGHT - state->ball_scale * ball_radius - 1;
-				state->ball_direction.y = -state->ball_direction.y;
-				bounceEffect();
+		if (!state->v_reflect) {
+			if (state->next_ball_pos.y - effective_ball_radius >= SCREEN_HEIGHT) {
+				state->next_ball_pos.y = effective_ball_radius + 1;
+				wrapped = true;
 			}
-			else if (state->next_ball_pos.y - state->ball_scale * ball_radius <= 0.f) {
-				state->next_ball_pos.y = state->ball_scale * ball_radius + 1;
-				state->ball_direction.y = -state->ball_direction.y;
-				bounceEffect();
+			else if (state->next_ball_pos.y + effective_ball_radius <= 0.f) {
+				state->next_ball_pos.y = SCREEN_HEIGHT - effective_ball_radius - 1;
+				wrapped = true;
 			}
 		}
-		else {
-			if (state->next_ball_pos.y - state->ball_scale * ball_radius >= SCREEN_HEIGHT) {
-				state->next_ball_pos.y = state->ball_scale * ball_radius + 1;
-				state->prev_ball_pos = state->ball_pos = state->next_ball_pos;
-			}
-			else if (state->next_ball_pos.y + state->ball_scale * ball_radius <= 0.f) {
-				state->next_ball_pos.y = SCREEN_HEIGHT - state->ball_scale * ball_radius - 1;
-				state->prev_ball_pos = state->ball_pos = state->next_ball_pos;
-			}
+		if (wrapped) {
+			state->prev_ball_pos = state->ball_pos = state->next_ball_pos;
+			ball_path.points[0] = ball_path.points[1] = state->next_ball_pos;
+			ball_path.num_points = 2;
 		}
 	}
 
-	if (!player_invul) {
-		bool collided = false;
-		Vector2f ball_dif = state->next_ball_pos - state->ball_pos;
+	if (!player_invul && !headless_simulation) {
+		PlayerLanes lanes;
+		for (uint32 i = 0; i < MAX_PLAYERS; i++) {
+			bool in_play = i < state->num_players && state->players[i].active;
+			lanes.x[i] = in_play ? state->players[i].pos.x : unused_lane_position;
+			lanes.y[i] = in_play ? state->players[i].pos.y : unused_lane_position;
+		}
+		int32 hit_player = -1;
 		real32 touch_limit = player_radius + ball_radius * state->ball_scale;
-		if (ball_dif.getMagnitude() > ball_radius * state->ball_scale * 2) {
-			if (collisionCheck(state->ball_pos + ball_dif * 0.25f, state->player_pos, touch_limit)) {
-				collided = true;
-				state->ball_pos = state->ball_pos + ball_dif * 0.25f;
-			}
-			else if (collisionCheck(state->ball_pos + ball_dif * 0.5f, state->player_pos, touch_limit)) {
-				collided = true;
-				state->ball_pos = state->ball_pos + ball_dif * 0.5f;
-			}
-			else if (collisionCheck(state->ball_pos + ball_dif * 0.75f, state->player_pos, touch_limit)) {
-				collided = true;
-				state->ball_pos = state->ball_pos + ball_dif * 0.75f;
+		for (uint32 i = 0; i + 1 < ball_path.num_points && hit_player < 0; i++) {
+			real32 hit_t;
+			hit_player = sweptCollisionCheckLanes(ball_path.points[i], ball_path.points[i + 1], &lanes, touch_limit, &hit_t);
+			if (hit_player >= 0) {
+				state->ball_pos = ball_path.points[i] + (ball_path.points[i + 1] - ball_path.points[i]) * hit_t;
 			}
 		}
-		if (!collided) {
-			if (collisionCheck(state->next_ball_pos, state->player_pos, touch_limit)) {
-				collided = true;
-			}
+		if (hit_player < 0) {
 			state->ball_pos = state->next_ball_pos;
 		}
-
-		if (collided) {
+		else {
 			LogDebug("Collision!!!");
-			Mix_PlayChannel(2, lose, 0);
-			if (state->player_lives > 0) {
-				state->player_lives--;
+			playChannel(2, lose);
+			Player * player = &state->players[hit_player];
+			state->hit_player = hit_player;
+			if (player->lives > 0) {
+				player->lives--;
+			}
+			else {
+				player->active = false;
+			}
+			bool any_active = false;
+			for (uint32 i = 0; i < state->num_players; i++) {
+				any_active = any_active || state->players[i].active;
+			}
+			if (any_active) {
 				state->shaking_for_dead = true;
 				changeCurrentState(Shaking);
 			}
@@ -932,6 +1396,12 @@ void playingUpdate(ControllerInput * controller, real32 time_delta) {
 	else {
 		state->ball_pos = state->next_ball_pos;
 	}
+#ifdef DEBUG
+	profile.ball_counter += SDL_GetPerformanceCounter() - ball_start_counter;
+	profile.ball_steps++;
+	profile.ball_segments += ball_path.num_points - 1;
+	profile.ball_segments_max = MAX(profile.ball_segments_max, ball_path.num_points - 1);
+#endif
 
 	state->playing_frames++;
 }
@@ -943,20 +1413,184 @@ const int8 death_shake_xs[] = { -6, 3, 5, 2, -3, 2, -2, 0 };
 const int8 death_shake_ys[] = { 3, -6, 2, 4, -2, 3, 1, -1 };
 const char * enemy_messages[] = { "", "Crabland belongs \nto ME!", "You can't win against \nmy new weapon!", "Bwa ha ha ha" };
 
-void updateAndDraw(SDL_Surface * screen_surface, SDL_Renderer * renderer, SDL_Window * window, ControllerInput * controller, real32 time_delta) {
+static void scrollLayer(ScrollLayer * layer) {
+	if (layer->tile_height <= 0) {
+		return;
+	}
+	layer->offset = fmodf(layer->offset - layer->speed, (real32)layer->tile_height);
+	if (layer->offset < 0) {
+		layer->offset += layer->tile_height;
+	}
+}
+
+// Points rendering at the frame being drawn, the offscreen texture or the window
+static void setFrameTarget(SDL_Renderer * renderer) {
+	SDL_SetRenderTarget(renderer, frame_texture);
+	if (frame_texture != NULL) {
+		// Switching targets resets the scale
+		SDL_RenderSetScale(renderer, (real32)render_settings.offscreen_width / SCREEN_WIDTH, (real32)render_settings.offscreen_height / SCREEN_HEIGHT);
+	}
+}
+
+static void beginFrame(SDL_Renderer * renderer) {
+	if (frame_texture != NULL) {
+		setFrameTarget(renderer);
+	}
 	SDL_RenderClear(renderer);
-	uint8 enemy_message = 0;
-	static uint64 non_paused_frame_count = 0;
-	bool pausePress = false;
-	int32 game_over_y = 0;
-	switch (state->current_state)
-	{
-	case MainMenu:
-		if (controller->button_start) {
-			last_pause_press = true;
+}
+
+static void presentFrame(SDL_Renderer * renderer) {
+	if (frame_texture != NULL) {
+		// Single scaled blit of the finished frame to the window
+		SDL_SetRenderTarget(renderer, NULL);
+		SDL_RenderClear(renderer);
+		SDL_RenderCopy(renderer, frame_texture, NULL, NULL);
+	}
+	SDL_RenderPresent(renderer);
+}
+
+// Offset applied to every draw call, so shaking doesn't need an extra full screen render pass
+static SDL_Point camera_offset = { 0, 0 };
+
+static void drawTexture(SDL_Renderer * renderer, SDL_Texture * texture, const SDL_Rect * src_rect, const SDL_Rect * dst_rect) {
+	SDL_Rect rect = { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT };
+	if (dst_rect != NULL) {
+		rect = *dst_rect;
+	}
+	rect.x += camera_offset.x;
+	rect.y += camera_offset.y;
+	SDL_RenderCopy(renderer, texture, src_rect, &rect);
+}
+
+// Covers the screen with as many slices of the tile as needed, starting from the layer offset
+static void drawScrollLayer(SDL_Renderer * renderer, const ScrollLayer * layer, real32 alpha) {
+	if (layer->tile_height <= 0) {
+		return;
+	}
+	real32 step = layer->offset - layer->prev_offset;
+	if (step > layer->tile_height / 2) {
+		step -= layer->tile_height;
+	}
+	else if (step < -layer->tile_height / 2) {
+		step += layer->tile_height;
+	}
+	real32 offset = layer->prev_offset + step * alpha;
+	if (offset < 0) {
+		offset += layer->tile_height;
+	}
+	int32 src_y = (int32)offset % layer->tile_height;
+	int32 dst_y = 0;
+	while (dst_y < SCREEN_HEIGHT) {
+		int32 slice_height = MIN(SCREEN_HEIGHT - dst_y, layer->tile_height - src_y);
+		SDL_Rect src_rect = { 0, src_y, SCREEN_WIDTH, slice_height };
+		SDL_Rect dst_rect = { 0, dst_y, SCREEN_WIDTH, slice_height };
+		drawTexture(renderer, layer->texture, &src_rect, &dst_rect);
+		dst_y += slice_height;
+		src_y = 0;
+	}
+}
+
+// Positions at the previous simulation tick, so frames drawn between ticks can interpolate
+struct TickSnapshot {
+	Vector2f player_pos[MAX_PLAYERS];
+	Vector2f enemy_pos;
+	Vector2f ball_pos;
+};
+static TickSnapshot prev_tick = {};
+
+static void snapshotTick() {
+	for (uint32 i = 0; i < state->num_players; i++) {
+		prev_tick.player_pos[i] = state->players[i].pos;
+	}
+	prev_tick.enemy_pos = state->enemy_pos;
+	prev_tick.ball_pos = state->ball_pos;
+	bg_layer.prev_offset = bg_layer.offset;
+}
+
+static Vector2f lerpPosition(Vector2f from, Vector2f to, real32 alpha) {
+	// Wrapping around the screen edges or resetting is not motion, don't smear it across the screen
+	if ((to - from).getMagnitude() > SCREEN_WIDTH / 2) {
+		return to;
+	}
+	return from + (to - from) * alpha;
+}
+
+static void drawLine(SDL_Renderer * renderer, int32 x1, int32 y1, int32 x2, int32 y2) {
+	SDL_RenderDrawLine(renderer, x1 + camera_offset.x, y1 + camera_offset.y, x2 + camera_offset.x, y2 + camera_offset.y);
+}
+
+// Practice mode restores the simulation as it was at the start of any ball phase.
+// The checkpoints are simulated headless on a background thread right after startup.
+static GameState * checkpoints = NULL;
+static int32 max_checkpoints = 0;
+static SDL_atomic_t checkpoint_count; // checkpoints below this index are complete and never written again
+static SDL_atomic_t checkpoint_builder_stop;
+static SDL_Thread * checkpoint_builder = NULL;
+static int32 practice_selection = -1; // -1 starts from the beginning
+static bool last_practice_press = false;
+
+static void updatePracticeSelection(ControllerInput * controller) {
+	bool left = controller->dir_left > 0.5f;
+	bool right = controller->dir_right > 0.5f;
+	if (!last_practice_press) {
+		if (left) {
+			practice_selection = MAX(practice_selection - 1, -1);
+		}
+		if (right) {
+			practice_selection = MIN(practice_selection + 1, SDL_AtomicGet(&checkpoint_count) - 1);
+		}
+	}
+	last_practice_press = left || right;
+}
+
+// Music for a state that was restored rather than reached by playing
+static void playStateMusic() {
+	Mix_Music * stage_music[] = { level1_music, level2_music, level3_music };
+	if (state->current_state == MainMenu) {
+		playMusic(title_music);
+	}
+	else if (state->current_state == Ending || state->ball_stage >= LEN(stage_music)) {
+		playMusic(ending_music);
+	}
+	else {
+		playMusic(stage_music[state->ball_stage]);
+	}
+}
+
+static void startPractice(int32 checkpoint_index) {
+	*state = checkpoints[checkpoint_index];
+	playStateMusic();
+	// Start is still held on the next tick, the checkpoint's latch doesn't know that
+	state->last_pause_press = true;
+}
+
+// controllers has one entry per player. Menus and pausing listen to all of them, both peers have to see the same,
+// but closing the game only happens here so only local players can do it.
+void update(ControllerInput * controllers, real32 time_delta) {
+	ControllerInput menu_input = controllers[0];
+	for (uint32 i = 1; i < state->num_players; i++) {
+		menu_input.button_start = menu_input.button_start || controllers[i].button_start;
+		menu_input.button_select = menu_input.button_select || controllers[i].button_select;
+	}
+	ControllerInput * controller = &menu_input;
+	bool close_press = closing_player >= 0 ? controllers[closing_player].button_select : menu_input.button_select;
+
+	bool pausePress = false;
+	state->enemy_message = 0;
+	switch (state->current_state)
+	{
+	case MainMenu:
+		if (state->num_players == 1) {
+			updatePracticeSelection(controller);
+		}
+		if (controller->button_start) {
 			changeCurrentState(Beginning);
+			state->last_pause_press = true;
+			if (practice_selection >= 0 && state->num_players == 1) {
+				startPractice(practice_selection);
+			}
 		}
-		if (controller->button_select) {
+		if (close_press) {
 			closing = true;
 		}
 		break;
@@ -970,26 +1604,26 @@ void updateAndDraw(SDL_Surface * screen_surface, SDL_Renderer * renderer, SDL_Wi
 			state->enemy_pos = org + (dest - org) * (sin(0.5f*Pi32*(state->beginning_frames / 60.f)));
 		}
 		else if (state->beginning_frames < 240) {
-			enemy_message = 1;
+			state->enemy_message = 1;
 			if (state->beginning_frames % 10 == 0) {
-				enemy_sprite_x = enemy_sprite_x == 0 ? player_width : 0;
+				state->enemy_sprite_x = state->enemy_sprite_x == 0 ? player_width : 0;
 			}
 		}
 		else if (state->beginning_frames == 240) {
-			enemy_sprite_x = 0;
-			enemy_message = 0;
+			state->enemy_sprite_x = 0;
+			state->enemy_message = 0;
 		}
 		else if (state->beginning_frames <= 300) {
 		}
 		else if (state->beginning_frames < 480) {
-			enemy_message = 2;
+			state->enemy_message = 2;
 			if (state->beginning_frames % 10 == 0) {
-				enemy_sprite_x = enemy_sprite_x == 0 ? player_width : 0;
+				state->enemy_sprite_x = state->enemy_sprite_x == 0 ? player_width : 0;
 			}
 		}
 		else if (state->beginning_frames == 480) {
-			enemy_sprite_x = 0;
-			enemy_message = 0;
+			state->enemy_sprite_x = 0;
+			state->enemy_message = 0;
 		}
 		else if (state->beginning_frames <= 540) {
 			Vector2f org = { SCREEN_WIDTH / 2,  60 };
@@ -1000,44 +1634,40 @@ void updateAndDraw(SDL_Surface * screen_surface, SDL_Renderer * renderer, SDL_Wi
 		else if (state->beginning_frames <= 600) {
 		}
 		else if (state->beginning_frames < 720) {
-			enemy_message = 3;
+			state->enemy_message = 3;
 			if (state->beginning_frames % 10 == 0) {
-				enemy_sprite_x = enemy_sprite_x == 0 ? player_width : 0;
+				state->enemy_sprite_x = state->enemy_sprite_x == 0 ? player_width : 0;
 			}
 			Vector2f org = { SCREEN_WIDTH / 2,  45 };
 			Vector2f dest = { SCREEN_WIDTH / 2,  -45 };
 			state->enemy_pos = org + (dest - org) * (sin(0.5f*Pi32*((state->beginning_frames - 600) / 120.f)));
 		}
 		else if (state->beginning_frames == 720) {
-			enemy_message = 0;
-			enemy_sprite_x = 0;
+			state->enemy_message = 0;
+			state->enemy_sprite_x = 0;
 			changeCurrentState(Playing);
 		}
 
 		state->beginning_frames++;
 		break;
 	case Playing:
-		playingUpdate(controller, time_delta);
+		playingUpdate(controllers, time_delta);
 		break;
 	case Dead:
 		deadUpdate(controller, time_delta);
 		break;
 	case Paused:
 		pausePress = controller->button_start || controller->button_select;
-		if (!last_pause_press && pausePress) {
+		if (!state->last_pause_press && pausePress) {
 			changeCurrentState(Playing);
 		}
-		if (!last_pause_press && controller->button_select) {
+		if (!state->last_pause_press && close_press) {
 			closing = true;
 		}
-		last_pause_press = pausePress;
+		state->last_pause_press = pausePress;
 		break;
 	case GameOver:
-		game_over_y = 210;
-		if (state->gameover_frames <= 95.f) {
-			game_over_y = 0 + (state->gameover_frames / 95.f) * 210;
-		}
-		else {
+		if (state->gameover_frames > 95.f) {
 			if (controller->button_select) {
 				changeCurrentState(MainMenu);
 			}
@@ -1049,28 +1679,29 @@ void updateAndDraw(SDL_Surface * screen_surface, SDL_Renderer * renderer, SDL_Wi
 		state->gameover_frames++;
 		break;
 	case Shaking:
+		// shaking_frames is the offset the last draws showed, 0 after the tick that started the shake, and each one gets a tick
 		if (state->shaking_for_dead) {
-			if (state->shaking_frames > 7) {
+			if (state->shaking_frames >= 7) {
 				changeCurrentState(Dead);
 				state->shaking_for_dead = false;
 			}
 		}
-		else if(state->shaking_frames > 1) {
+		else if(state->shaking_frames >= 1) {
 			changeCurrentState(Playing);
 		}
+		if (state->current_state == Shaking) {
+			state->shaking_frames++;
+		}
 		break;
 	default:
 		break;
 	}
 
 	if (state->current_state == Ending) {
-		SDL_RenderCopy(renderer, ending_texture, 0, 0);
-		SDL_RenderPresent(renderer);
-
 		if (controller->button_start) {
 			changeCurrentState(MainMenu);
 		}
-		if (controller->button_select) {
+		if (close_press) {
 			closing = true;
 		}
 		return;
@@ -1080,34 +1711,551 @@ void updateAndDraw(SDL_Surface * screen_surface, SDL_Renderer * renderer, SDL_Wi
 	state->ball_g = 255 - state->ball_r;
 	state->ball_b = (uint8)(MIN(state->ball_scale * 400, 255));
 
-	if (state->current_state == Shaking) {
+	if (state->current_state != Paused && state->current_state != Shaking && !silentSimulation()) {
+		scrollLayer(&bg_layer);
+	}
+}
+
+// Plays the game from the main menu with no input, saving a checkpoint whenever a new ball phase starts
+static int buildCheckpoints(void * data) {
+	(void)data;
+	headless_simulation = true;
+	GameState sim_state;
+	state = &sim_state;
+	ControllerInput no_input = {};
+	changeCurrentState(Beginning);
+
+	uint32 last_stage = 0;
+	uint32 last_phase = 0;
+	int32 count = 0;
+	while (count < max_checkpoints && state->current_state != Ending && !SDL_AtomicGet(&checkpoint_builder_stop)) {
+		update(&no_input, 1.0f / 60);
+		if (state->current_state == Beginning || state->ball_stage >= LEN(ball_stages) || state->ball_phase >= ball_stages[state->ball_stage]->size()) {
+			continue;
+		}
+		if (count == 0 || state->ball_stage != last_stage || state->ball_phase != last_phase) {
+			checkpoints[count] = *state;
+			count++;
+			SDL_AtomicSet(&checkpoint_count, count);
+			last_stage = state->ball_stage;
+			last_phase = state->ball_phase;
+		}
+	}
+	LogInfo("Built %d practice checkpoints", count);
+	return 0;
+}
+
+static void startCheckpointBuilder() {
+	max_checkpoints = 0;
+	for (uint32 i = 0; i < LEN(ball_stages); i++) {
+		max_checkpoints += ball_stages[i]->size();
+	}
+	checkpoints = new GameState[max_checkpoints];
+	SDL_AtomicSet(&checkpoint_count, 0);
+	SDL_AtomicSet(&checkpoint_builder_stop, 0);
+	checkpoint_builder = SDL_CreateThread(buildCheckpoints, "checkpoints", NULL);
+	if (checkpoint_builder == NULL) {
+		LogError("Could not start the practice checkpoint thread! SDL_Error: %s\n", SDL_GetError());
+	}
+}
+
+// Rewind history: every gameplay tick is stored as the XOR of its state with the previous tick, run length
+// encoded with varints, in a fixed ring. Each record is framed by its length on both sides, so the ring can
+// be dropped from the oldest end and popped from the newest end.
+#define REWIND_BUFFER_SIZE (1 << 20)
+static uint8 rewind_ring[REWIND_BUFFER_SIZE];
+static uint32 rewind_head = 0; // where the next record starts
+static uint32 rewind_tail = 0; // start of the oldest record
+static uint32 rewind_used = 0;
+static uint32 rewind_records = 0;
+static bool rewind_has_base = false;
+static GameState rewind_base; // the newest recorded state, the records lead backwards from it
+static uint8 rewind_scratch[2 * sizeof(GameState) + 16];
+
+static void rewindWrite(const void * data, uint32 size) {
+	const uint8 * bytes = (const uint8 *)data;
+	for (uint32 i = 0; i < size; i++) {
+		rewind_ring[rewind_head] = bytes[i];
+		rewind_head = (rewind_head + 1) % REWIND_BUFFER_SIZE;
+	}
+}
+
+static void rewindRead(uint32 position, void * data, uint32 size) {
+	uint8 * bytes = (uint8 *)data;
+	for (uint32 i = 0; i < size; i++) {
+		bytes[i] = rewind_ring[(position + i) % REWIND_BUFFER_SIZE];
+	}
+}
+
+static uint32 writeVarint(uint8 * out, uint32 value) {
+	uint32 size = 0;
+	while (value >= 0x80) {
+		out[size++] = (uint8)(value | 0x80);
+		value >>= 7;
+	}
+	out[size++] = (uint8)value;
+	return size;
+}
+
+static uint32 readVarint(const uint8 * in, uint32 * value) {
+	uint32 size = 0;
+	uint32 shift = 0;
+	*value = 0;
+	do {
+		*value |= (uint32)(in[size] & 0x7f) << shift;
+		shift += 7;
+	} while (in[size++] & 0x80);
+	return size;
+}
+
+// Encodes a XOR b as (zero run, literal run, literal bytes) triplets
+static uint32 encodeXorDelta(const uint8 * a, const uint8 * b, uint32 size, uint8 * out) {
+	uint32 out_size = 0;
+	uint32 i = 0;
+	while (i < size) {
+		uint32 zeros = 0;
+		while (i + zeros < size && a[i + zeros] == b[i + zeros]) {
+			zeros++;
+		}
+		i += zeros;
+		uint32 literals = 0;
+		while (i + literals < size && a[i + literals] != b[i + literals]) {
+			literals++;
+		}
+		out_size += writeVarint(out + out_size, zeros);
+		out_size += writeVarint(out + out_size, literals);
+		for (uint32 j = 0; j < literals; j++) {
+			out[out_size++] = a[i + j] ^ b[i + j];
+		}
+		i += literals;
+	}
+	return out_size;
+}
+
+static void applyXorDelta(uint8 * target, const uint8 * delta, uint32 delta_size) {
+	uint32 position = 0;
+	uint32 i = 0;
+	while (i < delta_size) {
+		uint32 zeros, literals;
+		i += readVarint(delta + i, &zeros);
+		i += readVarint(delta + i, &literals);
+		position += zeros;
+		for (uint32 j = 0; j < literals; j++) {
+			target[position++] ^= delta[i++];
+		}
+	}
+}
+
+static void clearRewind() {
+	rewind_head = rewind_tail = rewind_used = rewind_records = 0;
+	rewind_has_base = false;
+}
+
+static void recordRewindFrame() {
+#ifdef DEBUG
+	uint64 start_counter = SDL_GetPerformanceCounter();
+#endif
+	if (rewind_has_base) {
+		uint32 delta_size = encodeXorDelta((const uint8 *)state, (const uint8 *)&rewind_base, sizeof(GameState), rewind_scratch);
+		uint32 record_size = delta_size + 2 * sizeof(uint32);
+		while (rewind_used + record_size > REWIND_BUFFER_SIZE && rewind_records > 0) {
+			uint32 oldest_size;
+			rewindRead(rewind_tail, &oldest_size, sizeof(uint32));
+			rewind_tail = (rewind_tail + oldest_size + 2 * sizeof(uint32)) % REWIND_BUFFER_SIZE;
+			rewind_used -= oldest_size + 2 * sizeof(uint32);
+			rewind_records--;
+		}
+		rewindWrite(&delta_size, sizeof(uint32));
+		rewindWrite(rewind_scratch, delta_size);
+		rewindWrite(&delta_size, sizeof(uint32));
+		rewind_used += record_size;
+		rewind_records++;
+#ifdef DEBUG
+		profile.rewind_bytes += record_size;
+#endif
+	}
+	rewind_base = *state;
+	rewind_has_base = true;
+#ifdef DEBUG
+	profile.rewind_counter += SDL_GetPerformanceCounter() - start_counter;
+	profile.rewind_frames++;
+#endif
+}
+
+// Steps the game one recorded tick back, returns false when the history is exhausted
+static bool popRewindFrame() {
+	if (rewind_records == 0) {
+		return false;
+	}
+	uint32 delta_size;
+	uint32 trailer = (rewind_head + REWIND_BUFFER_SIZE - sizeof(uint32)) % REWIND_BUFFER_SIZE;
+	rewindRead(trailer, &delta_size, sizeof(uint32));
+	uint32 record_start = (rewind_head + REWIND_BUFFER_SIZE - delta_size - 2 * sizeof(uint32)) % REWIND_BUFFER_SIZE;
+	rewindRead((record_start + sizeof(uint32)) % REWIND_BUFFER_SIZE, rewind_scratch, delta_size);
+	applyXorDelta((uint8 *)&rewind_base, rewind_scratch, delta_size);
+	rewind_head = record_start;
+	rewind_used -= delta_size + 2 * sizeof(uint32);
+	rewind_records--;
+	*state = rewind_base;
+	return true;
+}
+
+// Save states: the raw GameState behind a small header. Bump SAVE_STATE_VERSION whenever GameState changes.
+#define SAVE_STATE_MAGIC 0x42524f42 // "BORB"
+#define SAVE_STATE_VERSION 3
+#define NUM_SAVE_SLOTS 4
+
+struct SaveStateHeader {
+	uint32 magic;
+	uint32 version;
+	uint32 size;
+};
+
+static GameState save_slots[NUM_SAVE_SLOTS];
+static bool save_slot_used[NUM_SAVE_SLOTS];
+
+static uint32 serializeGameState(const GameState * game_state, uint8 * buffer, uint32 buffer_size) {
+	SaveStateHeader header = { SAVE_STATE_MAGIC, SAVE_STATE_VERSION, sizeof(GameState) };
+	if (buffer_size < sizeof(header) + sizeof(GameState)) {
+		return 0;
+	}
+	memcpy(buffer, &header, sizeof(header));
+	memcpy(buffer + sizeof(header), game_state, sizeof(GameState));
+	return sizeof(header) + sizeof(GameState);
+}
+
+static bool deserializeGameState(const uint8 * buffer, uint32 size, GameState * game_state) {
+	SaveStateHeader header;
+	if (size < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, buffer, sizeof(header));
+	if (header.magic != SAVE_STATE_MAGIC || header.version != SAVE_STATE_VERSION || header.size != sizeof(GameState) || size < sizeof(header) + header.size) {
+		LogWarn("Incompatible save state (version %u, %u bytes)", header.version, header.size);
+		return false;
+	}
+	memcpy(game_state, buffer + sizeof(header), sizeof(GameState));
+	return true;
+}
+
+static void saveStateSlot(uint32 slot) {
+	save_slots[slot] = *state;
+	save_slot_used[slot] = true;
+
+	uint8 buffer[sizeof(SaveStateHeader) + sizeof(GameState)];
+	uint32 size = serializeGameState(state, buffer, sizeof(buffer));
+	char filename[32];
+	snprintf(filename, sizeof(filename), "save%u.bin", slot + 1);
+	SDL_RWops * file = SDL_RWFromFile(filename, "wb");
+	if (file == NULL || SDL_RWwrite(file, buffer, size, 1) != 1) {
+		LogWarn("Could not write %s: %s", filename, SDL_GetError());
+	}
+	if (file != NULL) {
+		SDL_RWclose(file);
+	}
+}
+
+static void loadStateSlot(uint32 slot) {
+	if (!save_slot_used[slot]) {
+		// Not saved in this session, try the file from an earlier one
+		uint8 buffer[sizeof(SaveStateHeader) + sizeof(GameState)];
+		char filename[32];
+		snprintf(filename, sizeof(filename), "save%u.bin", slot + 1);
+		SDL_RWops * file = SDL_RWFromFile(filename, "rb");
+		if (file == NULL) {
+			return;
+		}
+		size_t size = SDL_RWread(file, buffer, 1, sizeof(buffer));
+		SDL_RWclose(file);
+		save_slot_used[slot] = deserializeGameState(buffer, (uint32)size, &save_slots[slot]);
+		if (!save_slot_used[slot]) {
+			return;
+		}
+	}
+	*state = save_slots[slot];
+	clearRewind();
+	playStateMusic();
+}
+
+static bool isRewindable(State game_state) {
+	return game_state == Playing || game_state == Dead || game_state == Shaking;
+}
+
+// A main thread simulation step: holding rewind walks back through the history instead of updating
+static void gameTick(ControllerInput * controllers, real32 time_delta) {
+	ControllerInput * controller = &controllers[0];
+	if (controller->save_slot > 0) {
+		saveStateSlot(controller->save_slot - 1);
+		controller->save_slot = 0;
+	}
+	if (controller->load_slot > 0) {
+		loadStateSlot(controller->load_slot - 1);
+		controller->load_slot = 0;
+	}
+	if (controller->button_l && isRewindable(state->current_state)) {
+		popRewindFrame();
+		return;
+	}
+	update(controllers, time_delta);
+	if (isRewindable(state->current_state)) {
+		recordRewindFrame();
+	}
+	else if (state->current_state != Paused) {
+		clearRewind();
+	}
+}
+
+// Two player versus over UDP, kept in sync with rollback. Each peer runs the whole simulation.
+struct VersusSettings {
+	int32 local_player; // 0 or 1, -1 when not playing versus
+	uint16 local_port;
+	std::string peer_host;
+	uint16 peer_port;
+	int32 input_delay; // frames
+	uint32 delay_ms; // artificial network conditions, for testing over loopback
+	uint32 jitter_ms;
+	real32 loss;
+};
+static VersusSettings versus_settings = { -1, 0, "127.0.0.1", 0, 2, 0, 0, 0 };
+static NetTransport udp_transport = {};
+static NetTransport lossy_transport = {};
+static LossyTransport lossy_state;
+static RollbackSession rollback_session;
+static GameState rollback_states[NET_INPUT_HISTORY];
+static const real32 rollback_seconds_per_tick = 1.0f / 60;
+
+static NetInput netInputFromController(const ControllerInput * controller) {
+	NetInput input;
+	input.move_x = (int8)roundf(MAX(-1.f, MIN(1.f, controller->dir_right - controller->dir_left)) * 127);
+	input.move_y = (int8)roundf(MAX(-1.f, MIN(1.f, controller->dir_down - controller->dir_up)) * 127);
+	input.buttons = (controller->button_start ? NET_BUTTON_START : 0) | (controller->button_select ? NET_BUTTON_SELECT : 0);
+	return input;
+}
+
+// Both peers have to build exactly the same ControllerInput, so sub-tick movement edges are not used
+static void controllerFromNetInput(const NetInput * input, ControllerInput * controller) {
+	*controller = {};
+	controller->dir_right = MAX(input->move_x, 0) / 127.f;
+	controller->dir_left = MAX(-input->move_x, 0) / 127.f;
+	controller->dir_down = MAX(input->move_y, 0) / 127.f;
+	controller->dir_up = MAX(-input->move_y, 0) / 127.f;
+	controller->button_start = (input->buttons & NET_BUTTON_START) != 0;
+	controller->button_select = (input->buttons & NET_BUTTON_SELECT) != 0;
+	controller->move_before_edges = getMoveInput(*controller);
+}
+
+static void rollbackSaveState(void * context, int32 frame) {
+	(void)context;
+	rollback_states[frame & (NET_INPUT_HISTORY - 1)] = *state;
+}
+
+static void rollbackLoadState(void * context, int32 frame) {
+	(void)context;
+	*state = rollback_states[frame & (NET_INPUT_HISTORY - 1)];
+}
+
+static void rollbackAdvanceFrame(void * context, const NetInput * inputs, bool resimulate) {
+	(void)context;
+	ControllerInput controllers[MAX_PLAYERS] = {};
+	for (uint32 i = 0; i < NET_MAX_PLAYERS; i++) {
+		controllerFromNetInput(&inputs[i], &controllers[i]);
+	}
+	resimulating = resimulate;
+	rollback_simulation = true;
+	update(controllers, rollback_seconds_per_tick);
+	rollback_simulation = false;
+	resimulating = false;
+}
+
+static const RollbackCallbacks rollback_callbacks = { NULL, rollbackSaveState, rollbackLoadState, rollbackAdvanceFrame };
+
+static Mix_Music * versus_music = NULL;
+static int32 versus_music_volume = 0;
+
+// Plays the music of the newest state both peers agree on, so a predicted game over or pause that gets rolled back is never heard
+static void syncVersusMusic() {
+	int32 remote = 1 - rollback_session.local_player;
+	int32 confirmed_end = MIN(rollback_session.frame, rollback_session.confirmed_frame[remote] + 1);
+	// Saved at the start of the first frame simulated with a predicted input
+	const GameState * confirmed = confirmed_end >= rollback_session.frame ? state : &rollback_states[confirmed_end & (NET_INPUT_HISTORY - 1)];
+	Mix_Music * stage_music[] = { level1_music, level2_music, level3_music };
+	Mix_Music * music = NULL;
+	if (confirmed->current_state == MainMenu) {
+		music = title_music;
+	}
+	else if (confirmed->current_state == Ending || confirmed->ball_stage >= LEN(stage_music)) {
+		music = ending_music;
+	}
+	else if (confirmed->current_state != GameOver) {
+		music = stage_music[confirmed->ball_stage];
+	}
+	if (music != versus_music) {
+		if (music == NULL) {
+			Mix_FadeOutMusic(300);
+		}
+		else {
+			Mix_PlayMusic(music, -1);
+		}
+		versus_music = music;
+	}
+	int32 volume = confirmed->current_state == Paused ? music_volume / 2 : music_volume;
+	if (volume != versus_music_volume) {
+		Mix_VolumeMusic(volume);
+		versus_music_volume = volume;
+	}
+}
+
+// The versus counterpart of gameTick, without rewind or save states since the peer can't follow them
+static void versusTick(ControllerInput * controller) {
+#ifdef DEBUG
+	uint64 rollback_start_counter = SDL_GetPerformanceCounter();
+#endif
+	rollbackAddLocalInput(&rollback_session, netInputFromController(controller));
+	int32 resimulated_frames = rollbackAdvance(&rollback_session);
+	(void)resimulated_frames;
+	syncVersusMusic();
+#ifdef DEBUG
+	profile.rollback_counter += SDL_GetPerformanceCounter() - rollback_start_counter;
+	profile.rollback_ticks++;
+	profile.rollback_frames_max = MAX(profile.rollback_frames_max, (uint32)MAX(resimulated_frames, 0));
+#endif
+	controller->save_slot = 0;
+	controller->load_slot = 0;
+}
+
+static bool startVersus() {
+	if (!netStartup()) {
+		return false;
+	}
+	uint16 default_port = 7000 + versus_settings.local_player;
+	uint16 local_port = versus_settings.local_port ? versus_settings.local_port : default_port;
+	uint16 peer_port = versus_settings.peer_port ? versus_settings.peer_port : 7000 + (1 - versus_settings.local_player);
+	if (!udpTransportOpen(&udp_transport, local_port, versus_settings.peer_host.c_str(), peer_port)) {
+		netShutdown();
+		return false;
+	}
+	NetTransport * transport = &udp_transport;
+	if (versus_settings.loss > 0 || versus_settings.delay_ms > 0 || versus_settings.jitter_ms > 0) {
+		lossyTransportWrap(&lossy_transport, &lossy_state, &udp_transport, versus_settings.loss, versus_settings.delay_ms, versus_settings.jitter_ms);
+		transport = &lossy_transport;
+	}
+	rollbackStart(&rollback_session, transport, &rollback_callbacks, versus_settings.local_player, versus_settings.input_delay);
+	closing_player = versus_settings.local_player;
+	// initialize already started the title music
+	versus_music = title_music;
+	versus_music_volume = music_volume;
+	LogInfo("Versus as player %d on port %u, peer %s:%u", versus_settings.local_player + 1, local_port, versus_settings.peer_host.c_str(), peer_port);
+	return true;
+}
+
+static void stopVersus() {
+	if (versus_settings.local_player >= 0) {
+		udpTransportClose(&udp_transport);
+		netShutdown();
+	}
+}
+
+static void stopCheckpointBuilder() {
+	if (checkpoint_builder != NULL) {
+		SDL_AtomicSet(&checkpoint_builder_stop, 1);
+		SDL_WaitThread(checkpoint_builder, NULL);
+		checkpoint_builder = NULL;
+	}
+}
+
+// The fixed timestep: how many ticks each rendered frame runs and the real time window each tick's input covers
+struct TickClock {
+	real32 seconds_per_tick;
+	real32 accumulator; // simulated time the display is ahead by
+	real64 input_ms; // SDL ms the next tick's input window starts at
+};
+
+// Adds the real time since the last frame and returns how many ticks are due
+static int32 tickClockAdvance(TickClock * clock, real32 time_delta, real64 poll_ms) {
+	// Don't try to catch up on long stalls (window dragging, breakpoints)
+	clock->accumulator += MIN(time_delta, 0.25f);
+	// Input windows are a tick long and back to back, trailing the poll by the time not simulated yet. They only jump
+	// when that stops adding up, after a stall or as the two clocks drift apart, so an input lands at the same point
+	// of the same tick whatever the display rate. Edges after the last due tick's window wait for the next tick.
+	real64 start_ms = poll_ms - clock->accumulator * 1000.0;
+	if (fabs(start_ms - clock->input_ms) > 2.0) {
+		clock->input_ms = start_ms;
+	}
+	return (int32)(clock->accumulator / clock->seconds_per_tick);
+}
+
+// Runs one due tick over the next input window
+static void tickClockRun(TickClock * clock, ControllerInput * controllers) {
+	real64 tick_end_ms = clock->input_ms + clock->seconds_per_tick * 1000.0;
+	for (int32 i = 0; i < MAX_CONTROLLERS; i++) {
+		controllers[i].tick_start_ms = clock->input_ms;
+		controllers[i].tick_end_ms = tick_end_ms;
+	}
+	snapshotTick();
+	if (versus_settings.local_player >= 0) {
+		versusTick(&controllers[0]);
+	}
+	else {
+		gameTick(controllers, clock->seconds_per_tick);
+	}
+	for (int32 i = 0; i < MAX_CONTROLLERS; i++) {
+		consumeMoveEdges(controllers[i], tick_end_ms);
+	}
+	clock->input_ms = tick_end_ms;
+	clock->accumulator -= clock->seconds_per_tick;
+}
+
+// Renders the state between the previous tick (alpha = 0) and the current tick (alpha = 1)
+void draw(SDL_Renderer * renderer, real32 alpha) {
+	beginFrame(renderer);
+	if (state->current_state == Ending) {
+		SDL_RenderCopy(renderer, ending_texture, 0, 0);
+		presentFrame(renderer);
+		return;
+	}
+
+	// Screen Shake
+	camera_offset = { 0, 0 };
+	const bool shake_target = state->current_state == Shaking && frozen_texture != NULL;
+	if (shake_target) {
 		SDL_SetRenderTarget(renderer, frozen_texture);
 	}
+	else if (state->current_state == Shaking) {
+		const int8 * xs = state->shaking_for_dead ? death_shake_xs : shake_xs;
+		const int8 * ys = state->shaking_for_dead ? death_shake_ys : shake_ys;
+		camera_offset = { xs[state->shaking_frames], ys[state->shaking_frames] };
+	}
 
-	SDL_Rect bg_rect = {0, 1440 - ((non_paused_frame_count *2) % 1440), 720, 720};
-	SDL_RenderCopy(renderer, bg_texture, &bg_rect, 0);
+	drawScrollLayer(renderer, &bg_layer, alpha);
 
 	if (state->current_state != MainMenu) {
+		const Vector2f enemy_pos = lerpPosition(prev_tick.enemy_pos, state->enemy_pos, alpha);
+		const Vector2f ball_pos = lerpPosition(prev_tick.ball_pos, state->ball_pos, alpha);
+
 		if (state->ball_stage == 2) {
-			SDL_RenderCopy(renderer, big_circle_texture, 0, 0);
+			drawTexture(renderer, big_circle_texture, 0, 0);
 		}
 
-		if (state->player_visible) {
-			SDL_Rect player_sprite_rect = { player_sprite_x, 0, player_width, player_height };
-			SDL_Rect player_rect = { state->player_pos.x - player_width / 2, state->player_pos.y - player_height / 2, player_width, player_height };
-			SDL_RenderCopy(renderer, player_texture, &player_sprite_rect, &player_rect);
+		for (uint32 i = 0; i < state->num_players; i++) {
+			if (!state->players[i].active || (!state->player_visible && i == state->hit_player)) {
+				continue;
+			}
+			const Vector2f player_pos = lerpPosition(prev_tick.player_pos[i], state->players[i].pos, alpha);
+			SDL_Rect player_sprite_rect = { state->player_sprite_x, (int32)i * player_height, player_width, player_height };
+			SDL_Rect player_rect = { player_pos.x - player_width / 2, player_pos.y - player_height / 2, player_width, player_height };
+			drawTexture(renderer, player_texture, &player_sprite_rect, &player_rect);
 		}
 
-		SDL_Rect enemy_sprite_rect = { enemy_sprite_x, 0, player_width, player_height };
-		SDL_Rect enemy_rect = { state->enemy_pos.x - player_width / 2, state->enemy_pos.y - player_height / 2, player_width, player_height };
-		SDL_RenderCopy(renderer, enemy_texture, &enemy_sprite_rect, &enemy_rect);
+		SDL_Rect enemy_sprite_rect = { state->enemy_sprite_x, 0, player_width, player_height };
+		SDL_Rect enemy_rect = { enemy_pos.x - player_width / 2, enemy_pos.y - player_height / 2, player_width, player_height };
+		drawTexture(renderer, enemy_texture, &enemy_sprite_rect, &enemy_rect);
 
 		SDL_SetTextureAlphaMod(ball_texture, 255);
 		SDL_SetTextureColorMod(ball_texture, state->ball_r, state->ball_g, state->ball_b);
 
 		int32 effective_ball_radius = ball_radius * state->ball_scale;
-		SDL_Rect ball_rect = { state->ball_pos.x - effective_ball_radius, state->ball_pos.y - effective_ball_radius, effective_ball_radius * 2, effective_ball_radius * 2 };
-		SDL_RenderCopy(renderer, ball_texture, 0, &ball_rect);
+		SDL_Rect ball_rect = { ball_pos.x - effective_ball_radius, ball_pos.y - effective_ball_radius, effective_ball_radius * 2, effective_ball_radius * 2 };
+		drawTexture(renderer, ball_texture, 0, &ball_rect);
 
 		// Speed repeat draw
 		if (state->current_state == Playing && state->ball_moves_linearly) {
@@ -1120,118 +2268,869 @@ void updateAndDraw(SDL_Surface * screen_surface, SDL_Renderer * renderer, SDL_Wi
 			else if (diff_mag < ball_circ * 6) {
 				speed_ball_rect.x -= diff.x*0.5f;
 				speed_ball_rect.y -= diff.y*0.5f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 			}
 			else if (diff_mag < ball_circ * 8) {
 				speed_ball_rect.x -= diff.x*0.33f;
 				speed_ball_rect.y -= diff.y*0.33f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 				speed_ball_rect.x -= diff.x*0.33f;
 				speed_ball_rect.y -= diff.y*0.33f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 			}
 			else if (diff_mag < ball_circ * 10) {
 				speed_ball_rect.x -= diff.x*0.25f;
 				speed_ball_rect.y -= diff.y*0.25f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 				speed_ball_rect.x -= diff.x*0.25f;
 				speed_ball_rect.y -= diff.y*0.25f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 				speed_ball_rect.x -= diff.x*0.25f;
 				speed_ball_rect.y -= diff.y*0.25f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 			}
 			else{
 				speed_ball_rect.x -= diff.x*0.167f;
 				speed_ball_rect.y -= diff.y*0.167f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 				speed_ball_rect.x -= diff.x*0.167f;
 				speed_ball_rect.y -= diff.y*0.167f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 				speed_ball_rect.x -= diff.x*0.167f;
 				speed_ball_rect.y -= diff.y*0.167f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 				speed_ball_rect.x -= diff.x*0.167f;
 				speed_ball_rect.y -= diff.y*0.167f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
 				speed_ball_rect.x -= diff.x*0.167f;
 				speed_ball_rect.y -= diff.y*0.167f;
-				SDL_RenderCopy(renderer, ball_texture, 0, &speed_ball_rect);
+				drawTexture(renderer, ball_texture, 0, &speed_ball_rect);
+			}
+		}
+
+		if (show_ball_path && state->current_state == Playing && state->ball_moves_physically) {
+			// Predicted path for the next second, drawn from the tick position
+			const real32 effective_radius = state->ball_scale * ball_radius;
+			Vector2f pos = state->ball_pos;
+			Vector2f direction = state->ball_direction;
+			real32 seconds = 1.f;
+			SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+			for (uint32 i = 0; i < 16 && seconds > 0; i++) {
+				BallEvent event = predictNextBallEvent(pos, direction, state->ball_speed, effective_radius, state->h_reflect, state->v_reflect);
+				Vector2f end = event.time < seconds ? event.pos : pos + direction * (state->ball_speed * seconds);
+				drawLine(renderer, pos.x, pos.y, end.x, end.y);
+				seconds -= event.time;
+				applyBallEvent(&event, &pos, &direction, effective_radius);
 			}
+			SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 		}
 
 		if (state->dests_visible) {
 			SDL_SetTextureAlphaMod(ball_texture, state->dests_color.a);
 			SDL_SetTextureColorMod(ball_texture, state->dests_color.r, state->dests_color.g, state->dests_color.b);
-			for (int i = 0; i < num_dests; i++) {
-				Vector2f dest_v = polarToCar(r, dests[i]);
+			for (int i = 0; i < state->num_dests; i++) {
+				Vector2f dest_v = polarToCar(r, state->dests[i]);
 				SDL_Rect dest_rect = { dest_v.x, dest_v.y, 10, 10};
-				SDL_RenderCopy(renderer, ball_texture, 0, &dest_rect);
+				drawTexture(renderer, ball_texture, 0, &dest_rect);
 			}
 		}
 
 
 		SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
 		if (state->h_reflect) {
-			SDL_RenderDrawLine(renderer, 0, 0, 0, SCREEN_HEIGHT - 1);
-			SDL_RenderDrawLine(renderer, SCREEN_WIDTH - 1, 0, SCREEN_WIDTH - 1, SCREEN_HEIGHT - 1);
+			drawLine(renderer, 0, 0, 0, SCREEN_HEIGHT - 1);
+			drawLine(renderer, SCREEN_WIDTH - 1, 0, SCREEN_WIDTH - 1, SCREEN_HEIGHT - 1);
 		}
 		if (state->v_reflect) {
-			SDL_RenderDrawLine(renderer, 0, 0, SCREEN_WIDTH - 1, 0);
-			SDL_RenderDrawLine(renderer, 0, SCREEN_HEIGHT - 1, SCREEN_WIDTH - 1, SCREEN_HEIGHT - 1);
+			drawLine(renderer, 0, 0, SCREEN_WIDTH - 1, 0);
+			drawLine(renderer, 0, SCREEN_HEIGHT - 1, SCREEN_WIDTH - 1, SCREEN_HEIGHT - 1);
 		}
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 
-		SDL_Rect lives_sprite_rect = { 0, 0, player_width, player_height };
-		SDL_Rect lives_rect = { 20, 20, player_width / 2, player_height / 2 };
-		SDL_RenderCopy(renderer, player_texture, &lives_sprite_rect, &lives_rect);
-		FC_Draw(font, renderer, 60, 15, "x %d", state->player_lives);
+		for (uint32 i = 0; i < state->num_players; i++) {
+			if (!state->players[i].active) {
+				continue;
+			}
+			SDL_Rect lives_sprite_rect = { 0, (int32)i * player_height, player_width, player_height };
+			SDL_Rect lives_rect = { 20, 20 + (int32)i * 36, player_width / 2, player_height / 2 };
+			drawTexture(renderer, player_texture, &lives_sprite_rect, &lives_rect);
+			FC_SetText(lives_texts[i], "x %d", state->players[i].lives);
+			FC_DrawText(lives_texts[i], renderer, 60 + camera_offset.x, 15 + i * 36 + camera_offset.y);
+		}
 
 		if (state->current_state == GameOver) {
-			FC_Draw(large_font, renderer, 120, game_over_y, "Game Over");
+			int32 game_over_y = 210;
+			if (state->gameover_frames <= 95.f) {
+				game_over_y = 0 + (state->gameover_frames / 95.f) * 210;
+			}
+			FC_DrawText(game_over_text, renderer, 120 + camera_offset.x, game_over_y + camera_offset.y);
 		}
 		if (state->current_state == Paused) {
-			SDL_RenderCopy(renderer, overlay_texture, 0, 0);
+			drawTexture(renderer, overlay_texture, 0, 0);
 			SDL_Rect controls_rect = { 0, 360, 720, 360 };
-			SDL_RenderCopy(renderer, controls_texture, 0, &controls_rect);
-			SDL_RenderPresent(renderer);
+			drawTexture(renderer, controls_texture, 0, &controls_rect);
 		}
 
-		if (enemy_message > 0) {
-			FC_Draw(font, renderer, SCREEN_WIDTH / 2 + 40, 15, enemy_messages[enemy_message]);
+		if (state->enemy_message > 0) {
+			FC_SetText(enemy_text, "%s", enemy_messages[state->enemy_message]);
+			FC_DrawText(enemy_text, renderer, SCREEN_WIDTH / 2 + 40 + camera_offset.x, 15 + camera_offset.y);
 		}
 	}
 	else {
 		// Main menu
-		FC_Draw(large_font, renderer, 120, 60, "Beware \nthe Orb");
+		FC_DrawText(title_text, renderer, 120 + camera_offset.x, 60 + camera_offset.y);
+		if (state->num_players > 1) {
+			FC_SetText(menu_text, "Start with %u crabs", state->num_players);
+		}
+		else if (practice_selection < 0) {
+			FC_SetText(menu_text, "< Start from the beginning >");
+		}
+		else {
+			const GameState * practice_state = &checkpoints[practice_selection];
+			FC_SetText(menu_text, "< Practice: stage %u phase %u >", practice_state->ball_stage + 1, practice_state->ball_phase + 1);
+		}
+		FC_DrawText(menu_text, renderer, 120 + camera_offset.x, 300 + camera_offset.y);
 
 		SDL_Rect controls_rect = {0, 360, 720, 360};
-		SDL_RenderCopy(renderer, controls_texture, 0, &controls_rect);
+		drawTexture(renderer, controls_texture, 0, &controls_rect);
 	}
 
-	// Screen Shake
-	if (state->current_state == Shaking) {
-		SDL_SetRenderTarget(renderer, 0);
+	if (shake_target) {
+		setFrameTarget(renderer);
 		const int8 * xs = state->shaking_for_dead ? death_shake_xs : shake_xs;
 		const int8 * ys = state->shaking_for_dead ? death_shake_ys : shake_ys;
 		SDL_Rect frame_rect = { xs[state->shaking_frames], ys[state->shaking_frames], SCREEN_WIDTH, SCREEN_HEIGHT};
 		SDL_RenderCopy(renderer, frozen_texture, 0, &frame_rect);
-		SDL_RenderPresent(renderer);
+	}
+	presentFrame(renderer);
+}
+
+
+static bool parseSize(const char * text, int32 * width, int32 * height) {
+	int32 w, h;
+	if (sscanf(text, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+		return false;
+	}
+	*width = w;
+	*height = h;
+	return true;
+}
+
+// Times one tick of ball physics and collision against MAX_PLAYERS crabs at increasing speeds. The fastest ones saturate
+// MAX_BALL_PATH_POINTS, which is the worst case a tick can cost.
+static bool benchmarkBallPath() {
+	const real32 speeds[] = { 500, 2000, 8000, 32000, 128000, 1000000 };
+	const uint32 iterations = 100000;
+	const real64 budget_us = 20;
+	const uint64 perf_frequency = SDL_GetPerformanceFrequency();
+	const real32 effective_ball_radius = ball_radius * 0.01f;
+	PlayerLanes lanes;
+	for (uint32 i = 0; i < MAX_PLAYERS; i++) {
+		lanes.x[i] = -1000.f - i * player_width;
+		lanes.y[i] = -1000.f;
+	}
+	bool within_budget = true;
+	for (uint32 s = 0; s < LEN(speeds); s++) {
+		Vector2f pos = { SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2 };
+		Vector2f direction = { 0.6f, 0.8f };
+		BallPath path;
+		uint64 segments = 0;
+		uint32 hits = 0;
+		uint64 start_counter = SDL_GetPerformanceCounter();
+		for (uint32 i = 0; i < iterations; i++) {
+			traceBallPath(pos, &direction, speeds[s] / 60.f, effective_ball_radius, true, true, &path);
+			for (uint32 p = 0; p + 1 < path.num_points; p++) {
+				real32 hit_t;
+				hits += sweptCollisionCheckLanes(path.points[p], path.points[p + 1], &lanes, player_radius + effective_ball_radius, &hit_t) >= 0;
+			}
+			pos = path.points[path.num_points - 1];
+			segments += path.num_points - 1;
+		}
+		real64 step_us = (1000000.0 * (real64)(SDL_GetPerformanceCounter() - start_counter)) / ((real64)perf_frequency * iterations);
+		bool ok = step_us <= budget_us && hits == 0;
+		within_budget = within_budget && ok;
+		printf("%8.0f px/s: %.03f us/step, %.02f segments/step %s \n", speeds[s], step_us, (real64)segments / iterations, ok ? "" : "OVER BUDGET");
+	}
+	return within_budget;
+}
+
+// Times restoring a state and re-simulating 8 frames of two player play, which a rollback
+// has to fit into a single 60 Hz frame next to the regular tick and the draw
+static bool benchmarkRollback() {
+	const uint32 rollback_frames = 8;
+	const uint32 iterations = 3600;
+	const real64 budget_ms = 16;
+	const uint64 perf_frequency = SDL_GetPerformanceFrequency();
+	GameState base_state;
+	state = &base_state;
+	base_state.num_players = 2;
+
+	// Play through the intro without input, the base state never collides so it keeps playing
+	headless_simulation = true;
+	NetInput inputs[NET_MAX_PLAYERS] = {};
+	inputs[0].buttons = NET_BUTTON_START;
+	rollbackAdvanceFrame(NULL, inputs, false);
+	inputs[0].buttons = 0;
+	while (base_state.current_state != Playing) {
+		rollbackAdvanceFrame(NULL, inputs, false);
+	}
+
+	GameState sim_state;
+	uint64 total_counter = 0;
+	uint64 max_counter = 0;
+	for (uint32 i = 0; i < iterations; i++) {
+		state = &base_state;
+		headless_simulation = true;
+		rollbackAdvanceFrame(NULL, inputs, false);
+		headless_simulation = false;
+
+		state = &sim_state;
+		*state = base_state;
+		uint64 start_counter = SDL_GetPerformanceCounter();
+		rollbackSaveState(NULL, 0);
+		rollbackLoadState(NULL, 0);
+		for (uint32 f = 0; f < rollback_frames; f++) {
+			inputs[0].move_x = (int8)(127 * cosf((i + f) * 0.1f));
+			inputs[0].move_y = (int8)(127 * sinf((i + f) * 0.1f));
+			inputs[1].move_x = -inputs[0].move_x;
+			inputs[1].move_y = inputs[0].move_y;
+			rollbackSaveState(NULL, f + 1);
+			rollbackAdvanceFrame(NULL, inputs, true);
+		}
+		uint64 elapsed = SDL_GetPerformanceCounter() - start_counter;
+		total_counter += elapsed;
+		max_counter = MAX(max_counter, elapsed);
+	}
+	state = NULL;
+
+	real64 avg_ms = (1000.0 * (real64)total_counter) / ((real64)perf_frequency * iterations);
+	real64 max_ms = (1000.0 * (real64)max_counter) / (real64)perf_frequency;
+	bool ok = max_ms <= budget_ms;
+	printf("%u frame rollback: %.04f ms avg, %.04f ms max, %u bytes/state %s \n", rollback_frames, avg_ms, max_ms, (uint32)sizeof(GameState), ok ? "" : "OVER BUDGET");
+	return ok;
+}
+
+// An in-memory datagram queue standing in for a socket, one per direction
+struct MemoryLink {
+	uint8 data[LOSSY_MAX_PENDING][NET_MAX_PACKET];
+	uint32 size[LOSSY_MAX_PENDING];
+	uint32 head;
+	uint32 count;
+};
+
+struct MemoryEndpoint {
+	MemoryLink * out;
+	MemoryLink * in;
+};
+
+static bool memorySend(void * context, const uint8 * data, uint32 size) {
+	MemoryLink * link = ((MemoryEndpoint *)context)->out;
+	if (link->count >= LOSSY_MAX_PENDING || size > NET_MAX_PACKET) {
+		return false;
+	}
+	uint32 index = (link->head + link->count++) % LOSSY_MAX_PENDING;
+	memcpy(link->data[index], data, size);
+	link->size[index] = size;
+	return true;
+}
+
+static int32 memoryReceive(void * context, uint8 * data, uint32 capacity) {
+	MemoryLink * link = ((MemoryEndpoint *)context)->in;
+	if (link->count == 0) {
+		return 0;
+	}
+	uint32 size = MIN(link->size[link->head], capacity);
+	memcpy(data, link->data[link->head], size);
+	link->head = (link->head + 1) % LOSSY_MAX_PENDING;
+	link->count--;
+	return (int32)size;
+}
+
+#define NET_GAP_CHECK_FRAMES 600
+
+// Records the inputs each frame was last simulated with instead of running the game
+struct NetGapPeer {
+	int32 frame;
+	NetInput log[NET_GAP_CHECK_FRAMES + NET_INPUT_HISTORY][NET_MAX_PLAYERS];
+};
+
+static void netGapSaveState(void * context, int32 frame) {
+	((NetGapPeer *)context)->frame = frame;
+}
+
+static void netGapLoadState(void * context, int32 frame) {
+	(void)context;
+	(void)frame;
+}
+
+static void netGapAdvanceFrame(void * context, const NetInput * inputs, bool resimulate) {
+	(void)resimulate;
+	NetGapPeer * peer = (NetGapPeer *)context;
+	memcpy(peer->log[peer->frame], inputs, sizeof(peer->log[0]));
+}
+
+// Runs two sessions at the largest input delay over a link that drops everything one peer sends for a while,
+// so far more inputs go unacknowledged than used to fit in a packet, then lets the link recover. Both peers
+// have to get through NET_GAP_CHECK_FRAMES frames and agree on every input they simulated as confirmed.
+static bool checkRollbackGap() {
+	const int32 input_delay = NET_INPUT_HISTORY; // rollbackStart clamps it to the largest it allows
+	const uint32 outage_steps = 180;
+	const uint32 max_steps = 20 * NET_GAP_CHECK_FRAMES;
+	MemoryLink * links = new MemoryLink[NET_MAX_PLAYERS]();
+	NetGapPeer * peers = new NetGapPeer[NET_MAX_PLAYERS]();
+	MemoryEndpoint endpoints[NET_MAX_PLAYERS];
+	NetTransport inner[NET_MAX_PLAYERS];
+	NetTransport transports[NET_MAX_PLAYERS];
+	LossyTransport * lossy = new LossyTransport[NET_MAX_PLAYERS];
+	RollbackSession * sessions = new RollbackSession[NET_MAX_PLAYERS];
+	for (int32 player = 0; player < NET_MAX_PLAYERS; player++) {
+		endpoints[player] = { &links[player], &links[1 - player] };
+		inner[player] = { &endpoints[player], memorySend, memoryReceive };
+		lossyTransportWrap(&transports[player], &lossy[player], &inner[player], player == 0 ? 1.f : 0.f, 0, 0);
+		RollbackCallbacks callbacks = { &peers[player], netGapSaveState, netGapLoadState, netGapAdvanceFrame };
+		rollbackStart(&sessions[player], &transports[player], &callbacks, player, input_delay);
+	}
+
+	int32 max_gap = 0;
+	uint32 steps = 0;
+	while (steps < max_steps && (sessions[0].frame < NET_GAP_CHECK_FRAMES || sessions[1].frame < NET_GAP_CHECK_FRAMES)) {
+		if (steps == outage_steps) {
+			lossy[0].loss = 0.25f;
+		}
+		for (int32 player = 0; player < NET_MAX_PLAYERS; player++) {
+			// Both keep going until both are done, a finished peer still has to resend what the other lost
+			RollbackSession * session = &sessions[player];
+			int32 frame = session->frame + session->input_delay;
+			NetInput input = { (int8)((frame * 7 + player * 13) % 255 - 127), (int8)((frame * 11) % 255 - 127), (uint8)(frame % 3) };
+			rollbackAddLocalInput(session, input);
+			rollbackAdvance(session);
+			max_gap = MAX(max_gap, session->confirmed_frame[player] - session->remote_ack);
+		}
+		steps++;
+	}
+
+	bool finished = sessions[0].frame >= NET_GAP_CHECK_FRAMES && sessions[1].frame >= NET_GAP_CHECK_FRAMES;
+	int32 mismatched_frames = 0;
+	int32 checked_frames = MIN(sessions[0].confirmed_frame[1], sessions[1].confirmed_frame[0]) + 1;
+	checked_frames = MIN(checked_frames, MIN(sessions[0].frame, sessions[1].frame));
+	for (int32 frame = 0; frame < checked_frames; frame++) {
+		for (int32 player = 0; player < NET_MAX_PLAYERS; player++) {
+			const NetInput * a = &peers[0].log[frame][player];
+			const NetInput * b = &peers[1].log[frame][player];
+			if (a->move_x != b->move_x || a->move_y != b->move_y || a->buttons != b->buttons) {
+				mismatched_frames++;
+				break;
+			}
+		}
+	}
+	bool ok = finished && max_gap > 32 && checked_frames > 0 && mismatched_frames == 0;
+	printf("input delay %d: %d frames max unacknowledged, frames %d and %d after %u steps, %d of %d frames mismatched, %u stalls %s \n",
+		sessions[0].input_delay, max_gap, sessions[0].frame, sessions[1].frame, steps, mismatched_frames, checked_frames,
+		sessions[0].stalled_frames + sessions[1].stalled_frames, ok ? "" : "FAILED");
+	delete[] sessions;
+	delete[] lossy;
+	delete[] peers;
+	delete[] links;
+	return ok;
+}
+
+// Moves a crab with a scripted thrust for three seconds at 30, 60, 144 and 1000 steps per second. The thrust changes
+// every half second, which all four rates land on exactly, and the reference solves each half second in a single step.
+// The integrator is exact, so the rates may only differ by float rounding.
+static bool checkTimestep() {
+	const real32 step_hz[] = { 30, 60, 144, 1000 };
+	const real32 segment_seconds = 0.5f;
+	const Vector2f thrust[] = { { 1, 0 }, { 1, 1 }, { 0, 0 }, { -1, 0 }, { 0, -1 }, { 0, 0 } };
+	// Rounding over 3000 steps stays far below a pixel, a frame rate dependent integrator is off by several
+	const real32 pos_tolerance = 0.05f;
+	const real32 speed_tolerance = 0.05f;
+
+	const Vector2f start_pos = { SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2 };
+	Vector2f reference_pos = start_pos;
+	Vector2f reference_speed = {};
+	for (uint32 s = 0; s < LEN(thrust); s++) {
+		Vector2f direction = thrust[s];
+		integratePlayer(&reference_pos, &reference_speed, direction.getNormalized() * player_acceleration, segment_seconds);
+	}
+	printf("reference: crab at %.03f, %.03f moving %.03f, %.03f \n", reference_pos.x, reference_pos.y, reference_speed.x, reference_speed.y);
+
+	bool ok = true;
+	for (uint32 r = 0; r < LEN(step_hz); r++) {
+		const uint32 steps_per_segment = (uint32)(segment_seconds * step_hz[r] + 0.5f);
+		const real32 step_seconds = 1.0f / step_hz[r];
+		Vector2f pos = start_pos;
+		Vector2f speed = {};
+		for (uint32 s = 0; s < LEN(thrust); s++) {
+			Vector2f direction = thrust[s];
+			const Vector2f acceleration = direction.getNormalized() * player_acceleration;
+			for (uint32 i = 0; i < steps_per_segment; i++) {
+				integratePlayer(&pos, &speed, acceleration, step_seconds);
+			}
+		}
+		const real32 pos_error = MAX(fabsf(pos.x - reference_pos.x), fabsf(pos.y - reference_pos.y));
+		const real32 speed_error = MAX(fabsf(speed.x - reference_speed.x), fabsf(speed.y - reference_speed.y));
+		const bool rate_ok = pos_error <= pos_tolerance && speed_error <= speed_tolerance;
+		ok = ok && rate_ok;
+		printf("%6.0f Hz: crab at %.03f, %.03f moving %.03f, %.03f, off by %.04f px and %.04f px/s %s \n", step_hz[r], pos.x, pos.y,
+			speed.x, speed.y, pos_error, speed_error, rate_ok ? "" : "DIFFERS");
+	}
+	return ok;
+}
 
-		state->shaking_frames++;
+// Enters practice at the first checkpoint with Start held for a second tick, as any real press is, which must not
+// pause the game it just started
+static bool checkPracticeStart() {
+	headless_simulation = true;
+	max_checkpoints = 1;
+	checkpoints = new GameState[max_checkpoints];
+	SDL_AtomicSet(&checkpoint_count, 0);
+	SDL_AtomicSet(&checkpoint_builder_stop, 0);
+	buildCheckpoints(NULL);
+
+	GameState menu_state;
+	state = &menu_state;
+	practice_selection = 0;
+	ControllerInput start_held = {};
+	start_held.button_start = true;
+	update(&start_held, 1.0f / 60);
+	State entered_state = menu_state.current_state;
+	update(&start_held, 1.0f / 60);
+	bool ok = SDL_AtomicGet(&checkpoint_count) == 1 && entered_state == Playing && menu_state.current_state == Playing;
+	printf("practice entered %s, %s with Start still held %s \n", entered_state == Playing ? "playing" : "not playing",
+		menu_state.current_state == Playing ? "still playing" : "not playing", ok ? "" : "FAILED");
+
+	practice_selection = -1;
+	delete[] checkpoints;
+	checkpoints = NULL;
+	state = NULL;
+	headless_simulation = false;
+	return ok;
+}
+
+// Times death shake frames through SDL_RenderPresent, once offsetting every draw by the shake and once drawing the frame
+// to a render target that is copied back offset. Meant for the software renderer -bench-shake creates, add -offscreen
+// for the offscreen path.
+static bool benchmarkShake(SDL_Renderer * renderer) {
+	const uint32 warmup_frames = 30;
+	const uint32 frames = 600;
+	const uint64 perf_frequency = SDL_GetPerformanceFrequency();
+	SDL_RendererInfo info = {};
+	SDL_GetRendererInfo(renderer, &info);
+	SDL_Texture * frozen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+	if (frozen == NULL) {
+		LogError("Could not create the shake render target! SDL_Error: %s\n", SDL_GetError());
+		return false;
+	}
+
+	state->current_state = Shaking;
+	state->shaking_for_dead = true;
+	snapshotTick();
+	const char * path_names[] = { "camera offset", "render target" };
+	real64 frame_ms[LEN(path_names)];
+	for (uint32 path = 0; path < LEN(path_names); path++) {
+		frozen_texture = path == 1 ? frozen : NULL;
+		uint64 start_counter = 0;
+		for (uint32 i = 0; i < warmup_frames + frames; i++) {
+			if (i == warmup_frames) {
+				start_counter = SDL_GetPerformanceCounter();
+			}
+			state->shaking_frames = i % LEN(death_shake_xs);
+			draw(renderer, 1.0f);
+		}
+		frame_ms[path] = (1000.0 * (real64)(SDL_GetPerformanceCounter() - start_counter)) / ((real64)perf_frequency * frames);
+		printf("%s: %.03f ms/frame through present on %s%s \n", path_names[path], frame_ms[path], info.name ? info.name : "?", frame_texture ? " (offscreen)" : "");
+	}
+	frozen_texture = NULL;
+	SDL_DestroyTexture(frozen);
+	printf("render target pass: %+.03f ms/frame \n", frame_ms[1] - frame_ms[0]);
+	return true;
+}
+
+// FC codepoints are a character's UTF-8 bytes packed into an integer, see FC_GetCodepointFromUTF8. Scalar values up to U+FFFF.
+static Uint32 fontCodepoint(uint32 scalar) {
+	char utf8[4] = {};
+	if (scalar < 0x80) {
+		utf8[0] = (char)scalar;
+	}
+	else if (scalar < 0x800) {
+		utf8[0] = (char)(0xc0 | (scalar >> 6));
+		utf8[1] = (char)(0x80 | (scalar & 0x3f));
 	}
 	else {
-		SDL_RenderPresent(renderer);
+		utf8[0] = (char)(0xe0 | (scalar >> 12));
+		utf8[1] = (char)(0x80 | ((scalar >> 6) & 0x3f));
+		utf8[2] = (char)(0x80 | (scalar & 0x3f));
 	}
+	const char * c = utf8;
+	return FC_GetCodepointFromUTF8(&c, 0);
+}
 
+// Times loading both game font sizes in each load mode and looking up glyphs, which every drawn character does once per frame.
+// The lookups cover the HUD strings plus a few non-ASCII glyphs that are cached on first use.
+static bool benchmarkFont(SDL_Renderer * renderer) {
+	const char * font_path = "assets/8bitOperatorPlus-Regular.ttf";
+	const uint32 font_sizes[] = { 28, 96 };
+	const char * load_names[] = { "ASCII", "declared", "on demand", "ASCII from the atlas cache", "ASCII distance field" };
+	const uint32 loads = 10;
+	const uint32 lookups = 10000000;
+	const uint64 perf_frequency = SDL_GetPerformanceFrequency();
+	const char * text = "x 5 Game Over Beware the Orb < Practice: stage 1 phase 1 > \xc3\xa9\xc3\xbc\xc3\xb1\xe2\x82\xac";
+
+	for (uint32 s = 0; s < LEN(font_sizes); s++) {
+		for (uint32 mode = 0; mode < LEN(load_names); mode++) {
+			uint64 start_counter = 0;
+			FC_CacheStats stats = {};
+			for (uint32 i = 0; i <= loads; i++) {
+				// The first load is a warm up, which also writes the atlas file for the cached mode
+				if (i == 1) {
+					start_counter = SDL_GetPerformanceCounter();
+				}
+				FC_Font * bench_font = FC_CreateFont();
+				if (mode == 1) {
+					FC_SetLoadingString(bench_font, large_font_glyphs);
+				}
+				if (mode == 3) {
+					FC_SetAtlasCacheDir(bench_font, font_cache_dir);
+				}
+				FC_SetDistanceField(bench_font, mode == 4);
+				FC_SetLoadMode(bench_font, mode == 2 ? FC_LOAD_ON_DEMAND : FC_LOAD_STRING);
+				if (!FC_LoadFont(bench_font, renderer, font_path, font_sizes[s], FC_MakeColor(255, 255, 255, 255), TTF_STYLE_NORMAL)) {
+					LogError("Could not load %s", font_path);
+					FC_FreeFont(bench_font);
+					return false;
+				}
+				FC_GetCacheStats(bench_font, &stats);
+				FC_FreeFont(bench_font);
+			}
+			real64 load_ms = (1000.0 * (real64)(SDL_GetPerformanceCounter() - start_counter)) / ((real64)perf_frequency * loads);
+			printf("load %3u px, %-26s: %.03f ms, %u KB of glyph textures, %d levels, %.0f%% used\n", font_sizes[s], load_names[mode], load_ms, stats.texture_bytes / 1024, stats.num_levels, 100.0f * stats.utilization);
+		}
+	}
 
-	if (state->current_state != Paused && state->current_state != Shaking) {
-		non_paused_frame_count++;
+	FC_Font * bench_font = FC_CreateFont();
+	FC_LoadFont(bench_font, renderer, font_path, 28, FC_MakeColor(255, 255, 255, 255), TTF_STYLE_NORMAL);
+	Uint32 codepoints[128];
+	uint32 num_codepoints = 0;
+	for (const char * c = text; *c != '\0' && num_codepoints < LEN(codepoints);) {
+		codepoints[num_codepoints++] = FC_GetCodepointFromUTF8(&c, 1);
+		c++;
 	}
+	FC_GlyphData glyph;
+	uint32 found = 0;
+	for (uint32 i = 0; i < num_codepoints; i++) {
+		FC_GetGlyphData(bench_font, &glyph, codepoints[i]);
+	}
+	uint64 start_counter = SDL_GetPerformanceCounter();
+	for (uint32 i = 0; i < lookups; i++) {
+		found += FC_GetGlyphData(bench_font, &glyph, codepoints[i % num_codepoints]);
+	}
+	real64 lookup_ns = (1000000000.0 * (real64)(SDL_GetPerformanceCounter() - start_counter)) / ((real64)perf_frequency * lookups);
+	// Glyphs missing from the font miss on every lookup, which is also a cost worth seeing
+	printf("lookup: %.02f ns, %.01f M/s, %.01f%% hits, %u codepoints cached\n", lookup_ns, 1000.0 / lookup_ns, (100.0 * found) / lookups, FC_GetNumCodepoints(bench_font));
+	FC_FreeFont(bench_font);
+
+	// Cycles through more glyphs than a small budget holds, with ASCII looked up in between as the hot set
+	FC_Font * budget_font = FC_CreateFont();
+	FC_LoadFont(budget_font, renderer, font_path, 28, FC_MakeColor(255, 255, 255, 255), TTF_STYLE_NORMAL);
+	const uint32 budget_bytes = fontCacheBudget(budget_font, 2);
+	FC_SetCacheBudget(budget_font, budget_bytes);
+	start_counter = SDL_GetPerformanceCounter();
+	for (uint32 round = 0; round < 4; round++) {
+		for (uint32 scalar = 0xa0; scalar < 0x250; scalar++) {
+			FC_GetGlyphData(budget_font, &glyph, fontCodepoint(scalar));
+			FC_GetGlyphData(budget_font, &glyph, 'a' + scalar % 26);
+		}
+	}
+	real64 budget_ms = (1000.0 * (real64)(SDL_GetPerformanceCounter() - start_counter)) / (real64)perf_frequency;
+	FC_CacheStats stats;
+	FC_GetCacheStats(budget_font, &stats);
+	printf("budget %u KB: %.03f ms, %u hits, %u misses, %u evictions, %u repacks, %u KB of glyph textures\n", budget_bytes / 1024, budget_ms, stats.hits, stats.misses, stats.evictions, stats.repacks, stats.texture_bytes / 1024);
+	FC_FreeFont(budget_font);
+	return true;
 }
 
+// Times a frame's worth of in-game HUD text drawn with FC_Draw and with retained FC_Text handles.
+// Draw calls are queued by the renderer, so this is the CPU side of the HUD only.
+static bool benchmarkHud(SDL_Renderer * renderer) {
+	const char * font_path = "assets/8bitOperatorPlus-Regular.ttf";
+	const uint32 frames = 6000;
+	const uint32 frames_per_present = 100;
+	const uint64 perf_frequency = SDL_GetPerformanceFrequency();
+	FC_Font * hud_font = FC_CreateFont();
+	FC_Font * hud_large_font = FC_CreateFont();
+	if (!FC_LoadFont(hud_font, renderer, font_path, 28, FC_MakeColor(255, 255, 255, 255), TTF_STYLE_NORMAL) ||
+		!FC_LoadFont(hud_large_font, renderer, font_path, 96, FC_MakeColor(255, 255, 255, 255), TTF_STYLE_NORMAL)) {
+		LogError("Could not load %s", font_path);
+		return false;
+	}
+	FC_Text * hud_lives_texts[MAX_PLAYERS];
+	for (uint32 i = 0; i < MAX_PLAYERS; i++) {
+		hud_lives_texts[i] = FC_CreateText(hud_font);
+	}
+	FC_Text * hud_game_over_text = FC_CreateText(hud_large_font);
+	FC_SetText(hud_game_over_text, "Game Over");
+	FC_Text * hud_enemy_text = FC_CreateText(hud_font);
+
+	real64 frame_us[2];
+	for (uint32 retained = 0; retained < 2; retained++) {
+		uint64 draw_counter = 0;
+		for (uint32 frame = 0; frame < frames; frame++) {
+			// Lives change now and then, like they do in play
+			uint32 lives = 5 - (frame / 1000) % 5;
+			const char * message = enemy_messages[1 + (frame / 2000) % (LEN(enemy_messages) - 1)];
+			uint64 start_counter = SDL_GetPerformanceCounter();
+			for (uint32 i = 0; i < MAX_PLAYERS; i++) {
+				if (retained) {
+					FC_SetText(hud_lives_texts[i], "x %d", lives);
+					FC_DrawText(hud_lives_texts[i], renderer, 60, 15 + i * 36);
+				}
+				else {
+					FC_Draw(hud_font, renderer, 60, 15 + i * 36, "x %d", lives);
+				}
+			}
+			if (retained) {
+				FC_DrawText(hud_game_over_text, renderer, 120, 210);
+				FC_SetText(hud_enemy_text, "%s", message);
+				FC_DrawText(hud_enemy_text, renderer, SCREEN_WIDTH / 2 + 40, 15);
+			}
+			else {
+				FC_Draw(hud_large_font, renderer, 120, 210, "Game Over");
+				FC_Draw(hud_font, renderer, SCREEN_WIDTH / 2 + 40, 15, message);
+			}
+			draw_counter += SDL_GetPerformanceCounter() - start_counter;
+			if ((frame + 1) % frames_per_present == 0) {
+				SDL_RenderPresent(renderer);
+				SDL_RenderClear(renderer);
+			}
+		}
+		frame_us[retained] = (1000000.0 * (real64)draw_counter) / ((real64)perf_frequency * frames);
+	}
+	printf("HUD per frame: FC_Draw %.02f us, FC_Text %.02f us\n", frame_us[0], frame_us[1]);
+
+	for (uint32 i = 0; i < MAX_PLAYERS; i++) {
+		FC_FreeText(hud_lives_texts[i]);
+	}
+	FC_FreeText(hud_game_over_text);
+	FC_FreeText(hud_enemy_text);
+	FC_FreeFont(hud_font);
+	FC_FreeFont(hud_large_font);
+	return true;
+}
+
+#define LAYOUT_BENCH_MAX_THREADS 8
+#define LAYOUT_BENCH_WRAPPED_SIZE 512
+
+static const char * layout_bench_texts[] = {
+	"Crabland belongs \nto ME!",
+	"You can't win against \nmy new weapon!",
+	"Beware the Orb! It bounces off every wall of the arena and speeds up a little with each hit, so stay on the move and keep your paddle between it and your lives.",
+	"Practice: stage 1 phase 1 \xc3\xa9\xc3\xbc\xc3\xb1 x 5 Game Over",
+};
+static const uint16 layout_bench_widths[] = { 120, 240, 480 };
+
+struct LayoutBenchJob {
+	FC_Font * font;
+	uint32 rounds;
+	const char (* expected)[LAYOUT_BENCH_WRAPPED_SIZE]; // wrapped on the main thread, one per text and width
+	uint32 mismatches;
+	SDL_atomic_t * finished;
+};
+
+static int layoutBenchThread(void * data) {
+	LayoutBenchJob * job = (LayoutBenchJob *)data;
+	char wrapped[LAYOUT_BENCH_WRAPPED_SIZE];
+	for (uint32 round = 0; round < job->rounds; round++) {
+		for (uint32 t = 0; t < LEN(layout_bench_texts); t++) {
+			for (uint32 w = 0; w < LEN(layout_bench_widths); w++) {
+				FC_GetWrappedText(job->font, wrapped, sizeof(wrapped), layout_bench_widths[w], "%s", layout_bench_texts[t]);
+				job->mismatches += strcmp(wrapped, job->expected[t * LEN(layout_bench_widths) + w]) != 0;
+			}
+		}
+	}
+	SDL_AtomicIncRef(job->finished);
+	return 0;
+}
+
+// Wraps text into columns on the main thread, then on several threads at once, which only measure the cached glyphs.
+// Meanwhile the main thread draws glyphs the texts don't use, growing the glyph map and repacking it within a one level
+// budget, and keeps the texts' glyphs recently used so they survive. Every thread has to get the main thread's result.
+static bool benchmarkLayout(SDL_Renderer * renderer) {
+	const char * font_path = "assets/8bitOperatorPlus-Regular.ttf";
+	const uint32 rounds = 20000;
+	const uint64 perf_frequency = SDL_GetPerformanceFrequency();
+	FC_Font * layout_font = FC_CreateFont();
+	if (!FC_LoadFont(layout_font, renderer, font_path, 28, FC_MakeColor(255, 255, 255, 255), TTF_STYLE_NORMAL)) {
+		LogError("Could not load %s", font_path);
+		FC_FreeFont(layout_font);
+		return false;
+	}
+
+	const uint32 level_size = FC_GetLineHeight(layout_font) * 12;
+	FC_SetCacheBudget(layout_font, 4 * level_size * level_size);
+
+	// Also caches the non-ASCII glyphs, the threads can't add them
+	static char expected[LEN(layout_bench_texts) * LEN(layout_bench_widths)][LAYOUT_BENCH_WRAPPED_SIZE];
+	for (uint32 t = 0; t < LEN(layout_bench_texts); t++) {
+		for (uint32 w = 0; w < LEN(layout_bench_widths); w++) {
+			FC_GetWrappedText(layout_font, expected[t * LEN(layout_bench_widths) + w], LAYOUT_BENCH_WRAPPED_SIZE, layout_bench_widths[w], "%s", layout_bench_texts[t]);
+		}
+	}
+
+	LayoutBenchJob jobs[LAYOUT_BENCH_MAX_THREADS];
+	SDL_Thread * threads[LAYOUT_BENCH_MAX_THREADS];
+	uint32 num_threads = MIN(MAX(SDL_GetCPUCount(), 2), LAYOUT_BENCH_MAX_THREADS);
+	real64 layout_ns[2];
+	uint32 mismatches = 0;
+	uint32 drawn_glyphs = 0;
+	for (uint32 threaded = 0; threaded < 2; threaded++) {
+		uint32 started = threaded ? num_threads : 1;
+		SDL_atomic_t finished;
+		SDL_AtomicSet(&finished, 0);
+		for (uint32 i = 0; i < started; i++) {
+			jobs[i] = { layout_font, rounds, expected, 0, &finished };
+		}
+		uint64 start_counter = SDL_GetPerformanceCounter();
+		if (threaded) {
+			for (uint32 i = 0; i < started; i++) {
+				threads[i] = SDL_CreateThread(layoutBenchThread, "Layout", &jobs[i]);
+				if (threads[i] == NULL) {
+					LogError("Could not start a layout thread! SDL_Error: %s\n", SDL_GetError());
+					started = i;
+					break;
+				}
+			}
+			// Two byte UTF-8 from U+0100 on, none of which the texts use
+			for (uint32 scalar = 0x100; SDL_AtomicGet(&finished) < (int32)started; scalar = scalar < 0x7ff ? scalar + 1 : 0x100) {
+				for (uint32 t = 0; t < LEN(layout_bench_texts); t++) {
+					FC_GetWidth(layout_font, "%s", layout_bench_texts[t]);
+				}
+				char glyph[3] = { (char)(0xc0 | (scalar >> 6)), (char)(0x80 | (scalar & 0x3f)), '\0' };
+				FC_Draw(layout_font, renderer, 0, 0, "%s", glyph);
+				drawn_glyphs++;
+			}
+			for (uint32 i = 0; i < started; i++) {
+				SDL_WaitThread(threads[i], NULL);
+			}
+		}
+		else {
+			layoutBenchThread(&jobs[0]);
+		}
+		uint64 layouts = (uint64)started * rounds * LEN(layout_bench_texts) * LEN(layout_bench_widths);
+		layout_ns[threaded] = (1000000000.0 * (real64)(SDL_GetPerformanceCounter() - start_counter)) / ((real64)perf_frequency * MAX(layouts, 1));
+		for (uint32 i = 0; i < started; i++) {
+			mismatches += jobs[i].mismatches;
+		}
+	}
+	FC_CacheStats stats;
+	FC_GetCacheStats(layout_font, &stats);
+	printf("wrapped layout: %.0f ns on the main thread, %.0f ns per layout over %u threads while drawing %u glyphs with %u repacks, %u mismatches\n",
+		layout_ns[0], layout_ns[1], num_threads, drawn_glyphs, stats.repacks, mismatches);
+	FC_FreeFont(layout_font);
+	return mismatches == 0 && stats.repacks > 0;
+}
+
+int main(int argc, char** argv) {
+	// -offscreen[=WxH]: render at WxH (720x720 by default) and upscale once at present
+	// -integer-scale: nearest neighbour integer upscale of the offscreen frame
+	// -window=WxH: force the window size, e.g. to compare fill cost at 1920x1080, 2560x1440 and 3840x2160
+	// -bench-ball: print the cost of a ball physics tick at extreme speeds and exit
+	// -show-ball-path: draw where the ball will bounce during the next second
+	// -versus=1|2: two player versus as player 1 or 2, run a second instance with the other number to play over loopback
+	// -port=N, -peer=host:port: local UDP port and peer address, 7000 and 7001 on 127.0.0.1 by default
+	// -input-delay=frames: local input delay, trading latency for fewer rollbacks (2 by default)
+	// -net-delay=ms, -net-jitter=ms, -net-loss=percent: simulate a bad connection on outgoing packets
+	// -bench-rollback: print the cost of re-simulating 8 frames and exit
+	// -check-timestep: step the player motion at 30, 60, 144 and 1000 Hz and exit, failing unless all follow the same trajectory
+	// -check-practice: enter practice with Start held for two ticks and exit, failing if it pauses
+	// -check-net-gap: run two versus sessions over a link that loses a peer's packets for seconds and exit, failing if they stall or disagree
+	// -shake-render-target: shake the screen by drawing the frame to a texture and copying it back offset
+	// -bench-shake: print the cost of a shaking frame through present on the software renderer with and without the render target and exit
+	// -bench-font: print the font load time and texture memory of each load mode and the glyph lookup throughput and exit
+	// -bench-hud: print the CPU cost of drawing the HUD text with FC_Draw and with FC_Text and exit
+	// -bench-layout: print the cost of wrapping text on one and on several threads and exit, failing if they disagree
+	int32 forced_window_width = 0;
+	int32 forced_window_height = 0;
+	bool bench_shake = false;
+	bool bench_font = false;
+	bool bench_hud = false;
+	bool bench_layout = false;
+	for (int32 i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-offscreen") {
+			render_settings.offscreen = true;
+		}
+		else if (arg.compare(0, 11, "-offscreen=") == 0) {
+			render_settings.offscreen = parseSize(arg.c_str() + 11, &render_settings.offscreen_width, &render_settings.offscreen_height);
+		}
+		else if (arg == "-integer-scale") {
+			render_settings.integer_scale = true;
+		}
+		else if (arg.compare(0, 8, "-window=") == 0) {
+			parseSize(arg.c_str() + 8, &forced_window_width, &forced_window_height);
+		}
+		else if (arg == "-show-ball-path") {
+			show_ball_path = true;
+		}
+		else if (arg == "-bench-ball") {
+			return benchmarkBallPath() ? 0 : 1;
+		}
+		else if (arg == "-bench-rollback") {
+			return benchmarkRollback() ? 0 : 1;
+		}
+		else if (arg == "-check-timestep") {
+			return checkTimestep() ? 0 : 1;
+		}
+		else if (arg == "-check-practice") {
+			return checkPracticeStart() ? 0 : 1;
+		}
+		else if (arg == "-check-net-gap") {
+			return checkRollbackGap() ? 0 : 1;
+		}
+		else if (arg == "-shake-render-target") {
+			render_settings.shake_with_render_target = true;
+		}
+		else if (arg == "-bench-shake") {
+			bench_shake = true;
+		}
+		else if (arg == "-bench-font") {
+			bench_font = true;
+		}
+		else if (arg == "-bench-hud") {
+			bench_hud = true;
+		}
+		else if (arg == "-bench-layout") {
+			bench_layout = true;
+		}
+		else if (arg.compare(0, 8, "-versus=") == 0) {
+			versus_settings.local_player = MIN(MAX(atoi(arg.c_str() + 8), 1), NET_MAX_PLAYERS) - 1;
+		}
+		else if (arg.compare(0, 6, "-port=") == 0) {
+			versus_settings.local_port = (uint16)atoi(arg.c_str() + 6);
+		}
+		else if (arg.compare(0, 6, "-peer=") == 0) {
+			size_t colon = arg.rfind(':');
+			if (colon != std::string::npos && colon > 6) {
+				versus_settings.peer_host = arg.substr(6, colon - 6);
+				versus_settings.peer_port = (uint16)atoi(arg.c_str() + colon + 1);
+			}
+			else {
+				versus_settings.peer_host = arg.substr(6);
+			}
+		}
+		else if (arg.compare(0, 13, "-input-delay=") == 0) {
+			versus_settings.input_delay = atoi(arg.c_str() + 13);
+		}
+		else if (arg.compare(0, 11, "-net-delay=") == 0) {
+			versus_settings.delay_ms = atoi(arg.c_str() + 11);
+		}
+		else if (arg.compare(0, 12, "-net-jitter=") == 0) {
+			versus_settings.jitter_ms = atoi(arg.c_str() + 12);
+		}
+		else if (arg.compare(0, 10, "-net-loss=") == 0) {
+			versus_settings.loss = (real32)atof(arg.c_str() + 10) / 100.f;
+		}
+	}
 
-int main(int, char**) {
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0) {
 		std::cout << "SDL_Init Error: " << SDL_GetError() << std::endl;
 		return 1;
@@ -1261,6 +3160,11 @@ int main(int, char**) {
 	SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN);
 #endif
 
+	if (forced_window_width > 0) {
+		screen_physical_width = forced_window_width;
+		screen_physical_height = forced_window_height;
+	}
+
 	window = SDL_CreateWindow("Game", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, screen_physical_width, screen_physical_height, window_properties);
 	if (!window) {
 		LogError("Window could not be created! SDL_Error: %s\n", SDL_GetError());
@@ -1268,9 +3172,19 @@ int main(int, char**) {
 	}
 	LogInfo("Window is created");
 
-	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+	renderer = SDL_CreateRenderer(window, -1, bench_shake ? SDL_RENDERER_SOFTWARE : SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+	if (bench_font) {
+		return benchmarkFont(renderer) ? 0 : 1;
+	}
+	if (bench_hud) {
+		return benchmarkHud(renderer) ? 0 : 1;
+	}
+	if (bench_layout) {
+		return benchmarkLayout(renderer) ? 0 : 1;
+	}
 
 	/* Opening gamepads */
+	gamepadsStart();
 	SDLInitGamepads();
 
 	/* Initialize SDL_image and SDL_mixer */
@@ -1286,31 +3200,44 @@ int main(int, char**) {
 
 	SDL_ShowCursor(SDL_DISABLE);
 
+	// The simulation always ticks at game_update_hz, frames are rendered at the display refresh rate
 	real32 game_update_hz = 60;
-	real32 target_seconds_per_frame = 1.0f / game_update_hz;
+	real32 seconds_per_tick = 1.0f / game_update_hz;
+	real32 render_hz = game_update_hz;
+	SDL_DisplayMode window_display_mode;
+	if (SDL_GetWindowDisplayMode(window, &window_display_mode) == 0 && window_display_mode.refresh_rate > 0) {
+		render_hz = (real32)window_display_mode.refresh_rate;
+	}
+	real32 target_seconds_per_frame = 1.0f / render_hz;
 	uint64 perf_frequency = SDL_GetPerformanceFrequency();
-	
-	ControllerInput controller = {};
+	LogInfo("Updating at %.0f Hz, rendering at %.0f Hz", game_update_hz, render_hz);
+
+	ControllerInput controllers[MAX_CONTROLLERS] = {};
 	uint64 last_counter = SDL_GetPerformanceCounter();
 	uint64 update_counter = last_counter;
+	TickClock tick_clock = { seconds_per_tick, 0, (real64)SDL_GetTicks() };
 
 	state = new GameState;
 
 	initialize(state, renderer);
+	if (bench_shake) {
+		return benchmarkShake(renderer) ? 0 : 1;
+	}
+	if (versus_settings.local_player >= 0) {
+		state->num_players = 2;
+		if (!startVersus()) {
+			return 1;
+		}
+	}
+	else {
+		startCheckpointBuilder();
+	}
+	snapshotTick();
 
 	/* Main loop */
 	while (1) {
-		handleEvents(controller);
-		/*if (controller.button_select) {
-			closing = true;
-		}*/
-
-		uint64 new_update_counter = SDL_GetPerformanceCounter();
-		real32 time_delta = SDLGetSecondsElapsed(update_counter, new_update_counter, perf_frequency);
-		update_counter = new_update_counter;
-
-		updateAndDraw(screen_surface, renderer, window, &controller, time_delta);
-
+		// Wait out the frame before sampling input rather than after it, so the newest events
+		// go straight into the next tick and present instead of aging through a sleep
 		real32 seconds_elapsed = SDLGetSecondsElapsed(last_counter, SDL_GetPerformanceCounter(), perf_frequency);
 		if (seconds_elapsed < target_seconds_per_frame)
 		{
@@ -1334,15 +3261,86 @@ int main(int, char**) {
 			real64 ms_per_frame = (((1000.0f * (real64)counter_elapsed) / (real64)perf_frequency));
 			real64 fps = (real64)perf_frequency / (real64)counter_elapsed;
 			printf("%.02f ms/f, %.02f f/s \n", ms_per_frame, fps);
+			if (profile.frames > 0) {
+				real64 work_ms = (1000.0 * (real64)profile.frame_counter) / ((real64)perf_frequency * profile.frames);
+				printf("%.03f ms/f update+draw+present at %dx%d%s, %.02f ticks/f \n", work_ms, screen_physical_width, screen_physical_height, frame_texture ? " (offscreen)" : "", (real64)profile.ticks / profile.frames);
+			}
+			if (profile.input_latency_count > 0) {
+				printf("%u/%.01f/%u ms min/avg/max input to present (%u changes) \n", profile.input_latency_min, (real64)profile.input_latency_sum / profile.input_latency_count, profile.input_latency_max, profile.input_latency_count);
+			}
+			if (profile.ball_steps > 0) {
+				real64 ball_us = (1000000.0 * (real64)profile.ball_counter) / ((real64)perf_frequency * profile.ball_steps);
+				printf("%.03f us/ball step, %.02f avg %u max path segments \n", ball_us, (real64)profile.ball_segments / profile.ball_steps, profile.ball_segments_max);
+			}
+			if (profile.rewind_frames > 0) {
+				real64 rewind_us = (1000000.0 * (real64)profile.rewind_counter) / ((real64)perf_frequency * profile.rewind_frames);
+				printf("%.03f us/rewind record, %.01f bytes/frame, %.01f s buffered \n", rewind_us, (real64)profile.rewind_bytes / profile.rewind_frames, rewind_records / game_update_hz);
+			}
+			if (gamepadCount() > 0) {
+				uint32 gamepad_polls, gamepad_max_gap_us;
+				gamepadPollStats(&gamepad_polls, &gamepad_max_gap_us);
+				printf("%u gamepad polls, %.02f ms max gap \n", gamepad_polls, gamepad_max_gap_us / 1000.0);
+			}
+			if (profile.rollback_ticks > 0) {
+				real64 rollback_us = (1000000.0 * (real64)profile.rollback_counter) / ((real64)perf_frequency * profile.rollback_ticks);
+				printf("%.03f us/versus tick, %u max frames re-simulated, %u rollbacks %u stalls in total \n", rollback_us, profile.rollback_frames_max, rollback_session.rollbacks, rollback_session.stalled_frames);
+			}
+			profile = {};
 		}
 #endif
 		last_counter = end_counter;
 
+		handleEvents(controllers);
+		// One crab per connected gamepad, the count is picked up while on the main menu
+		if (versus_settings.local_player < 0 && state->current_state == MainMenu) {
+			state->num_players = MAX(gamepadCount(), 1);
+		}
+
+		uint64 new_update_counter = SDL_GetPerformanceCounter();
+		real32 time_delta = SDLGetSecondsElapsed(update_counter, new_update_counter, perf_frequency);
+		update_counter = new_update_counter;
+		int32 tick_count = tickClockAdvance(&tick_clock, time_delta, SDL_GetTicks());
+
+#ifdef DEBUG
+		uint64 frame_start_counter = SDL_GetPerformanceCounter();
+#endif
+		for (int32 tick = 0; tick < tick_count; tick++) {
+			tickClockRun(&tick_clock, controllers);
+#ifdef DEBUG
+			profile.ticks++;
+#endif
+		}
+		draw(renderer, tick_clock.accumulator / seconds_per_tick);
+		// An input is presented by the first draw after a tick applied it, a frame without ticks still shows the old state
+		bool inputs_applied = tick_count > 0;
+#ifdef DEBUG
+		profile.frame_counter += SDL_GetPerformanceCounter() - frame_start_counter;
+		profile.frames++;
+		for (int32 i = 0; i < MAX_CONTROLLERS; i++) {
+			if (inputs_applied && controllers[i].unpresented_change_timestamp != 0 && controllers[i].unpresented_change_timestamp <= tick_clock.input_ms) {
+				uint32 latency = SDL_GetTicks() - controllers[i].unpresented_change_timestamp;
+				if (profile.input_latency_count == 0 || latency < profile.input_latency_min) {
+					profile.input_latency_min = latency;
+				}
+				profile.input_latency_max = MAX(profile.input_latency_max, latency);
+				profile.input_latency_sum += latency;
+				profile.input_latency_count++;
+			}
+		}
+#endif
+		for (int32 i = 0; i < MAX_CONTROLLERS; i++) {
+			if (inputs_applied && controllers[i].unpresented_change_timestamp <= tick_clock.input_ms) {
+				controllers[i].unpresented_change_timestamp = 0;
+			}
+		}
 
 		if (closing) {
 			break;
 		}
 		frame_count++;
 	}
+	stopCheckpointBuilder();
+	stopVersus();
+	gamepadsStop();
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "gamepad.h"
+
+static GamepadSlot slots[MAX_CONTROLLERS];
+static SDL_mutex * slots_mutex = NULL; // held by the polling thread while it reads the handles
+static SDL_Thread * poll_thread = NULL;
+static SDL_atomic_t poll_stop;
+#ifdef DEBUG
+static SDL_atomic_t stat_polls;
+static SDL_atomic_t stat_max_gap_us;
+#endif
+
+
+static bool queuePush(GamepadQueue * queue, const GamepadSnapshot * snapshot) {
+	uint32 write = (uint32)SDL_AtomicGet(&queue->write);
+	if (write - (uint32)SDL_AtomicGet(&queue->read) >= GAMEPAD_QUEUE_SIZE) {
+		return false;
+	}
+	queue->items[write & (GAMEPAD_QUEUE_SIZE - 1)] = *snapshot;
+	// SDL atomics are full barriers, so the item is visible before the new write index
+	SDL_AtomicSet(&queue->write, (int)(write + 1));
+	return true;
+}
+
+static bool queuePop(GamepadQueue * queue, GamepadSnapshot * snapshot) {
+	uint32 read = (uint32)SDL_AtomicGet(&queue->read);
+	if (read == (uint32)SDL_AtomicGet(&queue->write)) {
+		return false;
+	}
+	*snapshot = queue->items[read & (GAMEPAD_QUEUE_SIZE - 1)];
+	SDL_AtomicSet(&queue->read, (int)(read + 1));
+	return true;
+}
+
+static GamepadSnapshot readSnapshot(SDL_GameController * handle, uint32 timestamp) {
+	GamepadSnapshot snapshot;
+	snapshot.timestamp = timestamp;
+	snapshot.left_x = SDL_GameControllerGetAxis(handle, SDL_CONTROLLER_AXIS_LEFTX);
+	snapshot.left_y = SDL_GameControllerGetAxis(handle, SDL_CONTROLLER_AXIS_LEFTY);
+	snapshot.buttons = 0;
+	for (int32 button = 0; button < SDL_CONTROLLER_BUTTON_MAX; button++) {
+		if (SDL_GameControllerGetButton(handle, (SDL_GameControllerButton)button)) {
+			snapshot.buttons |= 1 << button;
+		}
+	}
+	return snapshot;
+}
+
+static int pollGamepads(void * data) {
+	(void)data;
+	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+#ifdef DEBUG
+	const uint64 perf_frequency = SDL_GetPerformanceFrequency();
+	uint64 last_poll_counter = SDL_GetPerformanceCounter();
+#endif
+	while (!SDL_AtomicGet(&poll_stop)) {
+		SDL_LockMutex(slots_mutex);
+		SDL_LockJoysticks();
+		SDL_GameControllerUpdate();
+		uint32 timestamp = SDL_GetTicks();
+		for (int32 i = 0; i < MAX_CONTROLLERS; i++) {
+			GamepadSlot * slot = &slots[i];
+			if (slot->handle == NULL) {
+				continue;
+			}
+			GamepadSnapshot snapshot = readSnapshot(slot->handle, timestamp);
+			// Only changes are queued. When the queue is full the change is retried on the next poll.
+			bool changed = snapshot.left_x != slot->published.left_x || snapshot.left_y != slot->published.left_y || snapshot.buttons != slot->published.buttons;
+			if (changed && queuePush(&slot->queue, &snapshot)) {
+				slot->published = snapshot;
+			}
+		}
+		SDL_UnlockJoysticks();
+		SDL_UnlockMutex(slots_mutex);
+
+#ifdef DEBUG
+		uint64 poll_counter = SDL_GetPerformanceCounter();
+		int32 gap_us = (int32)((1000000 * (poll_counter - last_poll_counter)) / perf_frequency);
+		last_poll_counter = poll_counter;
+		SDL_AtomicAdd(&stat_polls, 1);
+		if (gap_us > SDL_AtomicGet(&stat_max_gap_us)) {
+			SDL_AtomicSet(&stat_max_gap_us, gap_us);
+		}
+#endif
+		// SDL asks for a 1 ms timer resolution, which is as fine as a sleep gets
+		SDL_Delay(1000 / GAMEPAD_POLL_HZ);
+	}
+	return 0;
+}
+
+void gamepadsStart() {
+	slots_mutex = SDL_CreateMutex();
+	// The polling thread owns the controller state, the events would only duplicate it
+	SDL_EventState(SDL_CONTROLLERAXISMOTION, SDL_IGNORE);
+	SDL_EventState(SDL_CONTROLLERBUTTONDOWN, SDL_IGNORE);
+	SDL_EventState(SDL_CONTROLLERBUTTONUP, SDL_IGNORE);
+	SDL_AtomicSet(&poll_stop, 0);
+	poll_thread = SDL_CreateThread(pollGamepads, "Gamepads", NULL);
+	if (poll_thread == NULL) {
+		LogError("Could not start the gamepad thread! SDL_Error: %s\n", SDL_GetError());
+	}
+}
+
+void gamepadsStop() {
+	if (poll_thread != NULL) {
+		SDL_AtomicSet(&poll_stop, 1);
+		SDL_WaitThread(poll_thread, NULL);
+		poll_thread = NULL;
+	}
+	for (int32 i = 0; i < MAX_CONTROLLERS; i++) {
+		if (slots[i].handle != NULL) {
+			SDL_GameControllerClose(slots[i].handle);
+			slots[i].handle = NULL;
+		}
+	}
+	SDL_DestroyMutex(slots_mutex);
+	slots_mutex = NULL;
+}
+
+int32 gamepadSlot(SDL_JoystickID instance_id) {
+	for (int32 i = 0; i < MAX_CONTROLLERS; i++) {
+		if (slots[i].handle != NULL && slots[i].instance_id == instance_id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int32 gamepadAdd(int32 device_index) {
+	if (!SDL_IsGameController(device_index)) {
+		return -1;
+	}
+	SDL_GameController * handle = SDL_GameControllerOpen(device_index);
+	if (handle == NULL) {
+		LogWarn("Could not open controller %d: %s", device_index, SDL_GetError());
+		return -1;
+	}
+	SDL_JoystickID instance_id = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(handle));
+	int32 slot = gamepadSlot(instance_id);
+	if (slot >= 0) {
+		// Already open, drop the extra reference
+		SDL_GameControllerClose(handle);
+		return slot;
+	}
+
+	SDL_LockMutex(slots_mutex);
+	for (int32 i = 0; i < MAX_CONTROLLERS; i++) {
+		if (slots[i].handle == NULL) {
+			slot = i;
+			break;
+		}
+	}
+	if (slot >= 0) {
+		slots[slot].handle = handle;
+		slots[slot].instance_id = instance_id;
+		slots[slot].published = {};
+		SDL_AtomicSet(&slots[slot].queue.read, 0);
+		SDL_AtomicSet(&slots[slot].queue.write, 0);
+	}
+	SDL_UnlockMutex(slots_mutex);
+
+	if (slot < 0) {
+		LogWarn("Ignoring controller %d, all %d players have one", device_index, MAX_CONTROLLERS);
+		SDL_GameControllerClose(handle);
+		return -1;
+	}
+	char * mapping = SDL_GameControllerMapping(handle);
+	SDL_Log("Controller %i is mapped as \"%s\", player %d.", device_index, mapping, slot + 1);
+	SDL_free(mapping);
+	return slot;
+}
+
+void gamepadRemove(SDL_JoystickID instance_id) {
+	int32 slot = gamepadSlot(instance_id);
+	if (slot < 0) {
+		return;
+	}
+	SDL_LockMutex(slots_mutex);
+	SDL_GameControllerClose(slots[slot].handle);
+	slots[slot].handle = NULL;
+	// Snapshots still queued belong to the removed controller
+	SDL_AtomicSet(&slots[slot].queue.read, SDL_AtomicGet(&slots[slot].queue.write));
+	SDL_UnlockMutex(slots_mutex);
+}
+
+uint32 gamepadCount() {
+	uint32 count = 0;
+	for (int32 i = 0; i < MAX_CONTROLLERS; i++) {
+		count += slots[i].handle != NULL;
+	}
+	return count;
+}
+
+bool gamepadPop(int32 slot, GamepadSnapshot * snapshot) {
+	return queuePop(&slots[slot].queue, snapshot);
+}
+
+#ifdef DEBUG
+void gamepadPollStats(uint32 * polls, uint32 * max_gap_us) {
+	*polls = (uint32)SDL_AtomicSet(&stat_polls, 0);
+	*max_gap_us = (uint32)SDL_AtomicSet(&stat_max_gap_us, 0);
+}
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <SDL.h>
+#include "definitions.h"
+
+// Snapshots per controller waiting for the main thread, must be a power of two
+#define GAMEPAD_QUEUE_SIZE 256
+#define GAMEPAD_POLL_HZ 1000
+
+// The state of one controller at one point in time
+struct GamepadSnapshot {
+	uint32 timestamp; // SDL_GetTicks() when it was polled
+	int16 left_x;
+	int16 left_y;
+	uint16 buttons; // bit n is SDL_GameControllerButton n
+};
+
+// Single producer (polling thread), single consumer (main thread) ring
+struct GamepadQueue {
+	SDL_atomic_t read;
+	SDL_atomic_t write;
+	GamepadSnapshot items[GAMEPAD_QUEUE_SIZE];
+};
+
+// One opened controller. The slot index is the player it's bound to.
+struct GamepadSlot {
+	SDL_GameController * handle; // NULL when the slot is free
+	SDL_JoystickID instance_id;
+	GamepadSnapshot published; // last snapshot pushed to the queue
+	GamepadQueue queue;
+};
+
+// Polls every open controller at GAMEPAD_POLL_HZ on its own thread, independently of the render frame.
+// Controllers are added and removed from the main thread, in response to the SDL device events.
+void gamepadsStart();
+void gamepadsStop();
+// Opens a joystick device index and returns its slot, or -1. Adding an open device returns its slot.
+int32 gamepadAdd(int32 device_index);
+void gamepadRemove(SDL_JoystickID instance_id);
+int32 gamepadSlot(SDL_JoystickID instance_id);
+uint32 gamepadCount();
+// Pops the oldest snapshot of a slot, main thread only
+bool gamepadPop(int32 slot, GamepadSnapshot * snapshot);
+
+#ifdef DEBUG
+// Polls done and the longest gap between two polls since the last call
+void gamepadPollStats(uint32 * polls, uint32 * max_gap_us);
+#endif
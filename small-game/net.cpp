@@ -0,0 +1,329 @@
+#include "net.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET NetSocket;
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+typedef int NetSocket;
+#define INVALID_SOCKET -1
+#define closesocket close
+#endif
+
+#define NET_PACKET_MAGIC 0x4e42524f // "ORBN"
+
+bool netStartup() {
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		LogError("WSAStartup failed");
+		return false;
+	}
+#endif
+	return true;
+}
+
+void netShutdown() {
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+
+// UDP
+
+struct UdpContext {
+	NetSocket socket;
+	sockaddr_in remote;
+};
+
+static bool udpSend(void * context, const uint8 * data, uint32 size) {
+	UdpContext * udp = (UdpContext *)context;
+	return sendto(udp->socket, (const char *)data, size, 0, (const sockaddr *)&udp->remote, sizeof(udp->remote)) == (int)size;
+}
+
+static int32 udpReceive(void * context, uint8 * data, uint32 capacity) {
+	UdpContext * udp = (UdpContext *)context;
+	sockaddr_in from;
+	socklen_t from_size = sizeof(from);
+	int result = recvfrom(udp->socket, (char *)data, capacity, 0, (sockaddr *)&from, &from_size);
+	if (result <= 0) {
+		return 0;
+	}
+	if (from.sin_addr.s_addr != udp->remote.sin_addr.s_addr || from.sin_port != udp->remote.sin_port) {
+		return 0;
+	}
+	return result;
+}
+
+bool udpTransportOpen(NetTransport * transport, uint16 local_port, const char * remote_host, uint16 remote_port) {
+	UdpContext * udp = new UdpContext;
+	udp->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (udp->socket == INVALID_SOCKET) {
+		LogError("Could not create a UDP socket");
+		delete udp;
+		return false;
+	}
+
+	sockaddr_in local = {};
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	local.sin_port = htons(local_port);
+	if (bind(udp->socket, (const sockaddr *)&local, sizeof(local)) != 0) {
+		LogError("Could not bind UDP port %u", local_port);
+		closesocket(udp->socket);
+		delete udp;
+		return false;
+	}
+
+#ifdef _WIN32
+	u_long non_blocking = 1;
+	ioctlsocket(udp->socket, FIONBIO, &non_blocking);
+#else
+	fcntl(udp->socket, F_SETFL, fcntl(udp->socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	addrinfo * address = NULL;
+	if (getaddrinfo(remote_host, NULL, &hints, &address) != 0 || address == NULL) {
+		LogError("Could not resolve %s", remote_host);
+		closesocket(udp->socket);
+		delete udp;
+		return false;
+	}
+	udp->remote = *(const sockaddr_in *)address->ai_addr;
+	udp->remote.sin_port = htons(remote_port);
+	freeaddrinfo(address);
+
+	transport->context = udp;
+	transport->send = udpSend;
+	transport->receive = udpReceive;
+	return true;
+}
+
+void udpTransportClose(NetTransport * transport) {
+	UdpContext * udp = (UdpContext *)transport->context;
+	if (udp != NULL) {
+		closesocket(udp->socket);
+		delete udp;
+		transport->context = NULL;
+	}
+}
+
+
+// Lossy decorator
+
+static uint32 lossyRandom(LossyTransport * lossy) {
+	// xorshift32
+	uint32 x = lossy->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	lossy->rng = x;
+	return x;
+}
+
+static bool lossySend(void * context, const uint8 * data, uint32 size) {
+	LossyTransport * lossy = (LossyTransport *)context;
+	if ((lossyRandom(lossy) % 10000) < (uint32)(lossy->loss * 10000)) {
+		return true;
+	}
+	if (lossy->num_pending >= LOSSY_MAX_PENDING || size > NET_MAX_PACKET) {
+		return false;
+	}
+	LossyPacket * packet = &lossy->pending[lossy->num_pending++];
+	packet->deliver_at = SDL_GetTicks() + lossy->delay_ms + (lossy->jitter_ms > 0 ? lossyRandom(lossy) % lossy->jitter_ms : 0);
+	packet->size = size;
+	memcpy(packet->data, data, size);
+	return true;
+}
+
+static int32 lossyReceive(void * context, uint8 * data, uint32 capacity) {
+	LossyTransport * lossy = (LossyTransport *)context;
+	uint32 now = SDL_GetTicks();
+	for (uint32 i = 0; i < lossy->num_pending;) {
+		LossyPacket * packet = &lossy->pending[i];
+		if ((int32)(now - packet->deliver_at) >= 0) {
+			lossy->inner->send(lossy->inner->context, packet->data, packet->size);
+			lossy->pending[i] = lossy->pending[--lossy->num_pending];
+		}
+		else {
+			i++;
+		}
+	}
+	return lossy->inner->receive(lossy->inner->context, data, capacity);
+}
+
+void lossyTransportWrap(NetTransport * transport, LossyTransport * lossy, NetTransport * inner, real32 loss, uint32 delay_ms, uint32 jitter_ms) {
+	lossy->inner = inner;
+	lossy->loss = loss;
+	lossy->delay_ms = delay_ms;
+	lossy->jitter_ms = jitter_ms;
+	lossy->rng = 0x9e3779b9;
+	lossy->num_pending = 0;
+	transport->context = lossy;
+	transport->send = lossySend;
+	transport->receive = lossyReceive;
+}
+
+
+// Rollback
+
+// Packet: header, then the sender's inputs for frames [start_frame, start_frame + num_inputs)
+struct NetPacketHeader {
+	uint32 magic;
+	int32 ack_frame; // newest frame of the receiver's input the sender has
+	int32 start_frame;
+	uint32 num_inputs;
+};
+
+// A packet carries every input the remote has not acknowledged, which rollbackStart keeps within the input history
+static_assert(sizeof(NetPacketHeader) + NET_INPUT_HISTORY * sizeof(NetInput) <= NET_MAX_PACKET, "a full input history must fit in one packet");
+
+static inline NetInput * inputAt(RollbackSession * session, int32 player, int32 frame) {
+	return &session->inputs[player][frame & (NET_INPUT_HISTORY - 1)];
+}
+
+static inline bool sameInput(const NetInput * a, const NetInput * b) {
+	return a->move_x == b->move_x && a->move_y == b->move_y && a->buttons == b->buttons;
+}
+
+void rollbackStart(RollbackSession * session, NetTransport * transport, const RollbackCallbacks * callbacks, int32 local_player, int32 input_delay) {
+	*session = {};
+	session->transport = transport;
+	session->callbacks = *callbacks;
+	session->local_player = local_player;
+	// Each peer can run a delay plus ROLLBACK_MAX_FRAMES + 1 ahead of what it has from the other, so up to twice
+	// that goes unacknowledged, and all of it has to stay in the history to be resent
+	session->input_delay = MIN(MAX(input_delay, 0), (NET_INPUT_HISTORY - 2 * (ROLLBACK_MAX_FRAMES + 1)) / 2);
+	session->rollback_frame = -1;
+	session->remote_ack = -1;
+	// Both peers know the delayed frames at the start are empty
+	for (int32 player = 0; player < NET_MAX_PLAYERS; player++) {
+		session->confirmed_frame[player] = session->input_delay - 1;
+	}
+}
+
+void rollbackAddLocalInput(RollbackSession * session, NetInput input) {
+	int32 frame = session->frame + session->input_delay;
+	int32 local = session->local_player;
+	if (frame <= session->confirmed_frame[local]) {
+		return;
+	}
+	*inputAt(session, local, frame) = input;
+	session->confirmed_frame[local] = frame;
+}
+
+static void rollbackSendInputs(RollbackSession * session) {
+	int32 local = session->local_player;
+	int32 remote = 1 - local;
+	NetPacketHeader header;
+	header.magic = NET_PACKET_MAGIC;
+	header.ack_frame = session->confirmed_frame[remote];
+	// Resend from the oldest unacknowledged input, the remote only accepts them in order
+	header.start_frame = MAX(session->remote_ack + 1, session->confirmed_frame[local] - NET_INPUT_HISTORY + 1);
+	header.start_frame = MAX(header.start_frame, 0);
+	header.num_inputs = MAX(session->confirmed_frame[local] - header.start_frame + 1, 0);
+
+	uint8 packet[NET_MAX_PACKET];
+	memcpy(packet, &header, sizeof(header));
+	uint32 size = sizeof(header);
+	for (uint32 i = 0; i < header.num_inputs; i++) {
+		memcpy(packet + size, inputAt(session, local, header.start_frame + i), sizeof(NetInput));
+		size += sizeof(NetInput);
+	}
+	session->transport->send(session->transport->context, packet, size);
+}
+
+static void rollbackReceiveInputs(RollbackSession * session) {
+	int32 remote = 1 - session->local_player;
+	uint8 packet[NET_MAX_PACKET];
+	int32 size;
+	while ((size = session->transport->receive(session->transport->context, packet, sizeof(packet))) > 0) {
+		NetPacketHeader header;
+		if (size < (int32)sizeof(header)) {
+			continue;
+		}
+		memcpy(&header, packet, sizeof(header));
+		if (header.magic != NET_PACKET_MAGIC || size < (int32)(sizeof(header) + header.num_inputs * sizeof(NetInput))) {
+			continue;
+		}
+		session->remote_ack = MAX(session->remote_ack, header.ack_frame);
+
+		// Inputs are applied strictly in order, anything after a gap arrives again in a later packet
+		for (uint32 i = 0; i < header.num_inputs; i++) {
+			int32 frame = header.start_frame + i;
+			if (frame != session->confirmed_frame[remote] + 1) {
+				continue;
+			}
+			NetInput input;
+			memcpy(&input, packet + sizeof(header) + i * sizeof(NetInput), sizeof(NetInput));
+			*inputAt(session, remote, frame) = input;
+			session->confirmed_frame[remote] = frame;
+			if (frame < session->frame && !sameInput(&input, &session->predicted[frame & (NET_INPUT_HISTORY - 1)])) {
+				if (session->rollback_frame < 0 || frame < session->rollback_frame) {
+					session->rollback_frame = frame;
+				}
+			}
+		}
+	}
+}
+
+static void rollbackSimulate(RollbackSession * session, int32 frame, bool resimulating) {
+	int32 local = session->local_player;
+	int32 remote = 1 - local;
+	NetInput inputs[NET_MAX_PLAYERS];
+	inputs[local] = *inputAt(session, local, frame);
+	if (frame <= session->confirmed_frame[remote]) {
+		inputs[remote] = *inputAt(session, remote, frame);
+	}
+	else if (session->confirmed_frame[remote] >= 0) {
+		inputs[remote] = *inputAt(session, remote, session->confirmed_frame[remote]);
+	}
+	else {
+		inputs[remote] = {};
+	}
+	session->predicted[frame & (NET_INPUT_HISTORY - 1)] = inputs[remote];
+
+	session->callbacks.save_state(session->callbacks.context, frame);
+	session->callbacks.advance_frame(session->callbacks.context, inputs, resimulating);
+}
+
+int32 rollbackAdvance(RollbackSession * session) {
+	int32 remote = 1 - session->local_player;
+	rollbackReceiveInputs(session);
+
+	int32 resimulated = 0;
+	if (session->rollback_frame >= 0) {
+		session->callbacks.load_state(session->callbacks.context, session->rollback_frame);
+		for (int32 frame = session->rollback_frame; frame < session->frame; frame++) {
+			rollbackSimulate(session, frame, true);
+			resimulated++;
+		}
+		session->rollback_frame = -1;
+		session->rollbacks++;
+		session->resimulated_frames += resimulated;
+		session->max_resimulated_frames = MAX(session->max_resimulated_frames, (uint32)resimulated);
+	}
+
+	bool too_far_ahead = session->frame - session->confirmed_frame[remote] > ROLLBACK_MAX_FRAMES;
+	bool missing_local_input = session->frame > session->confirmed_frame[session->local_player];
+	if (too_far_ahead || missing_local_input) {
+		session->stalled_frames++;
+		rollbackSendInputs(session);
+		return -1;
+	}
+
+	rollbackSimulate(session, session->frame, false);
+	session->frame++;
+	rollbackSendInputs(session);
+	return resimulated;
+}
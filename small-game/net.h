@@ -0,0 +1,91 @@
+#pragma once
+
+#include <SDL.h>
+#include "definitions.h"
+
+#define NET_MAX_PACKET 512
+#define NET_MAX_PLAYERS 2
+// Input ring size, must be a power of two. It bounds the input delay, see rollbackStart
+#define NET_INPUT_HISTORY 64
+// How many frames the simulation may run ahead of the last confirmed remote input
+#define ROLLBACK_MAX_FRAMES 12
+
+// A datagram transport. Implementations never block: receive returns 0 when nothing is pending.
+struct NetTransport {
+	void * context;
+	bool (*send)(void * context, const uint8 * data, uint32 size);
+	int32 (*receive)(void * context, uint8 * data, uint32 capacity);
+};
+
+bool netStartup();
+void netShutdown();
+
+bool udpTransportOpen(NetTransport * transport, uint16 local_port, const char * remote_host, uint16 remote_port);
+void udpTransportClose(NetTransport * transport);
+
+// Wraps another transport, dropping and delaying outgoing packets to test bad connections over loopback
+#define LOSSY_MAX_PENDING 256
+struct LossyPacket {
+	uint32 deliver_at;
+	uint32 size;
+	uint8 data[NET_MAX_PACKET];
+};
+
+struct LossyTransport {
+	NetTransport * inner;
+	real32 loss; // 0 to 1
+	uint32 delay_ms;
+	uint32 jitter_ms;
+	uint32 rng;
+	LossyPacket pending[LOSSY_MAX_PENDING];
+	uint32 num_pending;
+};
+
+void lossyTransportWrap(NetTransport * transport, LossyTransport * lossy, NetTransport * inner, real32 loss, uint32 delay_ms, uint32 jitter_ms);
+
+// One player's input for one frame, everything the simulation reads from a controller
+struct NetInput {
+	int8 move_x; // -127 to 127
+	int8 move_y;
+	uint8 buttons;
+};
+
+enum {
+	NET_BUTTON_START = 1,
+	NET_BUTTON_SELECT = 2,
+};
+
+// How the session drives the game: states are saved and loaded by frame number
+struct RollbackCallbacks {
+	void * context;
+	void (*save_state)(void * context, int32 frame);
+	void (*load_state)(void * context, int32 frame);
+	void (*advance_frame)(void * context, const NetInput * inputs, bool resimulating);
+};
+
+// GGPO style rollback between two peers: remote input is predicted by repeating the last one received,
+// and when the real input turns out different the game is rolled back and re-simulated from that frame
+struct RollbackSession {
+	NetTransport * transport;
+	RollbackCallbacks callbacks;
+	int32 local_player;
+	int32 input_delay;
+	int32 frame; // next frame to simulate
+	int32 confirmed_frame[NET_MAX_PLAYERS]; // newest frame with a known input for each player
+	int32 remote_ack; // newest local input frame the remote has received
+	int32 rollback_frame; // oldest frame simulated with a wrong prediction, -1 if none
+	NetInput inputs[NET_MAX_PLAYERS][NET_INPUT_HISTORY];
+	NetInput predicted[NET_INPUT_HISTORY]; // remote inputs the simulation used
+
+	uint32 rollbacks;
+	uint32 resimulated_frames;
+	uint32 max_resimulated_frames;
+	uint32 stalled_frames;
+};
+
+void rollbackStart(RollbackSession * session, NetTransport * transport, const RollbackCallbacks * callbacks, int32 local_player, int32 input_delay);
+// Sets the local input for frame + input_delay
+void rollbackAddLocalInput(RollbackSession * session, NetInput input);
+// Receives, rolls back and re-simulates if needed, then simulates one frame.
+// Returns the number of frames re-simulated, or -1 when waiting for the remote player.
+int32 rollbackAdvance(RollbackSession * session);